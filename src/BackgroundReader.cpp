@@ -0,0 +1,179 @@
+#include <iodrivers_base/BackgroundReader.hpp>
+#include <iodrivers_base/Driver.hpp>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+using namespace std;
+using namespace iodrivers_base;
+
+BackgroundReader::BackgroundReader(Driver& driver, size_t slot_count)
+    : m_driver(driver)
+    , m_slot_count(slot_count)
+    , m_slot_size(driver.MAX_PACKET_SIZE)
+    , m_slots(slot_count * driver.MAX_PACKET_SIZE)
+    , m_sizes(slot_count)
+    , m_poll_period(base::Time::fromMilliseconds(100))
+    , m_quit(false)
+    , m_running(false)
+    , m_head(0)
+    , m_tail(0)
+    , m_dropped(0)
+{
+    if (slot_count == 0)
+        throw std::invalid_argument("BackgroundReader: slot_count cannot be zero");
+}
+
+BackgroundReader::~BackgroundReader()
+{
+    m_quit = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void BackgroundReader::setPollPeriod(base::Time const& period)
+{
+    m_poll_period = period;
+}
+
+void BackgroundReader::start(int cpu)
+{
+    if (m_running)
+        throw std::logic_error("BackgroundReader: already running");
+    if (m_thread.joinable())
+        m_thread.join();
+
+#ifdef __linux__
+    if (cpu >= CPU_SETSIZE)
+        throw std::invalid_argument("BackgroundReader: invalid CPU " + std::to_string(cpu));
+#endif
+
+    m_quit = false;
+    m_running = true;
+    m_error = nullptr;
+
+    // The thread pins itself before it reads anything, and reports whether
+    // it managed to
+    promise<int> pinned;
+    future<int> pin_result = pinned.get_future();
+    m_thread = std::thread(&BackgroundReader::run, this, cpu, std::move(pinned));
+    int ret = pin_result.get();
+    if (ret != 0) {
+        m_thread.join();
+        throw UnixError("BackgroundReader: cannot pin the reader thread", ret);
+    }
+}
+
+void BackgroundReader::stop()
+{
+    m_quit = true;
+    if (m_thread.joinable())
+        m_thread.join();
+
+    if (m_error) {
+        exception_ptr error = m_error;
+        m_error = nullptr;
+        rethrow_exception(error);
+    }
+}
+
+bool BackgroundReader::isRunning() const
+{
+    return m_running;
+}
+
+/** Pins the calling thread to a CPU
+ *
+ * @return zero on success, an error code otherwise
+ */
+static int pinCurrentThread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#else
+    return ENOTSUP;
+#endif
+}
+
+void BackgroundReader::run(int cpu, promise<int> pinned)
+{
+    int pin_error = cpu >= 0 ? pinCurrentThread(cpu) : 0;
+    if (pin_error) {
+        m_running = false;
+        pinned.set_value(pin_error);
+        return;
+    }
+    pinned.set_value(0);
+
+    // Used to read packets while the ring is full, allocated once
+    vector<uint8_t> overflow(m_slot_size);
+
+    try {
+        while (!m_quit.load(memory_order_relaxed)) {
+            size_t tail = m_tail.load(memory_order_relaxed);
+            uint8_t* slot = &m_slots[(tail % m_slot_count) * m_slot_size];
+            bool full = (tail - m_head.load(memory_order_acquire) == m_slot_count);
+
+            int size;
+            try {
+                size = m_driver.readPacket(
+                    full ? overflow.data() : slot, m_slot_size, m_poll_period
+                );
+            }
+            catch(TimeoutError const&) {
+                if (m_driver.eof())
+                    break;
+                continue;
+            }
+
+            if (full) {
+                // The consumer may have popped packets in the meantime
+                if (tail - m_head.load(memory_order_acquire) == m_slot_count) {
+                    m_dropped.fetch_add(1, memory_order_relaxed);
+                    continue;
+                }
+                memcpy(slot, overflow.data(), size);
+            }
+
+            m_sizes[tail % m_slot_count] = size;
+            m_tail.store(tail + 1, memory_order_release);
+        }
+    }
+    catch(...) {
+        m_error = current_exception();
+    }
+    m_running = false;
+}
+
+PacketView BackgroundReader::front() const
+{
+    size_t head = m_head.load(memory_order_relaxed);
+    if (head == m_tail.load(memory_order_acquire))
+        return PacketView();
+
+    size_t index = head % m_slot_count;
+    return PacketView(&m_slots[index * m_slot_size], m_sizes[index]);
+}
+
+void BackgroundReader::pop()
+{
+    size_t head = m_head.load(memory_order_relaxed);
+    if (head == m_tail.load(memory_order_acquire))
+        return;
+    m_head.store(head + 1, memory_order_release);
+}
+
+size_t BackgroundReader::size() const
+{
+    return m_tail.load(memory_order_acquire) - m_head.load(memory_order_relaxed);
+}
+
+uint64_t BackgroundReader::getDroppedCount() const
+{
+    return m_dropped.load(memory_order_relaxed);
+}
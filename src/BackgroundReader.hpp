@@ -0,0 +1,123 @@
+#ifndef IODRIVERS_BASE_BACKGROUND_READER_HPP
+#define IODRIVERS_BASE_BACKGROUND_READER_HPP
+
+#include <base/Time.hpp>
+#include <iodrivers_base/PacketView.hpp>
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace iodrivers_base {
+    class Driver;
+
+    /** Reads packets from a driver in a dedicated thread
+     *
+     * The thread calls Driver::readPacket in a loop and stores the packets
+     * directly in a ring of preallocated slots. The application thread gets
+     * them with front() and pop(), which do neither system calls nor
+     * locking. This decouples the application's timing from the I/O jitter
+     * of slow devices.
+     *
+     * The ring is a single-producer/single-consumer queue: only one thread
+     * may call front() and pop(). When the ring is full, new packets are
+     * dropped and counted (see getDroppedCount).
+     *
+     * The driver must not be used by any other thread while the reader is
+     * running.
+     */
+    class BackgroundReader
+    {
+    public:
+        /**
+         * @param driver the driver. It is not owned by the reader
+         * @param slot_count the number of packets the ring can hold. Each
+         *   slot is MAX_PACKET_SIZE bytes
+         */
+        BackgroundReader(Driver& driver, size_t slot_count = 64);
+
+        /** Stops the reader thread if it is running */
+        ~BackgroundReader();
+
+        /** Sets how long each readPacket call in the reader thread may wait
+         *
+         * This bounds the time stop() takes. Defaults to 100ms
+         */
+        void setPollPeriod(base::Time const& period);
+
+        /** Starts the reader thread
+         *
+         * @param cpu if non-negative, the reader thread is pinned to this CPU
+         *   before it reads anything
+         * @throws std::logic_error if the reader is already running
+         * @throws std::invalid_argument if cpu is not a valid CPU index
+         * @throws UnixError if the thread cannot be pinned. The driver has
+         *   not been read then
+         */
+        void start(int cpu = -1);
+
+        /** Stops the reader thread and waits for it to finish
+         *
+         * Packets already in the ring stay available. If the thread stopped
+         * because of an exception, it is rethrown here.
+         */
+        void stop();
+
+        /** Whether the reader thread is running
+         *
+         * It stops by itself if the driver reaches end-of-file or if reading
+         * fails with an exception
+         */
+        bool isRunning() const;
+
+        /** Returns the oldest packet in the ring, or an empty view if there
+         * is none
+         *
+         * The view stays valid until the next call to pop()
+         */
+        PacketView front() const;
+
+        /** Removes the oldest packet from the ring
+         *
+         * It is a no-op if the ring is empty
+         */
+        void pop();
+
+        /** Number of packets currently in the ring */
+        size_t size() const;
+
+        /** Number of packets dropped because the ring was full */
+        uint64_t getDroppedCount() const;
+
+    private:
+        /** The reader thread
+         *
+         * @param cpu the CPU to pin the thread to, or -1
+         * @param pinned set to zero once the thread is pinned, or to the
+         *   error code if pinning failed. The thread then exits right away
+         */
+        void run(int cpu, std::promise<int> pinned);
+
+        Driver& m_driver;
+        size_t const m_slot_count;
+        size_t const m_slot_size;
+        std::vector<uint8_t> m_slots;
+        std::vector<int> m_sizes;
+        base::Time m_poll_period;
+
+        std::thread m_thread;
+        std::atomic<bool> m_quit;
+        std::atomic<bool> m_running;
+        std::exception_ptr m_error;
+
+        /** Index of the next slot to pop. Only written by the consumer */
+        alignas(64) std::atomic<size_t> m_head;
+        /** Index of the next slot to fill. Only written by the producer */
+        alignas(64) std::atomic<size_t> m_tail;
+        alignas(64) std::atomic<uint64_t> m_dropped;
+    };
+}
+
+#endif
@@ -0,0 +1,308 @@
+#include <iodrivers_base/Capture.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace iodrivers_base;
+using namespace iodrivers_base::capture;
+
+/** How long data may stay in the capture buffer before it gets written */
+static const chrono::milliseconds FLUSH_PERIOD(100);
+
+static uint64_t monotonicNow()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static void writeAll(int fd, uint8_t const* buffer, size_t size)
+{
+    while (size) {
+        ssize_t c = ::write(fd, buffer, size);
+        if (c < 0) {
+            if (errno == EINTR)
+                continue;
+            throw UnixError("cannot write to the capture file");
+        }
+        buffer += c;
+        size -= c;
+    }
+}
+
+CaptureListener::CaptureListener(string const& path, size_t buffer_size)
+    : m_buffer_size(buffer_size)
+    , m_start(monotonicNow())
+{
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1)
+        throw UnixError("cannot create capture file " + path);
+
+    FileHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.start_time = base::Time::now().toMicroseconds();
+    try {
+        writeAll(m_fd, reinterpret_cast<uint8_t const*>(&header), sizeof(header));
+    }
+    catch(...) {
+        ::close(m_fd);
+        throw;
+    }
+
+    m_front.reserve(buffer_size);
+    m_back.reserve(buffer_size);
+    m_thread = thread(&CaptureListener::writeThread, this);
+}
+
+CaptureListener::~CaptureListener()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake_writer.notify_one();
+    m_thread.join();
+    ::close(m_fd);
+}
+
+void CaptureListener::writeData(boost::uint8_t const* data, size_t size)
+{
+    append(DIRECTION_WRITE, data, size);
+}
+
+void CaptureListener::readData(boost::uint8_t const* data, size_t size)
+{
+    append(DIRECTION_READ, data, size);
+}
+
+void CaptureListener::append(Direction direction, uint8_t const* data, size_t size)
+{
+    if (!size)
+        return;
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.time = monotonicNow() - m_start;
+    header.size = size;
+    header.direction = direction;
+
+    size_t record_size = sizeof(header) + size;
+    bool wake_writer;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        size_t offset = m_front.size();
+        if (m_error || offset + record_size > m_buffer_size) {
+            m_dropped += size;
+            return;
+        }
+
+        // This stays within the reserved capacity, it does not allocate
+        m_front.resize(offset + record_size);
+        memcpy(&m_front[offset], &header, sizeof(header));
+        memcpy(&m_front[offset + sizeof(header)], data, size);
+        wake_writer = (offset < m_buffer_size / 2 &&
+                       m_front.size() >= m_buffer_size / 2);
+    }
+    if (wake_writer)
+        m_wake_writer.notify_one();
+}
+
+void CaptureListener::writeThread()
+{
+    unique_lock<mutex> lock(m_mutex);
+    while (true) {
+        m_wake_writer.wait_for(lock, FLUSH_PERIOD, [this] {
+            return m_quit || (!m_front.empty() &&
+                              (m_flushing || m_front.size() >= m_buffer_size / 2));
+        });
+        if (m_front.empty()) {
+            if (m_quit)
+                return;
+            continue;
+        }
+
+        m_front.swap(m_back);
+        m_writing = true;
+        lock.unlock();
+
+        exception_ptr error;
+        try {
+            writeAll(m_fd, m_back.data(), m_back.size());
+        }
+        catch(...) {
+            error = current_exception();
+        }
+        m_back.clear();
+
+        lock.lock();
+        if (error && !m_error)
+            m_error = error;
+        m_writing = false;
+        m_written.notify_all();
+    }
+}
+
+void CaptureListener::flush()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_flushing = true;
+    m_wake_writer.notify_one();
+    m_written.wait(lock, [this] { return m_front.empty() && !m_writing; });
+    m_flushing = false;
+    if (m_error)
+        rethrow_exception(m_error);
+}
+
+uint64_t CaptureListener::getDroppedBytes() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+ReplayStream::ReplayStream(string const& path, bool realtime)
+    : m_realtime(realtime)
+{
+    m_file = fopen(path.c_str(), "rbe");
+    if (!m_file)
+        throw UnixError("cannot open capture file " + path);
+
+    FileHeader header;
+    if (!readFile(&header, sizeof(header)) ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fclose(m_file);
+        throw invalid_argument(path + " is not a capture file");
+    }
+    if (header.version != VERSION) {
+        fclose(m_file);
+        throw invalid_argument(
+            path + " has an unsupported capture format version " +
+            to_string(header.version)
+        );
+    }
+
+    m_capture_start = base::Time::fromMicroseconds(header.start_time);
+    loadNextRecord();
+}
+
+ReplayStream::~ReplayStream()
+{
+    fclose(m_file);
+}
+
+bool ReplayStream::readFile(void* buffer, size_t size)
+{
+    return fread(buffer, 1, size, m_file) == size;
+}
+
+void ReplayStream::loadNextRecord()
+{
+    m_record_pos = 0;
+    RecordHeader header;
+    while (readFile(&header, sizeof(header))) {
+        if (header.direction != DIRECTION_READ || !header.size) {
+            if (fseek(m_file, header.size, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+
+        m_record.resize(header.size);
+        if (!readFile(m_record.data(), header.size))
+            break;
+        m_record_time = header.time;
+        return;
+    }
+
+    // End of the capture, or a truncated last record
+    m_record.clear();
+    m_end = true;
+}
+
+void ReplayStream::start()
+{
+    if (m_started)
+        return;
+
+    // Make the first captured read available right away
+    m_started = true;
+    m_replay_start = monotonicNow() - m_record_time;
+}
+
+uint64_t ReplayStream::getDeadline() const
+{
+    if (!m_realtime)
+        return 0;
+    return m_replay_start + m_record_time;
+}
+
+bool ReplayStream::waitRead(base::Time const& timeout)
+{
+    start();
+    if (m_end)
+        return true;
+
+    uint64_t now = monotonicNow();
+    uint64_t deadline = getDeadline();
+    if (deadline <= now)
+        return true;
+
+    uint64_t timeout_ns = timeout.toMicroseconds() * 1000;
+    if (deadline - now > timeout_ns) {
+        this_thread::sleep_for(chrono::nanoseconds(timeout_ns));
+        return false;
+    }
+    this_thread::sleep_for(chrono::nanoseconds(deadline - now));
+    return true;
+}
+
+bool ReplayStream::waitWrite(base::Time const&)
+{
+    return true;
+}
+
+size_t ReplayStream::read(uint8_t* buffer, size_t buffer_size)
+{
+    start();
+    if (m_end) {
+        m_eof = true;
+        return 0;
+    }
+    if (getDeadline() > monotonicNow())
+        return 0;
+
+    size_t size = min(buffer_size, m_record.size() - m_record_pos);
+    memcpy(buffer, &m_record[m_record_pos], size);
+    m_record_pos += size;
+    if (m_record_pos == m_record.size())
+        loadNextRecord();
+    return size;
+}
+
+size_t ReplayStream::write(uint8_t const*, size_t buffer_size)
+{
+    return buffer_size;
+}
+
+void ReplayStream::clear()
+{
+    start();
+    uint64_t now = monotonicNow();
+    while (!m_end && getDeadline() <= now)
+        loadNextRecord();
+}
+
+bool ReplayStream::eof() const
+{
+    return m_eof;
+}
+
+base::Time ReplayStream::getCaptureStartTime() const
+{
+    return m_capture_start;
+}
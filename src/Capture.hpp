@@ -0,0 +1,181 @@
+#ifndef IODRIVERS_BASE_CAPTURE_HPP
+#define IODRIVERS_BASE_CAPTURE_HPP
+
+#include <iodrivers_base/IOListener.hpp>
+#include <iodrivers_base/IOStream.hpp>
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace iodrivers_base {
+    /** Format of the capture files written by CaptureListener and read by
+     * ReplayStream
+     *
+     * A file is a FileHeader followed by records. Each record is a
+     * RecordHeader followed by the record's data. All integers are in the
+     * host's byte order. Records are only ever appended, so a file that has
+     * been cut short (e.g. because the process crashed) is valid up to its
+     * last complete record.
+     */
+    namespace capture {
+        static const char MAGIC[7] = { 'I', 'O', 'D', 'B', 'C', 'A', 'P' };
+        static const uint8_t VERSION = 1;
+
+        enum Direction : uint8_t {
+            /** Data the driver read from its device */
+            DIRECTION_READ = 0,
+            /** Data the driver wrote to its device */
+            DIRECTION_WRITE = 1
+        };
+
+        struct FileHeader
+        {
+            char magic[7];
+            uint8_t version;
+            /** Wall-clock time at which the capture started, in microseconds
+             * since the epoch
+             */
+            int64_t start_time;
+        };
+
+        struct RecordHeader
+        {
+            /** Time of the record, in nanoseconds since the start of the
+             * capture, measured with a monotonic clock
+             */
+            uint64_t time;
+            uint32_t size;
+            uint8_t direction;
+            uint8_t padding[3];
+        };
+    }
+
+    /** Listener that saves all the data that goes through a driver in a
+     * capture file, along with its direction and reception time
+     *
+     * The I/O thread only copies the data into a memory buffer. A background
+     * thread writes the buffer to disk, with large write calls. Data that
+     * does not fit in the buffer because the disk cannot keep up is dropped
+     * and counted (see getDroppedBytes), instead of blocking the I/O thread.
+     *
+     * The resulting file can be fed back into a driver with ReplayStream
+     */
+    class CaptureListener : public IOListener
+    {
+    public:
+        /**
+         * @param path the path of the capture file. It is truncated if it
+         *   already exists
+         * @param buffer_size the maximum number of bytes that are waiting to
+         *   be written to disk, headers included. Two buffers of this size
+         *   are allocated upfront. Chunks that are bigger than this are always
+         *   dropped
+         * @throws UnixError if the file cannot be created
+         */
+        explicit CaptureListener(std::string const& path,
+                                 size_t buffer_size = 4 * 1024 * 1024);
+
+        /** Writes the remaining buffered data and closes the file */
+        ~CaptureListener();
+
+        void writeData(boost::uint8_t const* data, size_t size) override;
+        void readData(boost::uint8_t const* data, size_t size) override;
+
+        /** Waits until all the data received so far has been written to
+         * disk
+         *
+         * @throws UnixError if writing to the file failed
+         */
+        void flush();
+
+        /** Number of bytes of data that have been dropped because the buffer
+         * was full
+         */
+        uint64_t getDroppedBytes() const;
+
+    private:
+        void append(capture::Direction direction, uint8_t const* data, size_t size);
+        void writeThread();
+
+        int m_fd;
+        size_t m_buffer_size;
+        uint64_t m_start;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wake_writer;
+        std::condition_variable m_written;
+        /** The buffer the I/O thread appends to */
+        std::vector<uint8_t> m_front;
+        /** The buffer the writer thread writes to disk */
+        std::vector<uint8_t> m_back;
+        bool m_writing = false;
+        bool m_flushing = false;
+        bool m_quit = false;
+        uint64_t m_dropped = 0;
+        std::exception_ptr m_error;
+        std::thread m_thread;
+    };
+
+    /** Stream that replays the data read in a capture file created by
+     * CaptureListener
+     *
+     * Each read() returns the data of at most one captured read, which
+     * preserves datagram boundaries. Data written to the stream is discarded.
+     * The stream reaches end-of-file after the last captured read.
+     */
+    class ReplayStream : public IOStream
+    {
+    public:
+        /**
+         * @param path the capture file
+         * @param realtime if true, the captured reads become available with
+         *   the same timing as in the original session, starting when the
+         *   stream is first waited on or read. Otherwise, they are all
+         *   available immediately
+         * @throws UnixError if the file cannot be opened
+         * @throws std::invalid_argument if the file is not a capture file
+         */
+        explicit ReplayStream(std::string const& path, bool realtime = true);
+        ~ReplayStream();
+
+        bool waitRead(base::Time const& timeout) override;
+        bool waitWrite(base::Time const& timeout) override;
+        size_t read(uint8_t* buffer, size_t buffer_size) override;
+        size_t write(uint8_t const* buffer, size_t buffer_size) override;
+
+        /** Skips the data that is already available */
+        void clear() override;
+        bool eof() const override;
+
+        /** Wall-clock time at which the capture started */
+        base::Time getCaptureStartTime() const;
+
+    private:
+        /** Loads the data of the next read record, skipping write records */
+        void loadNextRecord();
+        bool readFile(void* buffer, size_t size);
+        void start();
+        /** Monotonic time at which the current record becomes available, in
+         * nanoseconds
+         */
+        uint64_t getDeadline() const;
+
+        FILE* m_file;
+        bool m_realtime;
+        base::Time m_capture_start;
+
+        bool m_started = false;
+        uint64_t m_replay_start = 0;
+        std::vector<uint8_t> m_record;
+        uint64_t m_record_time = 0;
+        size_t m_record_pos = 0;
+        bool m_end = false;
+        bool m_eof = false;
+    };
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include <iodrivers_base/DatagramBatch.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace iodrivers_base;
+
+/** Maximum number of datagrams sent by a single DatagramBatch::send call */
+static const size_t SEND_BATCH = 64;
+
+void iodrivers_base::setReceiveTimestamps(int fd, bool enable)
+{
+#ifdef SO_TIMESTAMPNS
+    int value = enable ? 1 : 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) != 0)
+        throw UnixError("cannot change the receive timestamps option");
+#else
+    if (enable)
+        throw UnixError("receive timestamps are not supported", ENOTSUP);
+#endif
+}
+
+base::Time iodrivers_base::getReceiveTimestamp(msghdr const& msg)
+{
+#ifdef SO_TIMESTAMPNS
+    if (msg.msg_flags & MSG_CTRUNC)
+        return base::Time();
+
+    msghdr& header = const_cast<msghdr&>(msg);
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg;
+         cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return base::Time::fromMicroseconds(
+                static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+        }
+    }
+#endif
+    return base::Time();
+}
+
+size_t iodrivers_base::getReceiveTimestampControlSize()
+{
+    return CMSG_SPACE(sizeof(timespec));
+}
+
+DatagramBatch::DatagramBatch()
+    : m_datagram_size(0)
+{
+}
+
+DatagramBatch::DatagramBatch(size_t count, size_t datagram_size)
+    : m_datagram_size(datagram_size)
+    , m_slab(count * datagram_size)
+    , m_sizes(count)
+    , m_sources(count)
+    , m_source_sizes(count)
+#ifdef __linux__
+    , m_iovecs(count)
+    , m_headers(count)
+#endif
+{
+}
+
+bool DatagramBatch::isEnabled() const
+{
+    return !m_sizes.empty();
+}
+
+void DatagramBatch::setTimestamps(bool enable)
+{
+    if (enable) {
+        m_control.resize(m_sizes.size() * getReceiveTimestampControlSize());
+        m_timestamps.resize(m_sizes.size());
+    }
+    else {
+        m_control.clear();
+        m_timestamps.clear();
+    }
+}
+
+bool DatagramBatch::empty() const
+{
+    return m_next == m_count;
+}
+
+pair<int, int> DatagramBatch::receive(int fd)
+{
+    m_count = 0;
+    m_next = 0;
+    size_t count = m_sizes.size();
+
+#ifdef __linux__
+    // The kernel modifies the headers, and the batch may have been moved
+    // since the last call. Fill them again, this does not allocate
+    iovec* iovecs = m_iovecs.data();
+    mmsghdr* headers = m_headers.data();
+    for (size_t i = 0; i < count; ++i) {
+        iovecs[i].iov_base = &m_slab[i * m_datagram_size];
+        iovecs[i].iov_len = m_datagram_size;
+        memset(&headers[i], 0, sizeof(mmsghdr));
+        headers[i].msg_hdr.msg_iov = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+        headers[i].msg_hdr.msg_name = &m_sources[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        if (!m_control.empty()) {
+            size_t control_size = getReceiveTimestampControlSize();
+            headers[i].msg_hdr.msg_control = &m_control[i * control_size];
+            headers[i].msg_hdr.msg_controllen = control_size;
+        }
+    }
+
+    int ret = recvmmsg(fd, headers, count, MSG_DONTWAIT, NULL);
+    if (ret < 0)
+        return make_pair(ret, errno);
+
+    for (int i = 0; i < ret; ++i) {
+        m_sizes[i] = headers[i].msg_len;
+        m_source_sizes[i] = headers[i].msg_hdr.msg_namelen;
+        if (!m_timestamps.empty())
+            m_timestamps[i] = getReceiveTimestamp(headers[i].msg_hdr);
+    }
+    m_count = ret;
+    return make_pair(ret, 0);
+#else
+    for (size_t i = 0; i < count; ++i) {
+        m_source_sizes[i] = sizeof(sockaddr_storage);
+        ssize_t ret = ::recvfrom(
+            fd, &m_slab[i * m_datagram_size], m_datagram_size, MSG_DONTWAIT,
+            reinterpret_cast<sockaddr*>(&m_sources[i]), &m_source_sizes[i]
+        );
+        if (ret < 0) {
+            if (i == 0)
+                return make_pair(-1, errno);
+            break;
+        }
+        m_sizes[i] = ret;
+        m_count = i + 1;
+    }
+    return make_pair(m_count, 0);
+#endif
+}
+
+size_t DatagramBatch::pop(uint8_t* buffer, size_t buffer_size,
+                          sockaddr* from, socklen_t* from_len)
+{
+    int index = m_next++;
+    m_last_timestamp =
+        m_timestamps.empty() ? base::Time() : m_timestamps[index];
+    size_t size = std::min(buffer_size, m_sizes[index]);
+    memcpy(buffer, &m_slab[index * m_datagram_size], size);
+    if (from) {
+        socklen_t source_size = m_source_sizes[index];
+        memcpy(from, &m_sources[index], std::min(*from_len, source_size));
+        *from_len = source_size;
+    }
+    return size;
+}
+
+base::Time DatagramBatch::getLastTimestamp() const
+{
+    return m_last_timestamp;
+}
+
+pair<int, int> DatagramBatch::send(
+    int fd, PacketView const* datagrams, size_t count,
+    sockaddr const* to, socklen_t to_len
+) {
+#ifdef __linux__
+    iovec iovecs[SEND_BATCH];
+    mmsghdr headers[SEND_BATCH];
+    count = std::min(count, SEND_BATCH);
+    for (size_t i = 0; i < count; ++i) {
+        iovecs[i].iov_base = const_cast<uint8_t*>(datagrams[i].data);
+        iovecs[i].iov_len = datagrams[i].size;
+        memset(&headers[i], 0, sizeof(mmsghdr));
+        headers[i].msg_hdr.msg_iov = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+        headers[i].msg_hdr.msg_name = const_cast<sockaddr*>(to);
+        headers[i].msg_hdr.msg_namelen = to ? to_len : 0;
+    }
+
+    int ret = sendmmsg(fd, headers, count, 0);
+    return make_pair(ret, ret < 0 ? errno : 0);
+#else
+    for (size_t i = 0; i < count; ++i) {
+        ssize_t ret = ::sendto(fd, datagrams[i].data, datagrams[i].size, 0,
+                               to, to ? to_len : 0);
+        if (ret < 0) {
+            if (i == 0)
+                return make_pair(-1, errno);
+            return make_pair(static_cast<int>(i), 0);
+        }
+    }
+    return make_pair(static_cast<int>(count), 0);
+#endif
+}
@@ -0,0 +1,125 @@
+#ifndef IODRIVERS_BASE_DATAGRAM_BATCH_HPP
+#define IODRIVERS_BASE_DATAGRAM_BATCH_HPP
+
+#include <base/Time.hpp>
+#include <iodrivers_base/PacketView.hpp>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <utility>
+#include <vector>
+
+namespace iodrivers_base {
+    /** Enables or disables kernel receive timestamps (SO_TIMESTAMPNS) on a
+     * socket
+     *
+     * @throws UnixError if the socket does not support it
+     */
+    void setReceiveTimestamps(int fd, bool enable);
+
+    /** Returns the receive timestamp stored in the control data of a
+     * message received with recvmsg, or a null time if there is none
+     */
+    base::Time getReceiveTimestamp(msghdr const& msg);
+
+    /** Size of the control buffer needed to receive a timestamp with recvmsg
+     */
+    size_t getReceiveTimestampControlSize();
+
+    /** Receives and sends datagrams in batches, using recvmmsg and sendmmsg
+     *
+     * Received datagrams are stored in a slab and handed over one at a time
+     * with pop(), so that the datagram boundaries are kept.
+     *
+     * This is a helper for the datagram streams (UDPServerStream and
+     * UnixDatagramStream). A batch whose count is zero is disabled.
+     */
+    class DatagramBatch
+    {
+    public:
+        DatagramBatch();
+
+        /**
+         * @param count the maximum number of datagrams received at once
+         * @param datagram_size the maximum size of a single datagram. Bigger
+         *   datagrams are truncated, as with recvfrom
+         */
+        DatagramBatch(size_t count, size_t datagram_size);
+
+        /** Whether the batch has been configured with a non-zero count */
+        bool isEnabled() const;
+
+        /** Sets whether the kernel receive timestamps are retrieved along
+         * with the datagrams
+         *
+         * The timestamps must also be enabled on the socket, see
+         * setReceiveTimestamps
+         */
+        void setTimestamps(bool enable);
+
+        /** Whether all received datagrams have been popped */
+        bool empty() const;
+
+        /** Receives as many datagrams as available, without blocking
+         *
+         * Datagrams that have not been popped yet are discarded
+         *
+         * @return the number of received datagrams or -1, and the value of
+         *   errno
+         */
+        std::pair<int, int> receive(int fd);
+
+        /** Copies the next received datagram into the buffer
+         *
+         * The datagram is truncated if the buffer is too small
+         *
+         * @param from if non-NULL, set to the datagram's source address
+         * @param from_len the size of from on input, the size of the source
+         *   address on output
+         * @return the size of the copied data
+         */
+        size_t pop(uint8_t* buffer, size_t buffer_size,
+                   sockaddr* from, socklen_t* from_len);
+
+        /** Kernel receive timestamp of the last popped datagram
+         *
+         * It is null if timestamps are not enabled
+         */
+        base::Time getLastTimestamp() const;
+
+        /** Sends datagrams with a single sendmmsg call
+         *
+         * At most 64 datagrams are sent per call. The headers are on the
+         * stack, so it does not allocate
+         *
+         * @param to the destination address. Can be NULL on connected sockets
+         * @return the number of sent datagrams or -1, and the value of errno
+         */
+        static std::pair<int, int> send(
+            int fd, PacketView const* datagrams, size_t count,
+            sockaddr const* to, socklen_t to_len
+        );
+
+    private:
+        size_t m_datagram_size;
+        std::vector<uint8_t> m_slab;
+        std::vector<size_t> m_sizes;
+        std::vector<sockaddr_storage> m_sources;
+        std::vector<socklen_t> m_source_sizes;
+        std::vector<uint8_t> m_control;
+#ifdef __linux__
+        /** Headers given to recvmmsg, allocated upfront to keep receive()
+         * free of allocations
+         */
+        std::vector<iovec> m_iovecs;
+        std::vector<mmsghdr> m_headers;
+#endif
+        std::vector<base::Time> m_timestamps;
+        base::Time m_last_timestamp;
+        int m_count = 0;
+        int m_next = 0;
+    };
+}
+
+#endif
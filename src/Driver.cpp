@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include <termios.h>
@@ -17,7 +18,9 @@
 #include <cstring>
 #include <sstream>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <typeinfo>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -31,6 +34,8 @@
 #include <iodrivers_base/IOStream.hpp>
 #include <iodrivers_base/IOListener.hpp>
 #include <iodrivers_base/TestStream.hpp>
+#include <iodrivers_base/IOUringStream.hpp>
+#include <iodrivers_base/Capture.hpp>
 
 #ifdef __gnu_linux__
 #include <linux/serial.h>
@@ -91,8 +96,27 @@ string Driver::binary_com(char const* str, size_t str_size)
     return result.str();
 }
 
+struct Driver::LatencyMonitor
+{
+    LatencyHistogram packet;
+    LatencyHistogram wait_read;
+    LatencyHistogram extract;
+    LatencyHistogram write;
+
+    /** Reception time of the bytes at the front of the internal buffer, or
+     * zero if it is empty
+     */
+    uint64_t first_byte_time = 0;
+    /** Time and size of the last read into the internal buffer */
+    uint64_t last_read_time = 0;
+    size_t last_read_size = 0;
+};
+
 Driver::Driver(int max_packet_size, bool extract_last)
-    : internal_buffer(new uint8_t[max_packet_size]), internal_buffer_size(0)
+    : internal_buffer(new uint8_t[max_packet_size])
+    , internal_buffer_capacity(max_packet_size)
+    , internal_buffer_start(0), internal_buffer_size(0)
+    , internal_buffer_view_size(0)
     , MAX_PACKET_SIZE(max_packet_size)
     , m_stream(0), m_auto_close(true), m_extract_last(extract_last)
 {
@@ -102,7 +126,10 @@ Driver::Driver(int max_packet_size, bool extract_last)
 
 Driver::~Driver()
 {
-    delete[] internal_buffer;
+    if (m_lock_receive_buffer)
+        munlock(internal_buffer, internal_buffer_capacity);
+    if (internal_buffer_owned)
+        delete[] internal_buffer;
     delete m_stream;
     for (set<IOListener*>::iterator it = m_listeners.begin(); it != m_listeners.end(); ++it)
         delete *it;
@@ -112,6 +139,8 @@ void Driver::setMainStream(IOStream* stream)
 {
     delete m_stream;
     m_stream = stream;
+    if (m_stream && m_receive_timestamps)
+        m_stream->setReceiveTimestamps(true);
 }
 
 IOStream* Driver::getMainStream() const
@@ -129,23 +158,201 @@ void Driver::removeListener(IOListener* listener)
     m_listeners.erase(listener);
 }
 
+bool Driver::hasListeners() const
+{
+    return !m_listeners.empty();
+}
+
 void Driver::clear()
 {
     if (m_stream)
         m_stream->clear();
+    internal_buffer_start = 0;
     internal_buffer_size = 0;
+    internal_buffer_view_size = 0;
+    internal_buffer_packets.clear();
+    internal_buffer_stamps.clear();
+    invalidateScan();
+    m_stats.setQueuedBytes(0);
+    if (m_latencies)
+        m_latencies->first_byte_time = 0;
 }
 
 Status Driver::getStatus() const
+{ return m_stats.snapshot(); }
+void Driver::resetStatus()
+{ m_stats.reset(); }
+
+void Driver::setStatusStampMode(STATUS_STAMP_MODE mode)
 {
-    m_stats.queued_bytes = internal_buffer_size;
-    return m_stats;
+    m_status_stamp_mode = mode;
+    m_stats.setAutoStamp(mode == STAMP_ON_UPDATE);
+}
+Driver::STATUS_STAMP_MODE Driver::getStatusStampMode() const
+{ return m_status_stamp_mode; }
+
+void Driver::setLatencyMonitoring(bool enable)
+{
+    if (!enable)
+        m_latencies.reset();
+    else if (!m_latencies)
+        m_latencies.reset(new LatencyMonitor);
+}
+bool Driver::getLatencyMonitoring() const { return m_latencies != nullptr; }
+Latencies Driver::getLatencies() const
+{
+    Latencies result;
+    if (m_latencies) {
+        result.packet = m_latencies->packet.snapshot();
+        result.wait_read = m_latencies->wait_read.snapshot();
+        result.extract = m_latencies->extract.snapshot();
+        result.write = m_latencies->write.snapshot();
+    }
+    return result;
+}
+void Driver::resetLatencies()
+{
+    if (m_latencies) {
+        m_latencies->packet.reset();
+        m_latencies->wait_read.reset();
+        m_latencies->extract.reset();
+        m_latencies->write.reset();
+    }
+}
+
+int Driver::timedExtractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    if (!m_latencies)
+        return extractPacket(buffer, buffer_size);
+
+    uint64_t start = LatencyHistogram::now();
+    int result = extractPacket(buffer, buffer_size);
+    m_latencies->extract.record(LatencyHistogram::now() - start);
+    return result;
+}
+
+bool Driver::timedWaitRead(Time const& timeout)
+{
+    if (!m_latencies)
+        return m_stream->waitRead(timeout);
+
+    uint64_t start = LatencyHistogram::now();
+    bool result = m_stream->waitRead(timeout);
+    m_latencies->wait_read.record(LatencyHistogram::now() - start);
+    return result;
 }
-void Driver::resetStatus()
-{ m_stats = Status(); }
 
-void Driver::setExtractLastPacket(bool flag) { m_extract_last = flag; }
+void Driver::setExtractLastPacket(bool flag)
+{
+    m_extract_last = flag;
+    invalidateScan();
+}
 bool Driver::getExtractLastPacket() const { return m_extract_last; }
+void Driver::setDatagramMode(bool flag)
+{
+    internal_buffer_start = 0;
+    internal_buffer_size = 0;
+    internal_buffer_view_size = 0;
+    internal_buffer_packets.clear();
+    internal_buffer_stamps.clear();
+    invalidateScan();
+    m_stats.setQueuedBytes(0);
+    if (m_latencies)
+        m_latencies->first_byte_time = 0;
+    m_datagram_mode = flag;
+}
+bool Driver::getDatagramMode() const { return m_datagram_mode; }
+void Driver::setReceiveTimestamps(bool enable)
+{
+    if (m_stream)
+        m_stream->setReceiveTimestamps(enable);
+    m_receive_timestamps = enable;
+    if (!enable) {
+        internal_buffer_stamps.clear();
+        m_last_packet_time = Time();
+    }
+}
+bool Driver::getReceiveTimestamps() const { return m_receive_timestamps; }
+Time Driver::getLastPacketTime() const { return m_last_packet_time; }
+Time Driver::getPacketTime(PacketView const& packet) const
+{
+    uint8_t const* start = internal_buffer + internal_buffer_start;
+    if (packet.data < start || packet.data >= start + internal_buffer_size)
+        return Time();
+    return getReceiveTime(packet.data - start);
+}
+Time Driver::getReceiveTime(size_t offset) const
+{
+    uint64_t position = internal_buffer_position + offset;
+    for (auto it = internal_buffer_stamps.rbegin();
+         it != internal_buffer_stamps.rend(); ++it) {
+        if (it->first <= position)
+            return it->second;
+    }
+    return Time();
+}
+/** Touches all the pages of the given memory region and locks them */
+static void lockMemory(uint8_t* buffer, size_t size)
+{
+    volatile uint8_t* touch = buffer;
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page_size)
+        touch[i] = touch[i];
+    if (size)
+        touch[size - 1] = touch[size - 1];
+
+    if (mlock(buffer, size) != 0)
+        throw UnixError("cannot lock the receive buffer in memory");
+}
+
+void Driver::replaceInternalBuffer(uint8_t* buffer, size_t size, bool owned)
+{
+    if (size < (size_t)MAX_PACKET_SIZE)
+        throw std::invalid_argument("the receive buffer must be at least MAX_PACKET_SIZE bytes");
+
+    releasePacket();
+    if (size < internal_buffer_size)
+        throw std::invalid_argument("the receive buffer is smaller than the amount of data currently buffered");
+
+    if (m_lock_receive_buffer)
+        lockMemory(buffer, size);
+
+    memmove(buffer, internal_buffer + internal_buffer_start, internal_buffer_size);
+    if (m_lock_receive_buffer)
+        munlock(internal_buffer, internal_buffer_capacity);
+    if (internal_buffer_owned)
+        delete[] internal_buffer;
+    internal_buffer = buffer;
+    internal_buffer_capacity = size;
+    internal_buffer_owned = owned;
+    internal_buffer_start = 0;
+}
+
+void Driver::setReceiveBufferSize(size_t size)
+{
+    unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+    replaceInternalBuffer(buffer.get(), size, true);
+    buffer.release();
+}
+size_t Driver::getReceiveBufferSize() const { return internal_buffer_capacity; }
+void Driver::setReceiveBuffer(uint8_t* buffer, size_t size)
+{
+    replaceInternalBuffer(buffer, size, false);
+}
+void Driver::setReceiveBufferLocked(bool lock)
+{
+    if (lock == m_lock_receive_buffer)
+        return;
+    else if (lock)
+        lockMemory(internal_buffer, internal_buffer_capacity);
+    else
+        munlock(internal_buffer, internal_buffer_capacity);
+    m_lock_receive_buffer = lock;
+}
+bool Driver::isReceiveBufferLocked() const { return m_lock_receive_buffer; }
+void Driver::setScanBudget(int bytes) { m_scan_budget = bytes; }
+int Driver::getScanBudget() const { return m_scan_budget; }
+bool Driver::isScanBudgetExhausted() const { return m_scan_budget_exhausted; }
 
 void Driver::setFileDescriptor(int fd, bool auto_close, bool has_eof)
 {
@@ -158,14 +365,20 @@ int Driver::getFileDescriptor() const
         return m_stream->getFileDescriptor();
     return FDStream::INVALID_FD;
 }
+int Driver::getDeviceFileDescriptor() const
+{
+    if (auto uring_stream = dynamic_cast<IOUringStream*>(m_stream))
+        return uring_stream->getDeviceFileDescriptor();
+    return getFileDescriptor();
+}
 bool Driver::isValid() const { return m_stream; }
 
 static void validateURIScheme(std::string const& scheme) {
-    char const* knownSchemes[11] =
+    char const* knownSchemes[12] =
         {"serial", "tcp", "udp", "udpserver", "file", "test",
          "fd", "unixstreamserver", "unixstream",
-         "unixdgramserver", "unixdgram"};
-    for (int i = 0; i < 11; ++i) {
+         "unixdgramserver", "unixdgram", "replay"};
+    for (int i = 0; i < 12; ++i) {
         if (scheme == knownSchemes[i]) {
             return;
         }
@@ -174,6 +387,25 @@ static void validateURIScheme(std::string const& scheme) {
     throw std::runtime_error("unknown scheme " + scheme);
 }
 
+/** Largest value of the batch option. It is the maximum number of messages
+ * recvmmsg processes in a single call (UIO_MAXIOV)
+ */
+static const int MAX_DATAGRAM_BATCH = 1024;
+
+static int parseDatagramBatchSize(string const& value) {
+    char* end;
+    errno = 0;
+    long result = strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE ||
+        result < 0 || result > MAX_DATAGRAM_BATCH) {
+        throw std::invalid_argument(
+            "invalid batch parameter " + value + " in URI, expected a value "
+            "between 0 and " + to_string(MAX_DATAGRAM_BATCH) + " (inclusive)"
+        );
+    }
+    return result;
+}
+
 /** Backward-compatibility code to handle the old syntax udp://host:remote_port:local_port
  *
  * It transforms it into the new udp://host:remote_port?local_port=PORT URI
@@ -207,6 +439,36 @@ void Driver::openURI(std::string const& uri_string) {
     string scheme = uri.getScheme();
     validateURIScheme(scheme);
 
+    // Validate the options before opening, so that an invalid URI does not
+    // leave the driver open
+    SocketConfiguration socket_config = SocketConfiguration::fromURI(uri);
+    if (!socket_config.empty() &&
+        scheme != "tcp" && scheme != "udp" && scheme != "udpserver") {
+        throw std::invalid_argument(
+            "socket options are only supported by the tcp, udp and "
+            "udpserver URIs"
+        );
+    }
+    string batch = uri.getOption("batch");
+    int batch_size = batch.empty() ? -1 : parseDatagramBatchSize(batch);
+    if (batch_size >= 0 &&
+        scheme != "udp" && scheme != "udpserver" &&
+        scheme != "unixdgram" && scheme != "unixdgramserver") {
+        throw std::invalid_argument(
+            "the batch option is only supported by the udp, udpserver, "
+            "unixdgram and unixdgramserver URIs"
+        );
+    }
+    bool io_uring = uri.getOption("io_uring", "0") == "1";
+    if (io_uring &&
+        scheme != "serial" && scheme != "tcp" && scheme != "file" &&
+        scheme != "fd" && scheme != "unixstream") {
+        throw std::invalid_argument(
+            "the io_uring option is only supported by the serial, tcp, file, fd "
+            "and unixstream URIs"
+        );
+    }
+
     if (scheme == "serial") { // serial://DEVICE:baudrate
         if (uri.getPort() == 0) {
             throw std::invalid_argument("missing baud rate specification in serial URI");
@@ -226,29 +488,114 @@ void Driver::openURI(std::string const& uri_string) {
         openUDPServer(stoi(uri.getHost()));
     }
     else if (scheme == "file") { // file file://path
-        return openFile(uri.getHost());
+        openFile(uri.getHost());
     }
     else if (scheme == "unixstreamserver") {
-        return openUnixStreamServer(uri.getHost());
+        openUnixStreamServer(uri.getHost());
     }
     else if (scheme == "unixstream") {
-        return openUnixStreamClient(uri.getHost());
+        openUnixStreamClient(uri.getHost());
     }
     else if (scheme == "unixdgramserver") {
-        return openUnixDatagramServer(uri.getHost());
+        openUnixDatagramServer(uri.getHost());
     }
     else if (scheme == "unixdgram") {
-        return openUnixDatagramClient(uri.getHost());
+        openUnixDatagramClient(uri.getHost());
     }
     else if (scheme == "test") { // test://
         if (!dynamic_cast<TestStream*>(getMainStream()))
             openTestMode();
     }
+    else if (scheme == "replay") { // replay://path
+        openReplay(uri.getHost(), uri.getOption("realtime", "1") == "1");
+    }
     else if (scheme == "fd") { // fd://FD
-        return setFileDescriptor(stoi(uri.getHost()),
+        setFileDescriptor(stoi(uri.getHost()),
             uri.getOption("auto_close", "1") == "1",
             uri.getOption("has_eof", "0") == "1");
     }
+
+    // The configuration may still fail at the system level (e.g. missing
+    // privileges). Do not leave the driver open in this case either
+    try {
+        if (!socket_config.empty()) {
+            setSocketConfiguration(socket_config);
+        }
+        if (uri.getOption("datagram", "0") == "1") {
+            setDatagramMode(true);
+        }
+        if (batch_size >= 0) {
+            setDatagramBatchSize(batch_size);
+        }
+        if (io_uring) {
+            switchToIOUring();
+        }
+        if (uri.getOption("timestamps", "0") == "1") {
+            setReceiveTimestamps(true);
+        }
+    }
+    catch(...) {
+        close();
+        throw;
+    }
+}
+
+void Driver::setDatagramBatchSize(int count) {
+    // The driver never returns datagrams bigger than MAX_PACKET_SIZE, so do
+    // not allocate room for bigger ones
+    IOStream* stream = getMainStream();
+    if (auto udp = dynamic_cast<UDPServerStream*>(stream)) {
+        udp->setBatchSize(count, MAX_PACKET_SIZE);
+    }
+    else if (auto unix_dgram = dynamic_cast<UnixDatagramStream*>(stream)) {
+        unix_dgram->setBatchSize(count, MAX_PACKET_SIZE);
+    }
+    else {
+        throw std::invalid_argument(
+            "the batch option is only supported by the udp, udpserver, "
+            "unixdgram and unixdgramserver URIs"
+        );
+    }
+}
+
+void Driver::switchToIOUring() {
+    IOStream* stream = getMainStream();
+    FDStream* fd_stream = nullptr;
+    SocketStream* socket_stream = nullptr;
+    bool auto_close, has_eof;
+    if (stream && typeid(*stream) == typeid(FDStream)) {
+        fd_stream = static_cast<FDStream*>(stream);
+        auto_close = fd_stream->getAutoClose();
+        has_eof = fd_stream->hasEOF();
+    }
+    else if (stream && typeid(*stream) == typeid(SocketStream)) {
+        socket_stream = static_cast<SocketStream*>(stream);
+        auto_close = socket_stream->getAutoClose();
+        has_eof = socket_stream->hasEOF();
+    }
+    else {
+        throw std::invalid_argument(
+            "the io_uring option is only supported by the serial, tcp, file, fd "
+            "and unixstream URIs"
+        );
+    }
+
+    if (!IOUringStream::isSupported()) {
+        LOG_WARN_S << "io_uring is not supported on this system, "
+                      "falling back to the standard file descriptor stream" << endl;
+        return;
+    }
+
+    // The old stream keeps ownership of the file descriptor if this throws
+    IOUringStream* uring_stream =
+        new IOUringStream(stream->getFileDescriptor(), auto_close, has_eof);
+    if (fd_stream) {
+        fd_stream->setAutoClose(false);
+    }
+    else {
+        socket_stream->setAutoClose(false);
+    }
+    setMainStream(uring_stream);
 }
 
 void Driver::openURI_UDP(URI const& uri) {
@@ -641,10 +988,97 @@ SerialConfiguration Driver::parseSerialConfiguration(std::string const &descript
 }
 
 
+static void setSocketOption(int fd, int level, int option, int value,
+                            char const* name)
+{
+    if (setsockopt(fd, level, option, &value, sizeof(value)) != 0) {
+        throw UnixError(string("Driver::setSocketConfiguration: cannot set ") + name);
+    }
+}
+
+static int getSocketOption(int fd, int level, int option)
+{
+    int value;
+    socklen_t size = sizeof(value);
+    if (getsockopt(fd, level, option, &value, &size) != 0) {
+        return -1;
+    }
+    return value;
+}
+
+static int getSocketType(int fd, char const* context)
+{
+    int type = getSocketOption(fd, SOL_SOCKET, SO_TYPE);
+    if (type == -1) {
+        throw std::invalid_argument(
+            string(context) + ": the driver is not connected to a socket"
+        );
+    }
+    return type;
+}
+
+void Driver::setSocketConfiguration(SocketConfiguration const& config)
+{
+    int fd = getDeviceFileDescriptor();
+    int type = getSocketType(fd, "Driver::setSocketConfiguration");
+    if ((config.nodelay != -1 || config.quickack != -1) && type != SOCK_STREAM) {
+        throw std::invalid_argument(
+            "Driver::setSocketConfiguration: nodelay and quickack are only "
+            "supported on TCP sockets"
+        );
+    }
+
+    if (config.nodelay != -1) {
+        setSocketOption(fd, IPPROTO_TCP, TCP_NODELAY, config.nodelay, "TCP_NODELAY");
+    }
+    if (config.quickack != -1) {
+        setSocketOption(fd, IPPROTO_TCP, TCP_QUICKACK, config.quickack, "TCP_QUICKACK");
+        if (auto fd_stream = dynamic_cast<FDStream*>(m_stream)) {
+            fd_stream->setQuickAck(config.quickack == 1);
+        }
+    }
+    if (config.receive_buffer_size != -1) {
+        setSocketOption(fd, SOL_SOCKET, SO_RCVBUF, config.receive_buffer_size, "SO_RCVBUF");
+    }
+    if (config.send_buffer_size != -1) {
+        setSocketOption(fd, SOL_SOCKET, SO_SNDBUF, config.send_buffer_size, "SO_SNDBUF");
+    }
+    if (config.busy_poll != -1) {
+        setSocketOption(fd, SOL_SOCKET, SO_BUSY_POLL, config.busy_poll, "SO_BUSY_POLL");
+    }
+    if (config.priority != -1) {
+        setSocketOption(fd, SOL_SOCKET, SO_PRIORITY, config.priority, "SO_PRIORITY");
+    }
+
+    SocketConfiguration applied = getSocketConfiguration();
+    LOG_INFO_S << "applied socket configuration:"
+               << " nodelay=" << applied.nodelay
+               << " quickack=" << applied.quickack
+               << " rcvbuf=" << applied.receive_buffer_size
+               << " sndbuf=" << applied.send_buffer_size
+               << " busy_poll=" << applied.busy_poll
+               << " priority=" << applied.priority << endl;
+}
+
+SocketConfiguration Driver::getSocketConfiguration() const
+{
+    int fd = getDeviceFileDescriptor();
+    getSocketType(fd, "Driver::getSocketConfiguration");
+
+    SocketConfiguration config;
+    config.nodelay = getSocketOption(fd, IPPROTO_TCP, TCP_NODELAY);
+    config.quickack = getSocketOption(fd, IPPROTO_TCP, TCP_QUICKACK);
+    config.receive_buffer_size = getSocketOption(fd, SOL_SOCKET, SO_RCVBUF);
+    config.send_buffer_size = getSocketOption(fd, SOL_SOCKET, SO_SNDBUF);
+    config.busy_poll = getSocketOption(fd, SOL_SOCKET, SO_BUSY_POLL);
+    config.priority = getSocketOption(fd, SOL_SOCKET, SO_PRIORITY);
+    return config;
+}
+
 void Driver::setSerialConfiguration(SerialConfiguration const& serial_config)
 {
     struct termios tio;
-    int fd = getFileDescriptor();
+    int fd = getDeviceFileDescriptor();
 
     if (tcgetattr(fd, &tio)) {
         throw UnixError("Driver::setSerialConfiguration: Failed to get terminal info\n");
@@ -720,8 +1154,13 @@ void Driver::openFile(std::string const& path)
     setFileDescriptor(fd);
 }
 
+void Driver::openReplay(std::string const& path, bool realtime)
+{
+    setMainStream(new ReplayStream(path, realtime));
+}
+
 bool Driver::setSerialBaudrate(int brate) {
-    return setSerialBaudrate(getFileDescriptor(), brate);
+    return setSerialBaudrate(getDeviceFileDescriptor(), brate);
 }
 
 bool Driver::setSerialBaudrate(int fd, int brate) {
@@ -842,73 +1281,197 @@ void Driver::close()
 
 std::pair<uint8_t const*, int> Driver::findPacket(uint8_t const* buffer, int buffer_size) const
 {
-    int packet_start = 0, packet_size = 0;
-    int extract_result = extractPacket(buffer, buffer_size);
+    m_scan_budget_exhausted = false;
+
+    uint8_t const* cursor = buffer;
+    uint8_t const* end = buffer + buffer_size;
+    pair<uint8_t const*, int> last_packet(buffer, 0);
+    int scanned = 0;
+    internal_buffer_found_dropped_size = 0;
+    internal_buffer_found_dropped_packets = 0;
+    while (cursor != end)
+    {
+        if (m_scan_budget && scanned >= m_scan_budget) {
+            m_scan_budget_exhausted = true;
+            break;
+        }
 
-    // make sure the returned packet size is not longer than
-    // the buffer
-    if( extract_result > buffer_size )
-        throw length_error("extractPacket() returned result size "
-                + lexical_cast<string>(extract_result)
-                + ", which is larger than the buffer size "
-                + lexical_cast<string>(buffer_size) + ".");
+        int remaining = end - cursor;
+        int extract_result = timedExtractPacket(cursor, remaining);
+
+        // make sure the returned packet size is not longer than
+        // the buffer
+        if( extract_result > remaining )
+            throw length_error("extractPacket() returned result size "
+                    + lexical_cast<string>(extract_result)
+                    + ", which is larger than the buffer size "
+                    + lexical_cast<string>(remaining) + ".");
+        // the receive buffer may be bigger than MAX_PACKET_SIZE, but the
+        // buffers given to readPacket are not
+        else if( extract_result > MAX_PACKET_SIZE )
+            throw length_error("extractPacket() returned result size "
+                    + lexical_cast<string>(extract_result)
+                    + ", which is larger than MAX_PACKET_SIZE ("
+                    + lexical_cast<string>(MAX_PACKET_SIZE) + ").");
+
+        if (0 == extract_result)
+            break;
+        else if (extract_result < 0)
+        {
+            int skip = std::min(-extract_result, remaining);
+            cursor += skip;
+            scanned += skip;
+        }
+        else if (!m_extract_last)
+            return make_pair(cursor, extract_result);
+        else
+        {
+            // We are looking for the last packet in the buffer. The ones
+            // before it will be dropped
+            if (last_packet.second) {
+                internal_buffer_found_dropped_size += last_packet.second;
+                ++internal_buffer_found_dropped_packets;
+            }
+            last_packet = make_pair(cursor, extract_result);
+            cursor += extract_result;
+            scanned += extract_result;
+        }
+    }
 
-    if (0 == extract_result)
-        return make_pair(buffer, 0);
+    if (last_packet.second)
+        return last_packet;
+    return make_pair(cursor, 0);
+}
 
-    if (extract_result < 0)
-        packet_start += -extract_result;
-    else if (extract_result > 0)
-        packet_size = extract_result;
+pair<uint8_t const*, int> Driver::findPacketInInternalBuffer() const
+{
+    uint8_t const* data =
+        internal_buffer + internal_buffer_start + internal_buffer_view_size;
+    if (!m_datagram_mode) {
+        if (internal_buffer_found_size) {
+            m_scan_budget_exhausted = false;
+            return make_pair(data + internal_buffer_found_offset,
+                             internal_buffer_found_size);
+        }
 
-    if (m_extract_last)
-    {
-        m_stats.stamp = Time::now();
-        m_stats.bad_rx  += packet_start;
-        m_stats.good_rx += packet_size;
+        size_t size = internal_buffer_size - internal_buffer_view_size;
+        size_t resume = std::min(internal_buffer_scan_offset, size);
+        pair<uint8_t const*, int> packet = findPacket(data + resume, size - resume);
+        if (!packet.second)
+            internal_buffer_scan_offset = packet.first - data;
+        else if (!m_scan_budget_exhausted) {
+            internal_buffer_found_offset = packet.first - data;
+            internal_buffer_found_size = packet.second;
+        }
+        return packet;
     }
 
-    int remaining = buffer_size - (packet_start + packet_size);
+    m_scan_budget_exhausted = false;
 
-    if (remaining == 0)
-        return make_pair(buffer + packet_start, packet_size);
+    // The view always covers whole packets
+    auto it = internal_buffer_packets.begin();
+    size_t offset = 0;
+    while (offset < internal_buffer_view_size) {
+        offset += *it;
+        ++it;
+    }
 
-    if (!packet_size || (packet_size > 0 && m_extract_last))
-    {
-        // Recursively call findPacket to find a packet in the current internal
-        // buffer. This is used either if the last call to extractPacket
-        // returned a negative value (remove bytes at the front of the buffer),
-        // or if m_extract_last is true (we are looking for the last packet in
-        // buffer)
-        std::pair<uint8_t const*, int> next_packet;
-        next_packet = findPacket(buffer + packet_start + packet_size, remaining);
+    if (it == internal_buffer_packets.end())
+        return make_pair(data, 0);
+    else if (!m_extract_last)
+        return make_pair(data, *it);
 
-        if (m_extract_last)
-        {
-            if (next_packet.second == 0)
-                return make_pair(buffer + packet_start, packet_size);
-            else
-                return next_packet;
-        }
-        else
-        {
-            return next_packet;
+    pair<uint8_t const*, int> packet;
+    internal_buffer_found_dropped_size = 0;
+    internal_buffer_found_dropped_packets = 0;
+    for (; it != internal_buffer_packets.end(); ++it) {
+        if (packet.second) {
+            internal_buffer_found_dropped_size += packet.second;
+            ++internal_buffer_found_dropped_packets;
         }
+        packet = make_pair(data, *it);
+        data += *it;
+    }
+    return packet;
+}
+
+void Driver::validateDatagram(uint8_t const* datagram, int size)
+{
+    int packet_size = timedExtractPacket(datagram, size);
+    if (packet_size > size)
+        throw length_error("extractPacket() returned result size "
+                + lexical_cast<string>(packet_size)
+                + ", which is larger than the buffer size "
+                + lexical_cast<string>(size) + ".");
+    else if (packet_size > MAX_PACKET_SIZE)
+        throw length_error("extractPacket() returned result size "
+                + lexical_cast<string>(packet_size)
+                + ", which is larger than MAX_PACKET_SIZE ("
+                + lexical_cast<string>(MAX_PACKET_SIZE) + ").");
+
+    if (packet_size <= 0) {
+        m_stats.addRx(0, size);
+        return;
     }
-    return make_pair(buffer + packet_start, packet_size);
+
+    if (packet_size < size)
+        m_stats.addRx(0, size - packet_size);
+    internal_buffer_size += packet_size;
+    internal_buffer_packets.push_back(packet_size);
 }
 
 int Driver::doPacketExtraction(uint8_t* buffer)
 {
-    pair<uint8_t const*, int> packet = findPacket(internal_buffer, internal_buffer_size);
-    if (!m_extract_last)
-    {
-        m_stats.stamp = Time::now();
-        m_stats.bad_rx  += packet.first - internal_buffer;
-        m_stats.good_rx += packet.second;
+    uint64_t first_byte_time = m_latencies ? m_latencies->first_byte_time : 0;
+    int packet_size = extractPacketInPlace();
+    if (packet_size && first_byte_time)
+        m_latencies->packet.record(LatencyHistogram::now() - first_byte_time);
+    if (packet_size && m_receive_timestamps)
+        m_last_packet_time = getReceiveTime(0);
+    if (packet_size && buffer) {
+        pullBytesFromInternal(buffer, 0, packet_size);
+        internal_buffer_view_size = 0;
+    }
+    return packet_size;
+}
+
+int Driver::extractPacketInPlace()
+{
+    uint8_t* view = internal_buffer + internal_buffer_start;
+    uint8_t const* data = view + internal_buffer_view_size;
+    pair<uint8_t const*, int> packet = findPacketInInternalBuffer();
+    int skip = packet.first - data;
+    if (!m_extract_last || !packet.second)
+        m_stats.addRx(packet.second, skip);
+    else {
+        // The packets that precede the last one are dropped, the rest of
+        // the skipped bytes are bad. In datagram mode, they have already
+        // been counted by validateDatagram
+        int dropped = internal_buffer_found_dropped_size;
+        m_stats.addRx(dropped + packet.second, skip - dropped,
+                      internal_buffer_found_dropped_packets + 1);
+    }
+
+    if (packet.second || !internal_buffer_view_size) {
+        // Drop the current view (if there is one) and the bytes that
+        // precede the new packet
+        consumeInternalBuffer(internal_buffer_view_size + skip);
+        internal_buffer_view_size = packet.second;
+    }
+    else if (skip) {
+        // No new packet, but the bytes between the current view and the
+        // start of the next (partial) packet must be removed. Move the view
+        // over them.
+        memmove(view + skip, view, internal_buffer_view_size);
+        internal_buffer_start += skip;
+        internal_buffer_size -= skip;
+        internal_buffer_position += skip;
+        invalidateScan();
+        m_stats.setQueuedBytes(internal_buffer_size);
     }
 
-    pullBytesFromInternal(buffer, packet.first - internal_buffer, packet.second);
+    if (internal_buffer_size == 0)
+        internal_buffer_start = 0;
     return packet.second;
 }
 
@@ -934,13 +1497,64 @@ pair<int, bool> Driver::extractPacketFromInternalBuffer(uint8_t* buffer, int out
 
 void Driver::pullBytesFromInternal(uint8_t* buffer, int skip, int size) {
     int total_size = skip + size;
-    int new_internal_size = internal_buffer_size - total_size;
 
-    memcpy(buffer, internal_buffer + skip, size);
+    memcpy(buffer, internal_buffer + internal_buffer_start + skip, size);
+    consumeInternalBuffer(total_size);
+}
+
+void Driver::invalidateScan() {
+    internal_buffer_scan_offset = 0;
+    internal_buffer_found_size = 0;
+}
+
+void Driver::consumeInternalBuffer(int size) {
+    invalidateScan();
+    internal_buffer_size -= size;
+    internal_buffer_position += size;
+    m_stats.setQueuedBytes(internal_buffer_size);
+    if (internal_buffer_size == 0) {
+        internal_buffer_stamps.clear();
+    }
+    else {
+        while (internal_buffer_stamps.size() > 1 &&
+               internal_buffer_stamps[1].first <= internal_buffer_position)
+            internal_buffer_stamps.pop_front();
+    }
+    if (m_latencies) {
+        // If the remaining bytes all come from the last read, we know when
+        // they were received. Otherwise, keep the time of the oldest ones
+        if (internal_buffer_size == 0)
+            m_latencies->first_byte_time = 0;
+        else if (internal_buffer_size <= m_latencies->last_read_size)
+            m_latencies->first_byte_time = m_latencies->last_read_time;
+    }
+    if (internal_buffer_size == 0)
+        internal_buffer_start = 0;
+    else
+        internal_buffer_start += size;
+
+    while (size > 0 && !internal_buffer_packets.empty()) {
+        int& front = internal_buffer_packets.front();
+        if (front > size) {
+            front -= size;
+            break;
+        }
+        size -= front;
+        internal_buffer_packets.pop_front();
+    }
+}
+
+void Driver::compactInternalBuffer() {
+    // In datagram mode, a datagram that does not fit in the tail room gets
+    // truncated. Always make the whole free space available.
+    size_t tail_room = internal_buffer_capacity - internal_buffer_start - internal_buffer_size;
+    if (m_datagram_mode ? !internal_buffer_start : internal_buffer_start <= tail_room)
+        return;
+
     memmove(internal_buffer,
-            internal_buffer + total_size,
-            new_internal_size);
-    internal_buffer_size = new_internal_size;
+            internal_buffer + internal_buffer_start,
+            internal_buffer_size);
+    internal_buffer_start = 0;
 }
 
 int Driver::readRaw(uint8_t* buffer, int out_buffer_size)
@@ -961,6 +1575,8 @@ int Driver::readRaw(uint8_t* buffer, int out_buffer_size,
         throw std::runtime_error("attempting to call readRaw on a closed driver");
     }
 
+    releasePacket();
+
     int buffer_fill = std::min<int>(internal_buffer_size, out_buffer_size);
     pullBytesFromInternal(buffer, 0, buffer_fill);
 
@@ -968,19 +1584,19 @@ int Driver::readRaw(uint8_t* buffer, int out_buffer_size,
     auto inter_byte_timeout = inter_byte_timeout_.isNull() ?
                               packet_timeout : inter_byte_timeout_;
 
-    auto now = Time::now();
+    auto now = Timeout::now();
     auto last_char = now + packet_timeout;
     bool received_bytes = false;
     Time global_deadline = now + first_byte_timeout;
     while (buffer_fill < out_buffer_size && now <= global_deadline)
     {
         auto deadline = min(global_deadline, last_char + inter_byte_timeout);
-        if (!m_stream->waitRead(deadline - now)) {
+        if (!timedWaitRead(deadline - now)) {
             break;
         }
         int c = m_stream->read(buffer + buffer_fill,
                                out_buffer_size - buffer_fill);
-        now = Time::now();
+        now = Timeout::now();
 
         if (c > 0) {
             last_char = now;
@@ -999,11 +1615,12 @@ int Driver::readRaw(uint8_t* buffer, int out_buffer_size,
 
 pair<int, bool> Driver::readPacketInternal(uint8_t* buffer, int out_buffer_size)
 {
-    if (out_buffer_size < MAX_PACKET_SIZE)
+    if (buffer && out_buffer_size < MAX_PACKET_SIZE)
         throw length_error("readPacket(): provided buffer too small (got " + lexical_cast<string>(out_buffer_size) + ", expected at least " + lexical_cast<string>(MAX_PACKET_SIZE) + ")");
 
     // How many packet bytes are there currently in +buffer+
     int packet_size = 0;
+    m_scan_budget_exhausted = false;
     if (internal_buffer_size > 0)
     {
         packet_size = doPacketExtraction(buffer);
@@ -1011,21 +1628,16 @@ pair<int, bool> Driver::readPacketInternal(uint8_t* buffer, int out_buffer_size)
         // copied in 'buffer'
         if (packet_size && !m_extract_last)
             return make_pair(packet_size, false);
+        else if (m_scan_budget_exhausted)
+            return make_pair(packet_size, false);
     }
 
     bool received_something = false;
     while (true) {
-        // cerr << "reading with " << printable_com(buffer, buffer_size) << " as buffer" << endl;
-        int c = m_stream->read(internal_buffer + internal_buffer_size, MAX_PACKET_SIZE - internal_buffer_size);
+        int c = readToInternalBuffer();
         if (c > 0) {
-            for (set<IOListener*>::iterator it = m_listeners.begin(); it != m_listeners.end(); ++it)
-                (*it)->readData(internal_buffer + internal_buffer_size, c);
-
             received_something = true;
 
-            // cerr << "received: " << printable_com(buffer + buffer_size, c) << endl;
-            internal_buffer_size += c;
-
             int new_packet = doPacketExtraction(buffer);
             if (new_packet)
             {
@@ -1034,23 +1646,131 @@ pair<int, bool> Driver::readPacketInternal(uint8_t* buffer, int out_buffer_size)
                 else
                     packet_size = new_packet;
             }
+
+            // Let the caller check its deadline before searching further
+            if (m_scan_budget_exhausted)
+                return make_pair(packet_size, true);
         }
         else
             return make_pair(packet_size, received_something);
 
-        if (internal_buffer_size == (size_t)MAX_PACKET_SIZE)
+        if (internal_buffer_size == internal_buffer_capacity)
             throw length_error("readPacket(): current packet too large for buffer");
     }
 
     // Never reached
 }
 
+int Driver::readToInternalBuffer()
+{
+    compactInternalBuffer();
+    int total = readOnceToInternalBuffer();
+    if (!total)
+        return 0;
+
+    // A datagram that does not fit in the tail room would be truncated, so
+    // leave the ones that may not fit in the stream
+    while (m_stream->hasBufferedData()) {
+        compactInternalBuffer();
+        size_t tail_room = internal_buffer_capacity - internal_buffer_start - internal_buffer_size;
+        if (tail_room < static_cast<size_t>(MAX_PACKET_SIZE))
+            break;
+
+        int c = readOnceToInternalBuffer();
+        if (!c)
+            break;
+        total += c;
+    }
+    return total;
+}
+
+int Driver::readOnceToInternalBuffer()
+{
+    uint8_t* read_start = internal_buffer + internal_buffer_start + internal_buffer_size;
+    size_t size_before = internal_buffer_size;
+
+    int c = m_stream->read(read_start, internal_buffer_capacity - internal_buffer_start - internal_buffer_size);
+    if (c > 0) {
+        for (set<IOListener*>::iterator it = m_listeners.begin(); it != m_listeners.end(); ++it)
+            (*it)->readData(read_start, c);
+        if (m_status_stamp_mode == STAMP_ON_IO)
+            m_stats.setStamp(Time::now());
+        if (m_latencies) {
+            uint64_t now = LatencyHistogram::now();
+            if (internal_buffer_size == internal_buffer_view_size)
+                m_latencies->first_byte_time = now;
+            m_latencies->last_read_time = now;
+            m_latencies->last_read_size = c;
+        }
+        if (m_datagram_mode)
+            validateDatagram(read_start, c);
+        else
+            internal_buffer_size += c;
+        m_stats.setQueuedBytes(internal_buffer_size);
+
+        if (m_receive_timestamps && internal_buffer_size > size_before) {
+            Time stamp = m_stream->getLastReceiveTime();
+            if (stamp.isNull())
+                stamp = Time::now();
+            internal_buffer_stamps.push_back(
+                make_pair(internal_buffer_position + size_before, stamp));
+        }
+
+        // The last packet may be in the new data
+        if (m_extract_last)
+            internal_buffer_found_size = 0;
+    }
+    return c;
+}
+
+int Driver::readPackets(PacketView* packets, int max_packets, bool read)
+{
+    releasePacket();
+    if (read && isValid())
+        readToInternalBuffer();
+
+    if (max_packets <= 0)
+        return 0;
+
+    int count = 0;
+    if (m_extract_last) {
+        pair<int, bool> result = extractPacketFromInternalBuffer(nullptr, MAX_PACKET_SIZE);
+        if (result.first)
+            packets[count++] = PacketView(internal_buffer + internal_buffer_start, result.first);
+    }
+    else {
+        // The packets and the bytes that have been skipped in-between are
+        // all kept in the internal buffer until the next release
+        while (count < max_packets && internal_buffer_view_size < internal_buffer_size)
+        {
+            uint8_t const* data =
+                internal_buffer + internal_buffer_start + internal_buffer_view_size;
+            pair<uint8_t const*, int> packet = findPacketInInternalBuffer();
+            int skip = packet.first - data;
+            m_stats.addRx(packet.second, skip);
+
+            internal_buffer_view_size += skip + packet.second;
+            invalidateScan();
+            if (!packet.second)
+                break;
+            packets[count++] = PacketView(packet.first, packet.second);
+        }
+
+        if (!count)
+            releasePacket();
+    }
+
+    if (!count && internal_buffer_size == internal_buffer_capacity)
+        throw length_error("readPackets(): current packet too large for buffer");
+    return count;
+}
+
 bool Driver::hasPacket() const
 {
-    if (internal_buffer_size == 0)
+    if (internal_buffer_size == internal_buffer_view_size)
         return false;
 
-    pair<uint8_t const*, int> packet = findPacket(internal_buffer, internal_buffer_size);
+    pair<uint8_t const*, int> packet = findPacketInInternalBuffer();
     return (packet.second > 0);
 }
 
@@ -1080,7 +1800,7 @@ int Driver::readPacket(uint8_t* buffer, int buffer_size,
                       Time::fromMilliseconds(first_byte_timeout));
 }
 int Driver::readPacket(uint8_t* buffer, int buffer_size,
-                       Time const& packet_timeout, Time const& first_byte_timeout_)
+                       Time const& packet_timeout, Time const& first_byte_timeout)
 {
     if (buffer_size < MAX_PACKET_SIZE) {
         throw length_error("readPacket(): provided buffer too small (got "
@@ -1088,6 +1808,37 @@ int Driver::readPacket(uint8_t* buffer, int buffer_size,
                 + lexical_cast<string>(MAX_PACKET_SIZE) + ")");
     }
 
+    releasePacket();
+    return readPacketImpl(buffer, buffer_size, packet_timeout, first_byte_timeout);
+}
+PacketView Driver::readPacketView()
+{
+    return readPacketView(getReadTimeout(), getReadTimeout());
+}
+PacketView Driver::readPacketView(Time const& packet_timeout)
+{
+    return readPacketView(packet_timeout, packet_timeout);
+}
+PacketView Driver::readPacketView(Time const& packet_timeout,
+                                  Time const& first_byte_timeout)
+{
+    releasePacket();
+    int packet_size = readPacketImpl(
+        nullptr, MAX_PACKET_SIZE, packet_timeout, first_byte_timeout
+    );
+    return PacketView(internal_buffer + internal_buffer_start, packet_size);
+}
+void Driver::releasePacket()
+{
+    if (!internal_buffer_view_size)
+        return;
+
+    consumeInternalBuffer(internal_buffer_view_size);
+    internal_buffer_view_size = 0;
+}
+int Driver::readPacketImpl(uint8_t* buffer, int buffer_size,
+                           Time const& packet_timeout, Time const& first_byte_timeout_)
+{
     if (!isValid()) {
         // No valid file descriptor. Assume that the user is using the raw data
         // interface (i.e. that the data is already in the internal read buffer)
@@ -1104,7 +1855,7 @@ int Driver::readPacket(uint8_t* buffer, int buffer_size,
 
     TimeoutError::TIMEOUT_TYPE timeout_type = TimeoutError::FIRST_BYTE;
     Time first_byte_timeout = min(packet_timeout, first_byte_timeout_);
-    Time start_time = Time::now();
+    Time start_time = Timeout::now();
     Time deadline = start_time + first_byte_timeout;
 
     while (true) {
@@ -1128,7 +1879,7 @@ int Driver::readPacket(uint8_t* buffer, int buffer_size,
             timeout_type = TimeoutError::PACKET;
         }
 
-        Time now = Time::now();
+        Time now = Timeout::now();
         if (now > deadline)
         {
             throw TimeoutError(
@@ -1137,14 +1888,19 @@ int Driver::readPacket(uint8_t* buffer, int buffer_size,
                 + lexical_cast<string>((now - start_time).toMilliseconds()) + "ms");
         }
 
+        // there is still data to search in the internal buffer, do it before
+        // waiting for new data
+        if (m_scan_budget_exhausted)
+            continue;
+
         // we still have time left to wait for arriving data. see how much
         Time remaining = deadline - now;
 
-        // calls select and waits until a new read can be actually performed (in the next
+        // waits until a new read can be actually performed (in the next
         // while-iteration)
-        if (!m_stream->waitRead(remaining))
+        if (!timedWaitRead(remaining))
         {
-            auto total_wait = Time::now() - start_time;
+            auto total_wait = Timeout::now() - start_time;
             throw TimeoutError(timeout_type,
                 "readPacket(): no data waiting for data. Last wait lasted "
                 + lexical_cast<string>(remaining.toMilliseconds()) + "ms, "
@@ -1170,7 +1926,9 @@ bool Driver::writePacket(uint8_t const* buffer, int buffer_size, int timeout)
     if(!m_stream)
         throw std::runtime_error("Driver::writePacket : invalid stream, did you forget to call open ?");
 
+    uint64_t start = m_latencies ? LatencyHistogram::now() : 0;
     Timeout time_out(timeout);
+    drainWriteQueue(time_out);
     int written = 0;
     while(true) {
         int c = m_stream->write(buffer + written, buffer_size - written);
@@ -1179,8 +1937,11 @@ bool Driver::writePacket(uint8_t const* buffer, int buffer_size, int timeout)
         written += c;
 
         if (written == buffer_size) {
-            m_stats.stamp = Time::now();
-            m_stats.tx += buffer_size;
+            if (m_status_stamp_mode == STAMP_ON_IO)
+                m_stats.setStamp(Time::now());
+            m_stats.addTx(buffer_size);
+            if (m_latencies)
+                m_latencies->write.record(LatencyHistogram::now() - start);
             return true;
         }
 
@@ -1195,6 +1956,223 @@ bool Driver::writePacket(uint8_t const* buffer, int buffer_size, int timeout)
     }
 }
 
+bool Driver::writePacket(PacketView const* segments, size_t count)
+{
+    return writePacket(segments, count, getWriteTimeout());
+}
+bool Driver::writePacket(PacketView const* segments, size_t count, Time const& timeout)
+{
+    if(!m_stream)
+        throw std::runtime_error("Driver::writePacket : invalid stream, did you forget to call open ?");
+
+    uint64_t start = m_latencies ? LatencyHistogram::now() : 0;
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += segments[i].size;
+
+    Timeout time_out(timeout.toMilliseconds());
+    drainWriteQueue(time_out);
+    size_t written = 0;
+    // The first segment that has not been fully written, and how much of it
+    // has been written
+    size_t index = 0;
+    size_t offset = 0;
+    while(true) {
+        // Resume in the middle of a segment with a plain write, so that the
+        // caller's segments do not need to be copied
+        size_t c;
+        if (offset)
+            c = m_stream->write(segments[index].data + offset, segments[index].size - offset);
+        else
+            c = m_stream->writev(segments + index, count - index);
+        written += c;
+
+        while (c > 0) {
+            size_t chunk = std::min<size_t>(c, segments[index].size - offset);
+            for (IOListener* listener : m_listeners)
+                listener->writeData(segments[index].data + offset, chunk);
+            offset += chunk;
+            c -= chunk;
+            if (offset == static_cast<size_t>(segments[index].size)) {
+                ++index;
+                offset = 0;
+            }
+        }
+
+        if (written == total) {
+            if (m_status_stamp_mode == STAMP_ON_IO)
+                m_stats.setStamp(Time::now());
+            m_stats.addTx(total);
+            if (m_latencies)
+                m_latencies->write.record(LatencyHistogram::now() - start);
+            return true;
+        }
+
+        if (time_out.elapsed())
+            throw TimeoutError(TimeoutError::PACKET, "writePacket(): timeout");
+
+        int remaining_timeout = time_out.timeLeft();
+        if (!m_stream->waitWrite(Time::fromMilliseconds(remaining_timeout))) {
+            throw TimeoutError(TimeoutError::NONE, "waitWrite(): timeout");
+        };
+    }
+}
+
+/** Maximum number of datagrams written per writeBatch call when flushing the
+ * write queue
+ */
+static const int MAX_WRITE_BATCH = 64;
+
+void Driver::setWriteQueueSize(size_t size)
+{
+    if (m_write_queue_size)
+        throw std::logic_error("setWriteQueueSize(): the write queue is not empty");
+
+    m_write_queue.resize(size);
+    m_write_queue.shrink_to_fit();
+    m_write_queue_start = 0;
+    setWriteQueueWatermarks(size / 4, size * 3 / 4);
+}
+size_t Driver::getWriteQueueSize() const { return m_write_queue.size(); }
+void Driver::setWriteQueueWatermarks(size_t low, size_t high)
+{
+    if (low > high)
+        throw std::invalid_argument("setWriteQueueWatermarks(): low watermark above the high watermark");
+    m_write_queue_low_watermark = low;
+    m_write_queue_high_watermark = high;
+    m_write_queue_congested = false;
+}
+bool Driver::isWriteQueueCongested() const { return m_write_queue_congested; }
+size_t Driver::getQueuedWriteBytes() const { return m_write_queue_size; }
+bool Driver::hasPendingWrites() const { return m_write_queue_size != 0; }
+
+bool Driver::queuePacket(uint8_t const* buffer, int buffer_size)
+{
+    PacketView segment(buffer, buffer_size);
+    return queuePacket(&segment, 1);
+}
+
+bool Driver::queuePacket(PacketView const* segments, size_t count)
+{
+    if (m_write_queue.empty())
+        throw std::logic_error("queuePacket(): the write queue is disabled, call setWriteQueueSize first");
+
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i)
+        size += segments[i].size;
+    if (!size)
+        return true; // an empty packet would be sent as an empty datagram
+    if (size > m_write_queue.size() - m_write_queue_size)
+        return false;
+
+    if (size > m_write_queue.size() - m_write_queue_start - m_write_queue_size) {
+        memmove(m_write_queue.data(),
+                m_write_queue.data() + m_write_queue_start,
+                m_write_queue_size);
+        m_write_queue_start = 0;
+    }
+
+    uint8_t* tail = m_write_queue.data() + m_write_queue_start + m_write_queue_size;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(tail, segments[i].data, segments[i].size);
+        tail += segments[i].size;
+    }
+    m_write_queue_size += size;
+    m_write_queue_packets.push_back(size);
+    if (m_write_queue_size >= m_write_queue_high_watermark)
+        m_write_queue_congested = true;
+
+    flushWriteQueue();
+    return true;
+}
+
+size_t Driver::flushWriteQueue()
+{
+    if (!m_stream)
+        throw std::runtime_error("Driver::flushWriteQueue : invalid stream, did you forget to call open ?");
+    else if (!m_write_queue_size)
+        return 0;
+
+    UDPServerStream* udp = dynamic_cast<UDPServerStream*>(m_stream);
+    UnixDatagramStream* unix_dgram =
+        udp ? nullptr : dynamic_cast<UnixDatagramStream*>(m_stream);
+
+    while (m_write_queue_size) {
+        uint8_t const* data = m_write_queue.data() + m_write_queue_start;
+        size_t written = 0;
+        bool complete;
+        if (udp || unix_dgram) {
+            // Datagrams must be sent whole, one per packet
+            PacketView datagrams[MAX_WRITE_BATCH];
+            size_t count = 0;
+            for (auto it = m_write_queue_packets.begin();
+                 it != m_write_queue_packets.end() && count < MAX_WRITE_BATCH;
+                 ++it) {
+                datagrams[count++] = PacketView(data + written, *it);
+                written += *it;
+            }
+
+            size_t sent = udp ? udp->writeBatch(datagrams, count)
+                              : unix_dgram->writeBatch(datagrams, count);
+            complete = (sent == count);
+            written = 0;
+            for (size_t i = 0; i < sent; ++i)
+                written += datagrams[i].size;
+        }
+        else {
+            written = m_stream->write(data, m_write_queue_size);
+            complete = (written == m_write_queue_size);
+        }
+
+        if (!written)
+            break;
+        for (IOListener* listener : m_listeners)
+            listener->writeData(data, written);
+        consumeWriteQueue(written);
+        if (!complete)
+            break;
+    }
+    return m_write_queue_size;
+}
+
+void Driver::consumeWriteQueue(size_t size)
+{
+    m_write_queue_size -= size;
+    m_write_queue_start = m_write_queue_size ? m_write_queue_start + size : 0;
+
+    size_t remaining = size;
+    size_t completed = 0;
+    while (remaining > 0) {
+        int& front = m_write_queue_packets.front();
+        if (static_cast<size_t>(front) > remaining) {
+            front -= remaining;
+            break;
+        }
+
+        remaining -= front;
+        ++completed;
+        m_write_queue_packets.pop_front();
+    }
+    if (m_status_stamp_mode == STAMP_ON_IO)
+        m_stats.setStamp(Time::now());
+    m_stats.addTx(size, completed);
+
+    if (m_write_queue_size <= m_write_queue_low_watermark)
+        m_write_queue_congested = false;
+}
+
+void Driver::drainWriteQueue(Timeout const& timeout)
+{
+    while (flushWriteQueue()) {
+        if (timeout.elapsed())
+            throw TimeoutError(TimeoutError::PACKET, "writePacket(): timeout while writing the queued packets");
+
+        int remaining_timeout = timeout.timeLeft();
+        if (!m_stream->waitWrite(Time::fromMilliseconds(remaining_timeout)))
+            throw TimeoutError(TimeoutError::NONE, "waitWrite(): timeout");
+    }
+}
+
 bool Driver::eof() const
 {
     if (!m_stream)
@@ -5,11 +5,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <deque>
+#include <memory>
 #include <set>
 #include <vector>
 #include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/LatencyHistogram.hpp>
+#include <iodrivers_base/PacketView.hpp>
 #include <iodrivers_base/SerialConfiguration.hpp>
+#include <iodrivers_base/SocketConfiguration.hpp>
 #include <iodrivers_base/Status.hpp>
+#include <iodrivers_base/StatusCounters.hpp>
 #include <iodrivers_base/URI.hpp>
 
 struct addrinfo;
@@ -18,6 +24,7 @@ namespace iodrivers_base {
 
 class IOStream;
 class IOListener;
+class Timeout;
 
 class FileGuard
 {
@@ -73,13 +80,90 @@ public:
     /** For backward compatibility only */
     typedef iodrivers_base::Status Statistics;
 
+    /** How Status::stamp is updated
+     *
+     * @see setStatusStampMode
+     */
+    enum STATUS_STAMP_MODE
+    {
+        /** The stamp is the time of the last counter update. This costs a
+         * clock read per packet
+         */
+        STAMP_ON_UPDATE,
+        /** The stamp is the time of the last read or write that transferred
+         * data. When many packets are received at once, they share the
+         * reception time of the read
+         */
+        STAMP_ON_IO,
+        /** The stamp is never updated */
+        STAMP_NEVER
+    };
+
     static const int INVALID_FD = -1;
 
 private:
     /** Internal buffer used for reading packets */
     uint8_t* internal_buffer;
+    /** Size of \c internal_buffer
+     *
+     * @see setReceiveBufferSize
+     */
+    size_t internal_buffer_capacity;
+    /** Whether \c internal_buffer has been allocated by the driver, or
+     * provided with setReceiveBuffer
+     */
+    bool internal_buffer_owned = true;
+    /** Offset of the first valid byte in \c internal_buffer
+     *
+     * Consuming bytes only moves this offset forward. The space it leaves at
+     * the front of the buffer is reclaimed lazily by compactInternalBuffer
+     */
+    size_t internal_buffer_start;
     /** The current count of bytes left in \c internal_buffer */
     size_t internal_buffer_size;
+    /** Size of the data at the front of \c internal_buffer that is kept
+     * because packets returned by readPacketView or readPackets point to it,
+     * until it gets released
+     */
+    size_t internal_buffer_view_size;
+    /** In datagram mode, the sizes of the packets stored in \c internal_buffer,
+     * starting at \c internal_buffer_start
+     */
+    std::deque<int> internal_buffer_packets;
+    /** Number of bytes after the held view that a previous scan found not
+     * to contain the start of a packet, so that they are not scanned again
+     */
+    mutable size_t internal_buffer_scan_offset = 0;
+    /** Offset and size of the packet found by the last scan, relative to
+     * the end of the held view. The size is zero if there is none.
+     *
+     * This avoids parsing the same packet twice when hasPacket is followed
+     * by readPacket
+     */
+    mutable size_t internal_buffer_found_offset = 0;
+    mutable int internal_buffer_found_size = 0;
+    /** In extract-last mode, the total size and the number of the complete
+     * packets that the last scan found before the packet it returned
+     *
+     * These packets are dropped when the returned packet is extracted, and
+     * only counted in the statistics then
+     */
+    mutable size_t internal_buffer_found_dropped_size = 0;
+    mutable int internal_buffer_found_dropped_packets = 0;
+    /** Number of bytes consumed from \c internal_buffer since the driver
+     * was created, i.e. the position of \c internal_buffer_start in the
+     * received byte stream
+     */
+    uint64_t internal_buffer_position = 0;
+    /** If receive timestamps are enabled, the reception times of the bytes
+     * in \c internal_buffer
+     *
+     * Each element is the stream position of the first byte of a read, and
+     * the reception time of that read
+     *
+     * @see setReceiveTimestamps
+     */
+    std::deque<std::pair<uint64_t, base::Time>> internal_buffer_stamps;
 
 public:
     int const MAX_PACKET_SIZE;
@@ -106,6 +190,77 @@ protected:
      */
     bool m_extract_last;
 
+    /** True if each read from the stream is handled as a single packet
+     * candidate
+     *
+     * @see getDatagramMode
+     */
+    bool m_datagram_mode = false;
+
+    /** Maximum number of bytes findPacket examines in a single call, or zero
+     * for no limit
+     *
+     * @see setScanBudget
+     */
+    int m_scan_budget = 0;
+
+    /** Whether the receive buffer is locked in memory
+     *
+     * @see setReceiveBufferLocked
+     */
+    bool m_lock_receive_buffer = false;
+
+    /** How the Status stamp is updated
+     *
+     * @see setStatusStampMode
+     */
+    STATUS_STAMP_MODE m_status_stamp_mode = STAMP_ON_UPDATE;
+
+    /** Buffer of the asynchronous write queue. It is empty if the queue is
+     * disabled
+     *
+     * @see setWriteQueueSize
+     */
+    std::vector<uint8_t> m_write_queue;
+    /** Offset of the first queued byte in \c m_write_queue */
+    size_t m_write_queue_start = 0;
+    /** Number of bytes in \c m_write_queue */
+    size_t m_write_queue_size = 0;
+    /** Sizes of the packets in \c m_write_queue. The first one is reduced
+     * as it gets partially written
+     */
+    std::deque<int> m_write_queue_packets;
+    /** Backpressure thresholds of the write queue, in bytes
+     *
+     * @see setWriteQueueWatermarks
+     */
+    size_t m_write_queue_low_watermark = 0;
+    size_t m_write_queue_high_watermark = 0;
+    /** @see isWriteQueueCongested */
+    bool m_write_queue_congested = false;
+
+    /** Removes written bytes from the front of the write queue */
+    void consumeWriteQueue(size_t size);
+
+    /** Writes the whole write queue before a blocking write, so that the
+     * queued packets are sent first
+     */
+    void drainWriteQueue(Timeout const& timeout);
+
+    /** Whether the reception times of the received bytes are tracked
+     *
+     * @see setReceiveTimestamps
+     */
+    bool m_receive_timestamps = false;
+
+    /** Reception time of the last packet returned by readPacket or
+     * readPacketView
+     */
+    base::Time m_last_packet_time;
+
+    /** Set by findPacket if it stopped because of m_scan_budget */
+    mutable bool m_scan_budget_exhausted = false;
+
     /** Default read timeout for readPacket
      *
      * @see getReadTimeout setReadTimeout readPacket
@@ -129,6 +284,24 @@ protected:
      */
     std::pair<int, bool> readPacketInternal(uint8_t* buffer, int bufsize);
 
+    /** Internal helper method which does a single non-blocking read on the
+     * stream, and appends the data to the internal buffer
+     *
+     * If the stream still holds received data afterwards (e.g. the other
+     * datagrams of a batch, see IOStream::hasBufferedData), it is read as
+     * well while it fits, as nothing would report it later
+     *
+     * @return the number of bytes read
+     */
+    int readToInternalBuffer();
+
+    /** Does a single read on the stream into the internal buffer's tail
+     * room
+     *
+     * @return the number of bytes read
+     */
+    int readOnceToInternalBuffer();
+
     /** Internal helper which extracts the packet to be returned by
      * readPacketInternal (and therefore readPacket) in the provided
      * buffer. This method takes into account the negative values that
@@ -141,9 +314,30 @@ protected:
      *
      * The second element of the returned pair is the packet size if a full
      * packet has been found, and 0 in all other cases.
+     *
+     * If the scan budget is exhausted, the first element is the point where
+     * the scan stopped (or the last packet found in extract-last mode) and
+     * m_scan_budget_exhausted is set.
      */
     std::pair<uint8_t const*, int> findPacket(uint8_t const* buffer, int buffer_size) const;
 
+    /** Internal helper which finds the next packet in the internal buffer,
+     * after the data held for packet views
+     *
+     * It calls findPacket in normal mode, and only looks at the packets
+     * that have already been validated at reception in datagram mode
+     */
+    std::pair<uint8_t const*, int> findPacketInInternalBuffer() const;
+
+    /** Internal helper which validates the datagram that has just been
+     * appended to the internal buffer
+     *
+     * extractPacket is called once on the whole datagram. The packet at its
+     * start, if any, is kept and the remaining bytes are dropped. A datagram
+     * that does not start with a packet is dropped whole.
+     */
+    void validateDatagram(uint8_t const* datagram, int size);
+
     /** Internal helper method which reads packets only from the internal buffer
      * (does not access any file descriptor)
      */
@@ -152,10 +346,54 @@ protected:
     /** Internal helper method which copies in buffer the appropriate packet
      * found in the internal buffer, and returns its size. It returns 0 if no
      * packet has been found.
+     *
+     * If \c buffer is null, the packet is not copied but kept at the front
+     * of the internal buffer instead, to be returned by readPacketView
      */
     int doPacketExtraction(uint8_t* buffer);
 
-    mutable Status m_stats;
+    /** Internal helper method which finds the next packet in the internal
+     * buffer, removes the bytes that precede it and keeps it at the front
+     * of the buffer. It returns the packet size, or 0 if no packet has been
+     * found.
+     *
+     * A packet that was kept this way is replaced by the new one if there is
+     * one, and kept otherwise.
+     */
+    int extractPacketInPlace();
+
+    /** Internal implementation of readPacket and readPacketView
+     *
+     * If \c buffer is null, the packet is kept in the internal buffer
+     */
+    int readPacketImpl(uint8_t* buffer, int bufsize,
+                       base::Time const& packet_timeout,
+                       base::Time const& first_byte_timeout);
+
+    mutable StatusCounters m_stats;
+
+    struct LatencyMonitor;
+    /** The latency histograms, allocated only if latency monitoring is
+     * enabled
+     *
+     * @see setLatencyMonitoring
+     */
+    std::unique_ptr<LatencyMonitor> m_latencies;
+
+    /** Reception time of the byte at the given offset from the start of
+     * the internal buffer, or a null time if it is not known
+     */
+    base::Time getReceiveTime(size_t offset) const;
+
+    /** Calls extractPacket, measuring its duration if latency monitoring is
+     * enabled
+     */
+    int timedExtractPacket(uint8_t const* buffer, size_t buffer_size) const;
+
+    /** Calls waitRead on the main stream, measuring its duration if latency
+     * monitoring is enabled
+     */
+    bool timedWaitRead(base::Time const& timeout);
 
     void openIPClient(std::string const& hostname, int port, addrinfo const& hints);
 
@@ -167,12 +405,50 @@ protected:
     */
     void pullBytesFromInternal(uint8_t* buffer, int skip, int size);
 
+    /** Remove bytes from the front of the internal buffer */
+    void consumeInternalBuffer(int size);
+
+    /** Replaces the internal buffer, keeping the data it contains
+     *
+     * @param owned whether the driver must delete the new buffer
+     */
+    void replaceInternalBuffer(uint8_t* buffer, size_t size, bool owned);
+
+    /** Forget the results of the previous scans of the internal buffer
+     *
+     * This must be called whenever data is removed or moved in the
+     * internal buffer, or the way packets are searched for changes
+     */
+    void invalidateScan();
+
+    /** Move the bytes left in the internal buffer to its front if the space
+     * already consumed there is bigger than the space left at its end
+     *
+     * Consuming data from the internal buffer does not move the remaining
+     * bytes. This is done here, right before reading new data, so that the
+     * amount of data moved stays in the order of the amount of data consumed
+     * instead of being paid for each extracted packet.
+     */
+    void compactInternalBuffer();
+
     /** Helper for openURI to handle UDP streams
      *
      * They're rather complex to open because of backward compatibility reasons
      */
     void openURI_UDP(URI const& uri);
 
+    /** Helper for openURI to enable the batch mode of the datagram streams
+     * when the batch=N option is given
+     *
+     * The batch's datagrams are sized to MAX_PACKET_SIZE
+     */
+    void setDatagramBatchSize(int count);
+
+    /** Helper for openURI to replace the stream it just opened by an
+     * IOUringStream, when the io_uring=1 option is given
+     */
+    void switchToIOUring();
+
 public:
     /** Creates an Driver class for a packet-based protocol
      *
@@ -206,11 +482,15 @@ public:
 
     /** Returns the I/O statistics
      *
-     * Use resetStats() to set them back to 0
+     * Use resetStats() to set them back to 0. Unlike the rest of the
+     * driver, it can be called from another thread than the one doing the
+     * I/O, and returns a consistent snapshot without blocking it
      */
     Status getStatus() const;
 
     /** Reset the I/O statistics to 0
+     *
+     * It must be called from the thread that does the I/O
      */
     void resetStatus();
 
@@ -224,6 +504,55 @@ public:
      */
     void resetStats() { return resetStatus(); }
 
+    /** Sets how Status::stamp is updated
+     *
+     * The default is STAMP_ON_UPDATE. Use STAMP_ON_IO or STAMP_NEVER at
+     * high packet rates, where reading the clock for each packet is
+     * measurable
+     */
+    void setStatusStampMode(STATUS_STAMP_MODE mode);
+
+    /** How Status::stamp is updated
+     *
+     * @see setStatusStampMode
+     */
+    STATUS_STAMP_MODE getStatusStampMode() const;
+
+    /** Enables or disables the measurement of the driver's latencies
+     *
+     * When enabled, the driver records how long packets stay in its buffer,
+     * how long it waits for data, how long extractPacket takes and how long
+     * writePacket takes, into histograms that can be read with
+     * getLatencies(). It is disabled by default, as it costs a clock read
+     * around each of these operations.
+     *
+     * Disabling it drops the measurements. It must be called from the
+     * thread that does the I/O.
+     */
+    void setLatencyMonitoring(bool enable);
+
+    /** Whether latency monitoring is enabled
+     *
+     * @see setLatencyMonitoring
+     */
+    bool getLatencyMonitoring() const;
+
+    /** Returns the latency histograms
+     *
+     * The histograms are empty if latency monitoring is disabled. Like
+     * getStatus(), it can be called from another thread than the one doing
+     * the I/O
+     *
+     * @see setLatencyMonitoring
+     */
+    Latencies getLatencies() const;
+
+    /** Clears the latency histograms
+     *
+     * It must be called from the thread that does the I/O
+     */
+    void resetLatencies();
+
     /** Changes the packet extraction mode
      *
      * @see getExtractLastPacket
@@ -236,6 +565,145 @@ public:
      */
     bool getExtractLastPacket() const;
 
+    /** Changes the datagram mode
+     *
+     * Discards the data currently held in the internal buffer
+     *
+     * @see getDatagramMode
+     */
+    void setDatagramMode(bool flag);
+
+    /** Whether the driver is in datagram mode
+     *
+     * In datagram mode, each read from the stream is considered as a single
+     * datagram, and extractPacket is called only once per datagram instead
+     * of being called over a byte stream. Bytes that follow the packet at
+     * the start of a datagram are dropped, as are whole datagrams that do
+     * not start with a valid or complete packet. Packets can therefore not
+     * span multiple datagrams.
+     *
+     * This is meant for the udp, udpserver, unixdgram and unixdgramserver
+     * streams, which return a single datagram per read. It is enabled by
+     * the datagram=1 URI option.
+     */
+    bool getDatagramMode() const;
+
+    /** Enables or disables receive timestamps
+     *
+     * When enabled, the driver tracks the reception time of the bytes in its
+     * internal buffer, so that the time at which the first byte of a packet
+     * was received can be retrieved with getLastPacketTime or
+     * getPacketTime. Unlike a time taken when readPacket returns, it does
+     * not include the time spent by the data in the driver's buffer.
+     *
+     * Socket-based streams use the kernel receive timestamps
+     * (SO_TIMESTAMPNS). Other streams fall back to the time at which the
+     * data was read from the stream.
+     *
+     * It is enabled by the timestamps=1 URI option.
+     */
+    void setReceiveTimestamps(bool enable);
+
+    /** Whether receive timestamps are enabled
+     *
+     * @see setReceiveTimestamps
+     */
+    bool getReceiveTimestamps() const;
+
+    /** Reception time of the first byte of the last packet returned by
+     * readPacket or readPacketView
+     *
+     * It is null if receive timestamps are disabled
+     *
+     * @see setReceiveTimestamps
+     */
+    base::Time getLastPacketTime() const;
+
+    /** Reception time of the first byte of a packet returned by
+     * readPacketView or readPackets
+     *
+     * It must be called while the packet is still valid. It returns a null
+     * time if receive timestamps are disabled.
+     *
+     * @see setReceiveTimestamps
+     */
+    base::Time getPacketTime(PacketView const& packet) const;
+
+    /** Changes the size of the buffer in which data is received
+     *
+     * It defaults to MAX_PACKET_SIZE. A bigger buffer allows each read on
+     * the stream to get more data when a partial packet is already pending,
+     * which reduces the number of system calls on bursty links.
+     *
+     * The data currently in the buffer is kept. Packet views returned by
+     * readPacketView or readPackets are released.
+     *
+     * @throws std::invalid_argument if the size is smaller than
+     *   MAX_PACKET_SIZE or than the amount of data currently buffered
+     */
+    void setReceiveBufferSize(size_t size);
+
+    /** The size of the buffer in which data is received
+     *
+     * @see setReceiveBufferSize
+     */
+    size_t getReceiveBufferSize() const;
+
+    /** Makes the driver receive data in memory provided by the caller
+     *
+     * This allows to use a preallocated arena, a hugepage-backed region or
+     * a shared memory segment instead of the heap. The driver does not take
+     * ownership of the memory, which must stay valid until the driver is
+     * destroyed or the buffer replaced. Otherwise, it behaves as
+     * setReceiveBufferSize
+     */
+    void setReceiveBuffer(uint8_t* buffer, size_t size);
+
+    /** Pre-faults and locks the receive buffer in memory
+     *
+     * This avoids page faults the first time the buffer is used, and the
+     * buffer being swapped out. The setting also applies to the buffers
+     * set afterwards with setReceiveBufferSize or setReceiveBuffer.
+     *
+     * @throws UnixError if mlock fails, usually because of RLIMIT_MEMLOCK
+     */
+    void setReceiveBufferLocked(bool lock);
+
+    /** Whether the receive buffer is locked in memory
+     *
+     * @see setReceiveBufferLocked
+     */
+    bool isReceiveBufferLocked() const;
+
+    /** Limits the number of bytes examined by a single packet search
+     *
+     * On noisy lines, finding the next packet may require calling
+     * extractPacket on a lot of garbage. Setting a budget bounds the time
+     * spent in a single search. The search resumes where it stopped the
+     * next time, and readPacket keeps searching until either a packet is
+     * found or its timeout expires. hasPacket and readPackets may report no
+     * packets while unexamined data is still present in the internal
+     * buffer.
+     *
+     * @param bytes the maximum number of bytes, or zero for no limit (the
+     *   default)
+     */
+    void setScanBudget(int bytes);
+
+    /** The current scan budget
+     *
+     * @see setScanBudget
+     */
+    int getScanBudget() const;
+
+    /** Whether the last packet search stopped because of the scan budget
+     *
+     * The internal buffer then holds data that has not been examined yet
+     *
+     * @see setScanBudget
+     */
+    bool isScanBudgetExhausted() const;
+
     /** Opens an URI to a device
      *
      * The following formats are recognized:
@@ -244,6 +712,24 @@ public:
      * * tcp://hostname:port
      * * udp://hostname:remote_port[:local_port]
      * * udpserver://port
+     * * replay://path/to/capture[?realtime=0]
+     *
+     * Adding the io_uring=1 option to a serial, tcp, file, fd or unixstream
+     * URI makes the driver use IOUringStream instead of a plain file
+     * descriptor stream. The driver falls back to the plain stream if the
+     * kernel does not support io_uring.
+     *
+     * Adding the batch=N option to a udp, udpserver, unixdgram or
+     * unixdgramserver URI makes the stream receive up to N datagrams per
+     * system call. The datagram=1 option enables the datagram mode (see
+     * getDatagramMode)
+     *
+     * The timestamps=1 option enables receive timestamps (see
+     * setReceiveTimestamps)
+     *
+     * The nodelay, quickack, rcvbuf, sndbuf, busy_poll and priority options
+     * of tcp and udp URIs set the corresponding socket options (see
+     * SocketConfiguration::fromURI and setSocketConfiguration)
      */
     virtual void openURI(std::string const& uri);
 
@@ -351,6 +837,12 @@ public:
      */
     void openFile(std::string const& path);
 
+    /** Replays the data read in a capture file made by CaptureListener
+     *
+     * @see ReplayStream
+     */
+    void openReplay(std::string const& path, bool realtime = true);
+
     /** Opens a serial port and sets it up to a sane configuration
      *
      * Returns INVALID_FD on failure, or the file descriptor on success
@@ -376,9 +868,21 @@ public:
 
     /** Returns the file descriptor associated with this object. If no file
      * descriptor is assigned, returns INVALID_FD
+     *
+     * It is meant to wait for data with poll or epoll. With IOUringStream,
+     * it is an eventfd and not the device's file descriptor (see
+     * getDeviceFileDescriptor)
      */
     int getFileDescriptor() const;
 
+    /** Returns the file descriptor of the device itself, e.g. to configure
+     * it. If no file descriptor is assigned, returns INVALID_FD
+     *
+     * It is the same as getFileDescriptor() for all streams but
+     * IOUringStream
+     */
+    int getDeviceFileDescriptor() const;
+
     /** True if a valid file descriptor is assigned to this object */
     bool isValid() const;
 
@@ -495,6 +999,128 @@ public:
                    base::Time const& packet_timeout,
                    base::Time const& first_byte_timeout);
 
+    /** @overload
+     *
+     * Calls readPacketView using the default timeout as packet timeout, and
+     * no first byte timeout
+     */
+    PacketView readPacketView();
+
+    /** @overload
+     *
+     * Calls readPacketView without a first byte timeout
+     */
+    PacketView readPacketView(base::Time const& packet_timeout);
+
+    /** Reads a packet without copying it
+     *
+     * This behaves as readPacket, but instead of copying the packet in a
+     * caller-provided buffer, it returns a view on the packet as it is
+     * stored in the driver's internal buffer.
+     *
+     * The view is valid until either releasePacket is called, or the next
+     * call to any method that reads from the driver (readPacket, readRaw,
+     * readPacketView, readPackets) or clears it.
+     *
+     * @throws TimeoutError on timeout or no data, and UnixError on reading problems
+     */
+    PacketView readPacketView(base::Time const& packet_timeout,
+                              base::Time const& first_byte_timeout);
+
+    /** Returns all the packets that are available at once, without copying
+     * them
+     *
+     * This never waits for data. If \c read is true, a single non-blocking
+     * read is done on the stream first. The method then extracts as many
+     * complete packets as possible (up to \c max_packets) from the internal
+     * buffer, and returns views on them. As with readPacketView, these views
+     * are valid until either releasePacket is called, or the next read.
+     *
+     * If getExtractLastPacket() is true, only the last packet is returned.
+     *
+     * @param packets an array of at least \c max_packets elements that is
+     *   filled with the packets
+     * @return the number of packets that have been stored in \c packets
+     * @throws UnixError on reading problems
+     */
+    int readPackets(PacketView* packets, int max_packets, bool read = true);
+
+    /** Removes the packet(s) returned by the last call to readPacketView or
+     * readPackets from the internal buffer
+     *
+     * It is a no-op if there is no such packet. There is no need to call it
+     * explicitly before reading from the driver again.
+     */
+    void releasePacket();
+
+    /** Enables the asynchronous write mode
+     *
+     * queuePacket then copies packets into a queue of the given size and
+     * writes them only when the stream accepts data without blocking.
+     * Small packets are coalesced, so that a single system call writes
+     * many of them (writeBatch on datagram streams).
+     *
+     * The watermarks are set to 3/4 and 1/4 of the size, see
+     * setWriteQueueWatermarks
+     *
+     * @param size the queue size in bytes. Zero disables the queue
+     * @throws std::logic_error if the queue is not empty
+     */
+    void setWriteQueueSize(size_t size);
+
+    /** The size of the write queue in bytes, or zero if it is disabled */
+    size_t getWriteQueueSize() const;
+
+    /** Sets the thresholds used to report backpressure
+     *
+     * The queue becomes congested when it holds at least \c high bytes, and
+     * stops being congested when it drops to \c low bytes or less
+     *
+     * @see isWriteQueueCongested
+     */
+    void setWriteQueueWatermarks(size_t low, size_t high);
+
+    /** Whether the write queue went above its high watermark and did not
+     * drop to its low watermark since
+     *
+     * Use it to stop producing packets until the peer catches up
+     */
+    bool isWriteQueueCongested() const;
+
+    /** Number of bytes waiting in the write queue */
+    size_t getQueuedWriteBytes() const;
+
+    /** Whether the write queue holds data that has not been written yet */
+    bool hasPendingWrites() const;
+
+    /** Queues a packet and writes as much of the queue as possible without
+     * blocking
+     *
+     * Empty packets are ignored
+     *
+     * @return false if the packet does not fit in the queue. It is then not
+     *   queued at all
+     * @throws std::logic_error if the write queue is disabled
+     * @see setWriteQueueSize
+     */
+    bool queuePacket(uint8_t const* buffer, int buffer_size);
+
+    /** Queues a packet made of several segments
+     *
+     * @see queuePacket writePacket
+     */
+    bool queuePacket(PacketView const* segments, size_t count);
+
+    /** Writes as much of the write queue as the stream accepts without
+     * blocking
+     *
+     * Call it when the stream becomes writable. DriverReactor does it
+     * automatically.
+     *
+     * @return the number of bytes still queued
+     */
+    size_t flushWriteQueue();
+
     /** @overload
      *
      * Calls writePacket using the default write timeout
@@ -509,11 +1135,33 @@ public:
      * timeout in milliseconds. There is not infinite timeout value, and 0
      * is non-blocking at all
      *
+     * If the write queue holds packets, they are written first
+     *
      * @throws timeout_error on timeout and unix_error on reading problems
      * @returns always true. The return value is kept for backward compatibility only
      */
     bool writePacket(uint8_t const* buffer, int bufsize, base::Time const& timeout);
 
+    /** @overload
+     *
+     * Calls writePacket using the default write timeout
+     */
+    bool writePacket(PacketView const* segments, size_t count);
+
+    /** Writes a packet made of several segments
+     *
+     * This avoids copying e.g. a header, a payload and a checksum into a
+     * single buffer. The segments are written with writev or sendmsg when
+     * the stream supports it (see IOStream::writev), and are sent as a
+     * single datagram on datagram streams. The listeners are notified for
+     * each segment.
+     *
+     * @throws timeout_error on timeout and unix_error on writing problems
+     * @returns always true, for consistency with the other overloads
+     */
+    bool writePacket(PacketView const* segments, size_t count,
+                     base::Time const& timeout);
+
     /** Find a packet into the currently accumulated data.
      *
      * This method should be provided by subclasses. The @a buffer argument is
@@ -572,6 +1220,9 @@ public:
      */
     void removeListener(IOListener* stream);
 
+    /** Whether at least one listener has been added */
+    bool hasListeners() const;
+
     /** Whether the current stream is finished (e.g. end-of-file or disconnected)
      */
     bool eof() const;
@@ -582,6 +1233,32 @@ public:
 
     SerialConfiguration parseSerialConfiguration(std::string const &description);
 
+    /** Sets the options of the socket the driver is connected to
+     *
+     * The options that are set to -1 in the configuration are left
+     * unchanged. The effective configuration, as reported by the kernel, is
+     * logged once applied. Note that the kernel doubles the buffer sizes
+     * it is given.
+     *
+     * When quickack is set on a TCP stream, the driver sets TCP_QUICKACK
+     * again after each read (see FDStream::setQuickAck)
+     *
+     * @throws std::invalid_argument if the driver is not connected to a
+     *   socket, or if nodelay or quickack are set on a non-stream socket
+     * @throws UnixError if the kernel rejects an option, e.g. setting a
+     *   priority above 6 without CAP_NET_ADMIN
+     */
+    void setSocketConfiguration(SocketConfiguration const& config);
+
+    /** Returns the current options of the socket the driver is connected to
+     *
+     * nodelay and quickack are -1 if the socket is not a TCP socket
+     *
+     * @throws std::invalid_argument if the driver is not connected to a
+     *   socket
+     */
+    SocketConfiguration getSocketConfiguration() const;
+
     static std::string printable_com(std::string const& buffer);
     static std::string printable_com(uint8_t const* buffer, size_t buffer_size);
     static std::string printable_com(char const* buffer, size_t buffer_size);
@@ -0,0 +1,146 @@
+#include <iodrivers_base/DriverReactor.hpp>
+#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/IOStream.hpp>
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace iodrivers_base;
+
+/** Maximum number of events handled per call to epoll_wait */
+static const int MAX_EVENTS = 64;
+/** Maximum number of packets extracted per call to Driver::readPackets */
+static const int MAX_BATCH = 64;
+
+DriverReactor::DriverReactor()
+    : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    , m_events(MAX_EVENTS)
+{
+    if (m_epoll_fd == -1)
+        throw UnixError("DriverReactor: failed to create the epoll set");
+}
+
+DriverReactor::~DriverReactor()
+{
+    ::close(m_epoll_fd);
+}
+
+void DriverReactor::add(Driver& driver, PacketCallback callback)
+{
+    int fd = driver.getFileDescriptor();
+    if (fd == Driver::INVALID_FD)
+        throw std::invalid_argument("DriverReactor: driver has no valid file descriptor");
+    else if (m_registrations.find(fd) != m_registrations.end())
+        throw std::invalid_argument("DriverReactor: driver already registered");
+
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        throw UnixError("DriverReactor: failed to add file descriptor to the epoll set");
+
+    Registration registration = { &driver, callback, false };
+    m_registrations[fd] = registration;
+    dispatch(fd, false);
+}
+
+void DriverReactor::remove(Driver& driver)
+{
+    for (auto it = m_registrations.begin(); it != m_registrations.end(); ++it) {
+        if (it->second.driver == &driver) {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, it->first, NULL);
+            m_registrations.erase(it);
+            return;
+        }
+    }
+}
+
+size_t DriverReactor::size() const
+{
+    return m_registrations.size();
+}
+
+int DriverReactor::poll(base::Time const& timeout)
+{
+    updateWriteInterest();
+
+    int timeout_ms = (std::max<int64_t>(0, timeout.toMicroseconds()) + 999) / 1000;
+    int ret = epoll_wait(m_epoll_fd, m_events.data(), m_events.size(), timeout_ms);
+    if (ret < 0) {
+        if (errno == EINTR)
+            return 0;
+        throw UnixError("DriverReactor: error in epoll_wait()");
+    }
+
+    int count = 0;
+    for (int i = 0; i < ret; ++i) {
+        int fd = m_events[i].data.fd;
+        if (m_events[i].events & EPOLLOUT) {
+            auto it = m_registrations.find(fd);
+            if (it != m_registrations.end())
+                it->second.driver->flushWriteQueue();
+        }
+        if (m_events[i].events & ~EPOLLOUT)
+            count += dispatch(fd, true);
+    }
+    return count;
+}
+
+void DriverReactor::updateWriteInterest()
+{
+    for (auto& entry : m_registrations) {
+        Registration& registration = entry.second;
+        bool writing = registration.driver->hasPendingWrites();
+        if (writing == registration.writing)
+            continue;
+
+        epoll_event event = epoll_event();
+        event.events = writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        event.data.fd = entry.first;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, entry.first, &event) == -1)
+            throw UnixError("DriverReactor: failed to modify the epoll set");
+        registration.writing = writing;
+    }
+}
+
+int DriverReactor::dispatch(int fd, bool read)
+{
+    auto it = m_registrations.find(fd);
+    if (it == m_registrations.end())
+        return 0;
+
+    // Copy the callback, as it may remove the driver from the reactor
+    Driver& driver = *it->second.driver;
+    PacketCallback callback = it->second.callback;
+    PacketView packets[MAX_BATCH];
+    int count = 0;
+    while (true) {
+        int batch_size = driver.readPackets(packets, MAX_BATCH, read);
+        read = false;
+
+        for (int i = 0; i < batch_size; ++i) {
+            callback(packets[i]);
+            ++count;
+
+            if (m_registrations.find(fd) == m_registrations.end())
+                return count;
+        }
+
+        // The fd will not report the data left in the internal buffer or
+        // in the stream, so go on until neither holds packets
+        IOStream* stream = driver.getMainStream();
+        if (batch_size == MAX_BATCH || driver.isScanBudgetExhausted())
+            continue;
+        else if (!stream || !stream->hasBufferedData())
+            break;
+        read = true;
+    }
+
+    driver.releasePacket();
+    if (driver.eof())
+        remove(driver);
+    return count;
+}
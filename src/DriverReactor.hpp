@@ -0,0 +1,110 @@
+#ifndef IODRIVERS_BASE_DRIVER_REACTOR_HPP
+#define IODRIVERS_BASE_DRIVER_REACTOR_HPP
+
+#include <base/Time.hpp>
+#include <iodrivers_base/PacketView.hpp>
+
+#include <functional>
+#include <map>
+#include <vector>
+
+struct epoll_event;
+
+namespace iodrivers_base {
+    class Driver;
+
+    /** Services many drivers from a single thread
+     *
+     * The reactor waits on the file descriptors of all registered drivers
+     * with a single epoll set. When one becomes readable, the reactor reads
+     * the available data and extracts all complete packets using the
+     * driver's own extractPacket (see Driver::readPackets), and passes them
+     * one by one to the callback associated with the driver.
+     *
+     * The reactor also flushes the drivers' write queue (see
+     * Driver::queuePacket) when their file descriptor becomes writable.
+     *
+     * The reactor does not own the drivers. Their main stream, and therefore
+     * their file descriptor, must not change while they are registered.
+     *
+     * This uses epoll, and is therefore only available on Linux.
+     */
+    class DriverReactor
+    {
+    public:
+        /** Callback called for each packet received by a driver
+         *
+         * The view is only valid during the call
+         */
+        typedef std::function<void (PacketView const&)> PacketCallback;
+
+        DriverReactor();
+        ~DriverReactor();
+
+        /** Registers a driver
+         *
+         * The packets already in the driver's internal buffer are dispatched
+         * right away, as the reactor would otherwise only see them when new
+         * data arrives
+         *
+         * @throws std::invalid_argument if the driver has no valid file
+         *   descriptor, or if it is already registered
+         */
+        void add(Driver& driver, PacketCallback callback);
+
+        /** Deregisters a driver
+         *
+         * It is a no-op if the driver is not registered. It is safe to call
+         * from within a packet callback, which may then also destroy the
+         * driver. For this reason, the reactor does not touch the driver
+         * anymore: the packets it extracted along with the current one are
+         * not dispatched, and the driver's next read discards them. They
+         * are counted as received in the driver's status
+         */
+        void remove(Driver& driver);
+
+        /** Returns the number of registered drivers */
+        size_t size() const;
+
+        /** Waits for data on any of the registered drivers for at most \c
+         * timeout, and dispatches the packets that have been received
+         *
+         * Drivers whose stream reached end-of-file are automatically removed
+         * from the reactor. Exceptions raised by a driver while reading (e.g.
+         * UnixError) are passed through, and the driver stays registered.
+         *
+         * @return the number of packets that have been dispatched
+         */
+        int poll(base::Time const& timeout);
+
+    private:
+        struct Registration
+        {
+            Driver* driver;
+            PacketCallback callback;
+            /** Whether the file descriptor is registered for EPOLLOUT */
+            bool writing;
+        };
+
+        int m_epoll_fd;
+        std::map<int, Registration> m_registrations;
+        std::vector<epoll_event> m_events;
+
+        DriverReactor(DriverReactor const&) = delete;
+        DriverReactor& operator =(DriverReactor const&) = delete;
+
+        /** Dispatches the packets of the driver registered for \c fd
+         *
+         * @param read whether to read the available data from the stream
+         *   first, or only dispatch the packets already in the internal buffer
+         */
+        int dispatch(int fd, bool read);
+
+        /** Registers for EPOLLOUT the drivers that have pending writes, and
+         * deregisters the others
+         */
+        void updateWriteInterest();
+    };
+}
+
+#endif
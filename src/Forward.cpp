@@ -1,37 +1,435 @@
+#include <base-logging/Logging.hpp>
 #include <iodrivers_base/Forward.hpp>
 #include <iodrivers_base/Driver.hpp>
-#include <thread>
+#include <iodrivers_base/IOStream.hpp>
+#include <iodrivers_base/Timeout.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <typeinfo>
 #include <vector>
 
 using namespace std;
 using namespace iodrivers_base;
 
-struct QuitGuard
-{
-    bool& quitFlag;
-    Driver& driver1;
-    Driver& driver2;
-
-    ~QuitGuard() {
-        quitFlag = true;
-    }
-};
+static const int MAX_PACKETS = 64;
 
-typedef int (Driver::*ReadMode)(uint8_t*, int, base::Time const&);
-
-static int forwardData(Driver& from, ReadMode mode, Driver& to,
-                        uint8_t* buffer, int buffer_size, base::Time timeout)
+/** Whether the stream is a plain file descriptor, which splice() can use */
+static bool isPlainStream(IOStream* stream, bool& has_eof)
 {
-    int size = 0;
-    try {
-        size = (from.*mode)(buffer, buffer_size, timeout);
+    if (!stream) {
+        return false;
+    }
+    else if (typeid(*stream) == typeid(FDStream)) {
+        has_eof = static_cast<FDStream*>(stream)->hasEOF();
+        return true;
     }
-    catch(TimeoutError&) {
+    else if (typeid(*stream) == typeid(SocketStream)) {
+        has_eof = static_cast<SocketStream*>(stream)->hasEOF();
+        return true;
     }
-    if (size != 0) {
-        to.writePacket(buffer, size);
+    return false;
+}
+
+/** Whether the driver's stream holds received data that epoll does not
+ * report, see IOStream::hasBufferedData
+ */
+static bool hasBufferedData(Driver& driver)
+{
+    IOStream* stream = driver.getMainStream();
+    return stream && stream->hasBufferedData();
+}
+
+namespace {
+    /** Enables the write queue of a driver for the duration of forward()
+     *
+     * The previous queue size is restored on destruction, if the queue is
+     * empty by then
+     */
+    struct WriteQueueGuard
+    {
+        Driver& driver;
+        size_t old_size;
+
+        WriteQueueGuard(Driver& driver, size_t size)
+            : driver(driver)
+            , old_size(driver.getWriteQueueSize()) {
+            if (old_size < size) {
+                driver.setWriteQueueSize(size);
+            }
+        }
+
+        ~WriteQueueGuard() {
+            if (driver.getWriteQueueSize() != old_size && !driver.hasPendingWrites()) {
+                driver.setWriteQueueSize(old_size);
+            }
+        }
+    };
+
+    /** One of the two directions of forward()
+     *
+     * Data read from 'from' is written to 'to' through the write queue of
+     * 'to', so that a direction whose destination is slow never blocks the
+     * other one. The direction stops reading while the data it already read
+     * cannot be queued (backpressure).
+     *
+     * In raw mode, if both drivers use a plain file descriptor and have no
+     * listeners, the data goes from one file descriptor to the other through
+     * a pipe with splice(), without being copied to user space. It then
+     * bypasses the drivers entirely, including their I/O statistics.
+     */
+    struct Direction
+    {
+        Driver& from;
+        Driver& to;
+        bool raw_mode;
+        base::Time timeout;
+        uint8_t* buffer;
+        size_t buffer_size;
+
+        /** Bytes of 'buffer' that have not been queued on 'to' yet */
+        size_t pending = 0;
+        /** Time at which the gathered bytes must be forwarded */
+        base::Time deadline;
+        /** Whether we wait for 'to' to be writable before writing more */
+        bool blocked = false;
+
+        /** Packets read from 'from' in packet mode */
+        PacketView packets[MAX_PACKETS];
+        int packet_count = 0;
+        /** Index of the first packet that has not been queued on 'to' yet */
+        int packet_index = 0;
+
+        /** The splice pipe, or -1 if the data is copied */
+        int pipe_fds[2] = { -1, -1 };
+        size_t pipe_capacity = 0;
+        size_t in_pipe = 0;
+        bool has_eof = true;
+        /** Set when splice() reached the end of 'from' */
+        bool eof = false;
+
+        Direction(Driver& from, Driver& to, bool raw_mode,
+                  base::Time const& timeout,
+                  uint8_t* buffer, size_t buffer_size,
+                  bool allow_splice = true)
+            : from(from), to(to), raw_mode(raw_mode), timeout(timeout)
+            , buffer(buffer), buffer_size(buffer_size) {
+            bool to_has_eof;
+            if (allow_splice && raw_mode &&
+                !from.hasListeners() && !to.hasListeners() &&
+                isPlainStream(from.getMainStream(), has_eof) &&
+                isPlainStream(to.getMainStream(), to_has_eof)) {
+                openPipe();
+            }
+        }
+
+        ~Direction() {
+            closePipe();
+        }
+
+        void openPipe() {
+            if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+                pipe_fds[0] = pipe_fds[1] = -1;
+                return;
+            }
+            // Best effort, the pipe keeps its default size if this fails
+            fcntl(pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(buffer_size));
+            int capacity = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+            pipe_capacity = min<size_t>(buffer_size, capacity > 0 ? capacity : 0);
+            if (pipe_capacity == 0) {
+                closePipe();
+            }
+        }
+
+        void closePipe() {
+            if (pipe_fds[0] != -1) {
+                ::close(pipe_fds[0]);
+                ::close(pipe_fds[1]);
+                pipe_fds[0] = pipe_fds[1] = -1;
+            }
+        }
+
+        bool isSplicing() const {
+            return pipe_fds[0] != -1;
+        }
+
+        /** Forwards the data that the driver has buffered before forward()
+         * got called
+         */
+        void start(base::Time const& now) {
+            if (!raw_mode) {
+                queuePackets(false);
+                return;
+            }
+
+            size_t queued = from.getStatus().queued_bytes;
+            if (queued) {
+                pending = from.readRaw(buffer, min(queued, buffer_size), base::Time());
+                deadline = now + timeout;
+            }
+        }
+
+        bool wantsRead() const {
+            if (eof || blocked) {
+                return false;
+            }
+            else if (isSplicing()) {
+                return in_pipe < pipe_capacity;
+            }
+            else if (raw_mode) {
+                return pending < buffer_size;
+            }
+            else {
+                return packet_index == packet_count && !to.isWriteQueueCongested();
+            }
+        }
+
+        bool wantsWrite() const {
+            return blocked || to.hasPendingWrites();
+        }
+
+        bool hasPendingData() const {
+            return pending || in_pipe || packet_index < packet_count ||
+                   to.hasPendingWrites();
+        }
+
+        /** Whether the direction waits for a timeout to forward the data
+         * it gathered, as opposed to waiting for 'to' to become writable
+         */
+        bool hasDeadline() const {
+            return raw_mode && !blocked && (pending || in_pipe);
+        }
+
+        void read(base::Time const& now) {
+            if (isSplicing()) {
+                spliceIn(now);
+            }
+            else if (raw_mode) {
+                size_t c = from.readRaw(buffer + pending, buffer_size - pending,
+                                        base::Time());
+                if (c && !pending) {
+                    deadline = now + timeout;
+                }
+                pending += c;
+            }
+            else {
+                queuePackets(true);
+            }
+        }
+
+        void spliceIn(base::Time const& now) {
+            ssize_t c = splice(from.getFileDescriptor(), NULL, pipe_fds[1], NULL,
+                               pipe_capacity - in_pipe,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (c > 0) {
+                if (!in_pipe) {
+                    deadline = now + timeout;
+                }
+                in_pipe += c;
+            }
+            else if (c == 0) {
+                eof = has_eof;
+            }
+            else if (errno == EINVAL && in_pipe == 0) {
+                // This kind of file descriptor does not support splice (e.g.
+                // ttys on recent kernels), copy instead
+                closePipe();
+                read(now);
+            }
+            else if (errno != EAGAIN) {
+                throw UnixError("forward(): error reading data");
+            }
+        }
+
+        /** Called when 'to' becomes writable */
+        void resume() {
+            to.flushWriteQueue();
+            blocked = false;
+        }
+
+        /** Writes the data that is due
+         *
+         * @param force write the gathered data regardless of the timeout
+         */
+        void write(base::Time const& now, bool force) {
+            if (blocked) {
+                return;
+            }
+            else if (!raw_mode) {
+                queuePackets(false);
+                return;
+            }
+
+            bool due = force || now >= deadline;
+            if (pending && (due || pending == buffer_size)) {
+                if (!to.queuePacket(buffer, pending)) {
+                    blocked = true;
+                    return;
+                }
+                pending = 0;
+            }
+
+            if (in_pipe && (due || in_pipe == pipe_capacity)) {
+                // Do not overtake the data that is still in the queue
+                if (to.hasPendingWrites()) {
+                    blocked = true;
+                    return;
+                }
+                spliceOut();
+            }
+        }
+
+        void spliceOut() {
+            ssize_t c = splice(pipe_fds[0], NULL, to.getFileDescriptor(), NULL,
+                               in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (c > 0) {
+                in_pipe -= c;
+            }
+            else if (c < 0 && errno != EAGAIN) {
+                throw UnixError("forward(): error writing data");
+            }
+            blocked = (in_pipe != 0);
+        }
+
+        void queuePackets(bool read) {
+            while (true) {
+                for (; packet_index < packet_count; ++packet_index) {
+                    PacketView const& packet = packets[packet_index];
+                    if (to.queuePacket(&packet, 1)) {
+                        continue;
+                    }
+                    else if (to.hasPendingWrites()) {
+                        blocked = true;
+                        return;
+                    }
+                    // The packet is bigger than the queue
+                    to.writePacket(&packet, 1);
+                }
+
+                packet_count = from.readPackets(packets, MAX_PACKETS, read);
+                packet_index = 0;
+                read = false;
+                if (packet_count == 0) {
+                    return;
+                }
+            }
+        }
+
+        /** Gives 'to' up to its write timeout to send the remaining data */
+        void drain() {
+            Timeout drain_timeout(to.getWriteTimeout().toMilliseconds());
+            while (true) {
+                blocked = false;
+                write(Timeout::now(), true);
+                if (!hasPendingData() || drain_timeout.elapsed()) {
+                    return;
+                }
+                to.getMainStream()->waitWrite(
+                    base::Time::fromMilliseconds(drain_timeout.timeLeft())
+                );
+                to.flushWriteQueue();
+            }
+        }
+    };
+
+    /** epoll-based wait on the file descriptors of a set of drivers
+     *
+     * Regular files cannot be registered in epoll. They are always ready,
+     * so wait() reports them as such without waiting.
+     */
+    struct Poller
+    {
+        struct Entry
+        {
+            int fd = -1;
+            uint32_t events = 0;
+            bool pollable = true;
+        };
+
+        int fd;
+        vector<Entry> entries;
+        vector<epoll_event> events;
+
+        Poller(size_t count)
+            : fd(epoll_create1(EPOLL_CLOEXEC))
+            , entries(count)
+            , events(count * 2) {
+            if (fd == -1) {
+                throw UnixError("forward(): cannot create the epoll instance");
+            }
+        }
+
+        ~Poller() {
+            ::close(fd);
+        }
+
+        /** Changes the events monitored on the file descriptor of an entry
+         *
+         * The file descriptor is removed from the set when there are none,
+         * so that hangups are not reported while nothing is read from it
+         */
+        void update(int index, int target_fd, uint32_t new_events) {
+            Entry& entry = entries[index];
+            if (!entry.pollable || entry.events == new_events) {
+                entry.events = new_events;
+                return;
+            }
+
+            epoll_event event = {};
+            event.events = new_events;
+            event.data.u32 = index;
+            int op = !new_events ? EPOLL_CTL_DEL :
+                     !entry.events ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            if (epoll_ctl(fd, op, target_fd, &event) != 0) {
+                if (op != EPOLL_CTL_ADD || errno != EPERM) {
+                    throw UnixError("forward(): cannot register file descriptor in epoll");
+                }
+                entry.pollable = false;
+            }
+            entry.fd = target_fd;
+            entry.events = new_events;
+        }
+
+        /** Waits for events and returns how many are stored in \c events */
+        int wait(int timeout_ms) {
+            for (auto const& entry : entries) {
+                if (!entry.pollable && entry.events) {
+                    timeout_ms = 0;
+                }
+            }
+
+            int ret = epoll_wait(fd, events.data(), entries.size(), timeout_ms);
+            if (ret < 0) {
+                if (errno != EINTR) {
+                    throw UnixError("forward(): error in epoll_wait()");
+                }
+                ret = 0;
+            }
+
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (!entries[i].pollable && entries[i].events) {
+                    events[ret].events = entries[i].events;
+                    events[ret].data.u32 = i;
+                    ++ret;
+                }
+            }
+            return ret;
+        }
+    };
+
+    /** Computes the epoll_wait timeout to the deadline of a direction */
+    void updateWaitTime(int& wait_ms, base::Time const& deadline,
+                        base::Time const& now)
+    {
+        int64_t remaining_us = (deadline - now).toMicroseconds();
+        int ms = max<int64_t>(0, (remaining_us + 999) / 1000);
+        wait_ms = wait_ms == -1 ? ms : min(wait_ms, ms);
     }
-    return size;
 }
 
 void iodrivers_base::forward(bool raw_mode,
@@ -40,38 +438,360 @@ void iodrivers_base::forward(bool raw_mode,
                 base::Time timeout2,
                 size_t const buffer_size)
 {
-    vector<uint8_t> buffer(buffer_size);
-    int fd1 = driver1.getFileDescriptor();
-    int fd2 = driver2.getFileDescriptor();
-    int select_nfd = std::max(fd1, fd2) + 1;
+    vector<uint8_t> buffer(buffer_size * 2);
+    forward(raw_mode, driver1, driver2, buffer.data(), buffer.size(),
+            timeout1, timeout2);
+}
 
+void iodrivers_base::forward(bool raw_mode,
+                Driver& driver1, Driver& driver2,
+                uint8_t* buffer, size_t const buffer_size,
+                base::Time timeout1,
+                base::Time timeout2)
+{
+    size_t direction_size = buffer_size / 2;
+    WriteQueueGuard queue1(driver1, direction_size);
+    WriteQueueGuard queue2(driver2, direction_size);
 
-    ReadMode readMode = raw_mode ? static_cast<ReadMode>(&Driver::readRaw) :
-                                   static_cast<ReadMode>(&Driver::readPacket);
+    Direction direction12(driver1, driver2, raw_mode, timeout1,
+                          buffer, direction_size);
+    Direction direction21(driver2, driver1, raw_mode, timeout2,
+                          buffer + direction_size, direction_size);
 
-    while (!driver1.eof() && !driver2.eof()) {
-        fd_set set;
-        FD_ZERO(&set);
-        FD_SET(fd1, &set);
-        FD_SET(fd2, &set);
+    // Driver i is the source of directions[i] and the destination of
+    // directions[1 - i]
+    Driver* drivers[2] = { &driver1, &driver2 };
+    Direction* directions[2] = { &direction12, &direction21 };
+    Poller poller(2);
 
-        timeval timeout_spec = {
-            static_cast<time_t>(10),
-            suseconds_t(0)
-        };
+    base::Time now = Timeout::now();
+    for (auto direction : directions) {
+        direction->start(now);
+        direction->write(now, false);
+    }
+
+    auto closed = [&](int i) {
+        return drivers[i]->eof() || directions[i]->eof;
+    };
+    while (!closed(0) && !closed(1)) {
+        for (int i = 0; i < 2; ++i) {
+            uint32_t events = 0;
+            if (directions[i]->wantsRead()) {
+                events |= EPOLLIN;
+            }
+            if (directions[1 - i]->wantsWrite()) {
+                events |= EPOLLOUT;
+            }
+            poller.update(i, drivers[i]->getFileDescriptor(), events);
+        }
+
+        int wait_ms = -1;
+        for (auto direction : directions) {
+            if (direction->hasDeadline()) {
+                updateWaitTime(wait_ms, direction->deadline, now);
+            }
+        }
+
+        int ret = poller.wait(wait_ms);
+        now = Timeout::now();
+        for (int e = 0; e < ret; ++e) {
+            auto const& event = poller.events[e];
+            int i = event.data.u32;
+            if (event.events & EPOLLOUT) {
+                directions[1 - i]->resume();
+            }
+            if ((event.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                directions[i]->wantsRead()) {
+                directions[i]->read(now);
+            }
+        }
+        // epoll does not report the data the streams already received
+        for (int i = 0; i < 2; ++i) {
+            while (directions[i]->wantsRead() && hasBufferedData(*drivers[i])) {
+                directions[i]->read(now);
+            }
+        }
+
+        for (auto direction : directions) {
+            direction->write(now, false);
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (!closed(1 - i)) {
+            directions[i]->drain();
+        }
+    }
+}
+
+namespace {
+    /** A sink of fanOut() */
+    struct Sink
+    {
+        Driver& driver;
+        FanOutSinkStatus& status;
+        vector<uint8_t> buffer;
+        /** The data received from the sink, forwarded to the source */
+        Direction fan_in;
+
+        Sink(Driver& driver, FanOutSinkStatus& status, Driver& source,
+             bool raw_mode, size_t buffer_size)
+            : driver(driver)
+            , status(status)
+            , buffer(buffer_size)
+            , fan_in(driver, source, raw_mode, base::Time(),
+                     buffer.data(), buffer.size(), false) {}
+
+        bool isOpen() const {
+            return !status.closed;
+        }
 
-        int ret = select(select_nfd, &set, NULL, NULL, &timeout_spec);
-        if (ret < 0 && errno != EINTR)
-            throw UnixError("forward(): error in select()");
-        else if (ret == 0)
-            continue;
+        void close(string const& reason) {
+            LOG_WARN_S << "fanOut(): removing sink: " << reason << endl;
+            status.closed = true;
+        }
+
+        void queue(PacketView const& packet) {
+            try {
+                if (!driver.queuePacket(&packet, 1)) {
+                    status.dropped_bytes += packet.size;
+                }
+            }
+            catch (UnixError const& e) {
+                close(e.what());
+            }
+        }
+
+        void flush() {
+            try {
+                driver.flushWriteQueue();
+            }
+            catch (UnixError const& e) {
+                close(e.what());
+            }
+        }
 
-        if (FD_ISSET(fd1, &set)) {
-            forwardData(driver1, readMode, driver2, &buffer[0], buffer_size, timeout1);
+        /** Gives the sink up to its write timeout to send its queue */
+        void drain() {
+            Timeout drain_timeout(driver.getWriteTimeout().toMilliseconds());
+            while (isOpen() && driver.hasPendingWrites() &&
+                   !drain_timeout.elapsed()) {
+                try {
+                    driver.getMainStream()->waitWrite(
+                        base::Time::fromMilliseconds(drain_timeout.timeLeft())
+                    );
+                }
+                catch (UnixError const& e) {
+                    close(e.what());
+                    return;
+                }
+                flush();
+            }
         }
 
-        if (FD_ISSET(fd2, &set)) {
-            forwardData(driver2, readMode, driver1, &buffer[0], buffer_size, timeout1);
+        void read(base::Time const& now) {
+            try {
+                fan_in.read(now);
+            }
+            catch (UnixError const& e) {
+                close(e.what());
+                return;
+            }
+            if (driver.eof()) {
+                close("end of stream");
+            }
+        }
+    };
+
+    /** The data received from the source of fanOut(), sent to all sinks */
+    struct FanOut
+    {
+        Driver& source;
+        vector<unique_ptr<Sink>>& sinks;
+        bool raw_mode;
+        base::Time timeout;
+        vector<uint8_t> buffer;
+        size_t pending = 0;
+        base::Time deadline;
+        PacketView packets[MAX_PACKETS];
+
+        FanOut(Driver& source, vector<unique_ptr<Sink>>& sinks, bool raw_mode,
+               base::Time const& timeout, size_t buffer_size)
+            : source(source), sinks(sinks), raw_mode(raw_mode)
+            , timeout(timeout), buffer(buffer_size) {}
+
+        bool wantsRead() const {
+            return !raw_mode || pending < buffer.size();
+        }
+
+        bool hasDeadline() const {
+            return raw_mode && pending;
+        }
+
+        void start(base::Time const& now) {
+            if (!raw_mode) {
+                sendPackets(false);
+                return;
+            }
+
+            size_t queued = source.getStatus().queued_bytes;
+            if (queued) {
+                pending = source.readRaw(buffer.data(), min(queued, buffer.size()),
+                                         base::Time());
+                deadline = now + timeout;
+            }
+        }
+
+        void read(base::Time const& now) {
+            if (!raw_mode) {
+                sendPackets(true);
+                return;
+            }
+
+            size_t c = source.readRaw(buffer.data() + pending,
+                                      buffer.size() - pending, base::Time());
+            if (c && !pending) {
+                deadline = now + timeout;
+            }
+            pending += c;
+        }
+
+        void write(base::Time const& now, bool force) {
+            if (pending && (force || now >= deadline || pending == buffer.size())) {
+                send(PacketView(buffer.data(), pending));
+                pending = 0;
+            }
+        }
+
+        void sendPackets(bool read) {
+            while (int count = source.readPackets(packets, MAX_PACKETS, read)) {
+                for (int i = 0; i < count; ++i) {
+                    send(packets[i]);
+                }
+                read = false;
+            }
+        }
+
+        void send(PacketView const& packet) {
+            for (auto& sink : sinks) {
+                if (sink->isOpen()) {
+                    sink->queue(packet);
+                }
+            }
+        }
+    };
+}
+
+vector<FanOutSinkStatus> iodrivers_base::fanOut(
+    bool raw_mode, Driver& source, vector<Driver*> const& sink_drivers,
+    base::Time timeout, size_t buffer_size, size_t sink_queue_size)
+{
+    vector<FanOutSinkStatus> result(sink_drivers.size());
+    WriteQueueGuard source_queue(source, buffer_size);
+    vector<unique_ptr<WriteQueueGuard>> sink_queues;
+    vector<unique_ptr<Sink>> sinks;
+    for (size_t i = 0; i < sink_drivers.size(); ++i) {
+        sink_queues.emplace_back(
+            new WriteQueueGuard(*sink_drivers[i], sink_queue_size)
+        );
+        sinks.emplace_back(
+            new Sink(*sink_drivers[i], result[i], source, raw_mode, buffer_size)
+        );
+    }
+    FanOut fan_out(source, sinks, raw_mode, timeout, buffer_size);
+
+    // Entry 0 is the source, entry i + 1 is sink i
+    Poller poller(sinks.size() + 1);
+
+    base::Time now = Timeout::now();
+    fan_out.start(now);
+    fan_out.write(now, false);
+
+    auto hasOpenSinks = [&sinks] {
+        for (auto const& sink : sinks) {
+            if (sink->isOpen()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    while (!source.eof() && hasOpenSinks()) {
+        uint32_t source_events = fan_out.wantsRead() ? uint32_t(EPOLLIN) : 0u;
+        for (size_t i = 0; i < sinks.size(); ++i) {
+            Sink& sink = *sinks[i];
+            uint32_t events = 0;
+            if (sink.isOpen()) {
+                if (sink.fan_in.wantsWrite()) {
+                    source_events |= EPOLLOUT;
+                }
+                // Regular files are only written
+                if (sink.fan_in.wantsRead() && poller.entries[i + 1].pollable) {
+                    events |= EPOLLIN;
+                }
+                if (sink.driver.hasPendingWrites()) {
+                    events |= EPOLLOUT;
+                }
+            }
+            poller.update(i + 1, sink.driver.getFileDescriptor(), events);
+        }
+        poller.update(0, source.getFileDescriptor(), source_events);
+
+        int wait_ms = -1;
+        if (fan_out.hasDeadline()) {
+            updateWaitTime(wait_ms, fan_out.deadline, now);
+        }
+
+        int ret = poller.wait(wait_ms);
+        now = Timeout::now();
+        for (int e = 0; e < ret; ++e) {
+            auto const& event = poller.events[e];
+            size_t index = event.data.u32;
+            bool readable = event.events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+            if (index == 0) {
+                if (event.events & EPOLLOUT) {
+                    for (auto& sink : sinks) {
+                        sink->fan_in.resume();
+                    }
+                }
+                if (readable && fan_out.wantsRead()) {
+                    fan_out.read(now);
+                }
+                continue;
+            }
+
+            Sink& sink = *sinks[index - 1];
+            if (sink.isOpen() && (event.events & EPOLLOUT)) {
+                sink.flush();
+            }
+            if (sink.isOpen() && readable && sink.fan_in.wantsRead() &&
+                poller.entries[index].pollable) {
+                sink.read(now);
+            }
+        }
+        // epoll does not report the data the streams already received
+        while (fan_out.wantsRead() && hasBufferedData(source)) {
+            fan_out.read(now);
+        }
+        for (auto& sink : sinks) {
+            while (sink->isOpen() && sink->fan_in.wantsRead() &&
+                   hasBufferedData(sink->driver)) {
+                sink->read(now);
+            }
+        }
+
+        fan_out.write(now, false);
+        for (auto& sink : sinks) {
+            if (sink->isOpen()) {
+                sink->fan_in.write(now, false);
+            }
+        }
+    }
+
+    fan_out.write(now, true);
+    for (auto& sink : sinks) {
+        if (sink->isOpen()) {
+            sink->drain();
         }
     }
+    return result;
 }
@@ -2,6 +2,8 @@
 #define IODRIVERS_BASE_FORWARD_HPP
 
 #include <base/Time.hpp>
+#include <stdint.h>
+#include <vector>
 
 namespace iodrivers_base {
     class Driver;
@@ -9,7 +11,22 @@ namespace iodrivers_base {
     /** Forward data between two subclasses of iodrivers_base::Driver
      *
      * It blocks until one of the connections is closed (the driver
-     * detects an EOF)
+     * detects an EOF). The data that has already been received from the
+     * other connection is then written, within the write timeout of its
+     * destination.
+     *
+     * The two directions are independent: each has its own buffer, and data
+     * is written through the write queue of the destination driver (see
+     * Driver::queuePacket), so that a slow destination does not block the
+     * other direction. A direction stops reading while its destination
+     * cannot accept more data. The write queues are enabled for the duration
+     * of the call if they are not already.
+     *
+     * In raw mode, if both drivers use a plain file descriptor (e.g. tcp,
+     * unixstream or fd URIs) and have no listeners, the data is moved with
+     * splice() and is never copied to user space. This bypasses the drivers,
+     * whose statistics are then not updated. Serial ports do not support
+     * splice() and are always copied.
      *
      * The timeouts are meant to be used to avoid passing data byte-by-byte.
      * This is important when forwarding from a relatively slow connection (e.g.
@@ -28,24 +45,94 @@ namespace iodrivers_base {
      *      reception of a first byte and the sending of the bytes received.
      * </li>
      *
+     * The timeouts are only used in raw mode. In packet mode, packets are
+     * forwarded as soon as they are complete.
+     *
      * @param raw_mode whether bytes are read using readRaw (true) or readPacket(false)
      * @param driver1 one of the two drivers
-     * @param timeout1 how long we should wait, while reading, before
-     *                 forwarding the data received from driver2. Set to a
-     *                 nonzero value to gather bytes into bigger chunks when
-     *                 forwarding from a slow connection
+     * @param timeout1 how long we should wait, after the first byte received
+     *                 from driver1, before forwarding the data to driver2.
+     *                 Set to a nonzero value to gather bytes into bigger
+     *                 chunks when forwarding from a slow connection
      * @param driver2 the other driver
-     * @param timeout2 how long we should wait, while reading, before
-     *                 forwarding the data received from driver2. Set to avoid
-     *                 nonzero value to gather bytes into bigger chunks when
-     *                 forwarding from a slow connection
-     * @param buffer_size the size of the reading buffer size. In practice,
-     *                    it sets the maximum size of a forwarded packet
+     * @param timeout2 how long we should wait, after the first byte received
+     *                 from driver2, before forwarding the data to driver1
+     * @param buffer_size the size of the reading buffer of each direction.
+     *                    In practice, it sets the maximum size of a
+     *                    forwarded chunk in raw mode
      */
     void forward(bool raw_mode, Driver& driver1, Driver& driver2,
                  base::Time timeout1 = base::Time(),
                  base::Time timeout2 = base::Time(),
                  size_t buffer_size = 32768);
+
+    /** Forward data between two subclasses of iodrivers_base::Driver, using
+     * a buffer provided by the caller
+     *
+     * The buffer is split in two halves, one per direction. This does not
+     * allocate memory on the heap, unless the write queues of the drivers
+     * need to be enabled
+     *
+     * @see forward
+     */
+    void forward(bool raw_mode, Driver& driver1, Driver& driver2,
+                 uint8_t* buffer, size_t buffer_size,
+                 base::Time timeout1 = base::Time(),
+                 base::Time timeout2 = base::Time());
+
+    /** Status of a sink at the end of fanOut() */
+    struct FanOutSinkStatus
+    {
+        /** Count of bytes that were not sent to the sink because its write
+         * queue was full
+         */
+        uint64_t dropped_bytes = 0;
+        /** Whether the sink has been closed or failed, and was removed from
+         * the forwarding
+         */
+        bool closed = false;
+    };
+
+    /** Forward data from one driver to several others, and back
+     *
+     * Every chunk (raw mode) or packet (packet mode) received from the
+     * source is written to all the sinks, and the data received from the
+     * sinks is written to the source. It blocks until either the source is
+     * closed or all the sinks have been removed.
+     *
+     * Each sink has its own write queue. A sink whose queue is full does
+     * not slow down the source: the data that does not fit is dropped for
+     * this sink only. In raw mode, a sink that dropped data therefore
+     * receives an incomplete stream. The data of the sinks is written to
+     * the source in full, a sink is not read while the source's write queue
+     * is congested.
+     *
+     * A sink that is closed, or fails, is removed and the forwarding
+     * continues with the other sinks. Regular files can be used as sinks,
+     * they are written but never read.
+     *
+     * Note that writing to a closed socket raises SIGPIPE. Programs using
+     * TCP sinks should ignore it so that such sinks are simply removed.
+     *
+     * @param raw_mode whether bytes are read using readRaw (true) or
+     *   readPacket (false)
+     * @param source the driver whose data is sent to all the sinks
+     * @param sinks the drivers the data is sent to
+     * @param timeout in raw mode, how long we should wait after the first
+     *   byte received from the source before forwarding the data, see
+     *   forward()
+     * @param buffer_size the size of the reading buffers. In raw mode, it is
+     *   the maximum size of a forwarded chunk
+     * @param sink_queue_size the size of the write queue of each sink, in
+     *   bytes. It is ignored for the sinks whose write queue is already
+     *   bigger
+     * @return the status of each sink, in the same order than \c sinks
+     */
+    std::vector<FanOutSinkStatus> fanOut(
+        bool raw_mode, Driver& source, std::vector<Driver*> const& sinks,
+        base::Time timeout = base::Time(),
+        size_t buffer_size = 32768,
+        size_t sink_queue_size = 262144);
 }
 
 #endif
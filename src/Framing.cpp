@@ -0,0 +1,235 @@
+#include <iodrivers_base/Framing.hpp>
+
+#include <cstring>
+#include <dlfcn.h>
+#include <stdexcept>
+
+using namespace std;
+using namespace iodrivers_base;
+
+/** Extraction of packets terminated by a delimiter byte, which is included
+ * in the packet
+ */
+static int extractDelimited(uint8_t const* buffer, size_t buffer_size,
+                            uint8_t delimiter, size_t max_packet_size)
+{
+    auto end = static_cast<uint8_t const*>(memchr(buffer, delimiter, buffer_size));
+    if (end) {
+        int packet_size = end - buffer + 1;
+        if (static_cast<size_t>(packet_size) > max_packet_size) {
+            return -packet_size;
+        }
+        return packet_size;
+    }
+    else if (buffer_size >= max_packet_size) {
+        return -static_cast<int>(buffer_size);
+    }
+    return 0;
+}
+
+static int parseByte(string const& value, string const& description)
+{
+    size_t end = 0;
+    unsigned long result = 0;
+    try {
+        result = stoul(value, &end, 0);
+    }
+    catch (std::logic_error const&) {
+    }
+    if (value.empty() || end != value.size() || result > 255) {
+        throw std::invalid_argument(
+            "invalid byte " + value + " in framing description " + description
+        );
+    }
+    return result;
+}
+
+unique_ptr<Framing> Framing::fromString(string const& description,
+                                        size_t max_packet_size)
+{
+    size_t separator = description.find(':');
+    string type = description.substr(0, separator);
+    string arguments = separator == string::npos ?
+                       string() : description.substr(separator + 1);
+
+    if (type == "raw" && arguments.empty()) {
+        return unique_ptr<Framing>();
+    }
+    else if (type == "slip" && arguments.empty()) {
+        return unique_ptr<Framing>(new SLIPFraming(max_packet_size));
+    }
+    else if (type == "cobs" && arguments.empty()) {
+        return unique_ptr<Framing>(new COBSFraming(max_packet_size));
+    }
+    else if (type == "delimiter") {
+        uint8_t delimiter = parseByte(arguments, description);
+        return unique_ptr<Framing>(new DelimiterFraming(delimiter, max_packet_size));
+    }
+    else if (type == "length") {
+        string size = arguments.substr(0, arguments.find(':'));
+        string order = size.size() == arguments.size() ?
+                       "le" : arguments.substr(size.size() + 1);
+        if ((size != "1" && size != "2" && size != "4") ||
+            (order != "le" && order != "be")) {
+            throw std::invalid_argument(
+                "invalid framing description " + description + ", expected "
+                "length:N[:le|be] with N being 1, 2 or 4"
+            );
+        }
+        return unique_ptr<Framing>(
+            new LengthPrefixedFraming(stoi(size), order == "be", max_packet_size)
+        );
+    }
+    else if (type == "plugin" && !arguments.empty()) {
+        // The symbol is optional, and the path may itself contain colons
+        size_t symbol_separator = arguments.rfind(':');
+        if (symbol_separator != string::npos &&
+            arguments.find('/', symbol_separator) == string::npos) {
+            return unique_ptr<Framing>(new PluginFraming(
+                arguments.substr(0, symbol_separator),
+                arguments.substr(symbol_separator + 1)
+            ));
+        }
+        return unique_ptr<Framing>(new PluginFraming(arguments));
+    }
+
+    throw std::invalid_argument(
+        "invalid framing description " + description + ", expected one of "
+        "raw, length:N[:le|be], delimiter:BYTE, slip, cobs or "
+        "plugin:PATH[:SYMBOL]"
+    );
+}
+
+LengthPrefixedFraming::LengthPrefixedFraming(int length_size, bool big_endian,
+                                             size_t max_packet_size)
+    : m_length_size(length_size)
+    , m_big_endian(big_endian)
+    , m_max_packet_size(max_packet_size)
+{
+    if (length_size != 1 && length_size != 2 && length_size != 4) {
+        throw std::invalid_argument("LengthPrefixedFraming: length_size must be 1, 2 or 4");
+    }
+}
+
+int LengthPrefixedFraming::extractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    if (buffer_size < static_cast<size_t>(m_length_size)) {
+        return 0;
+    }
+
+    size_t length = 0;
+    for (int i = 0; i < m_length_size; ++i) {
+        int shift = m_big_endian ? (m_length_size - 1 - i) * 8 : i * 8;
+        length |= static_cast<size_t>(buffer[i]) << shift;
+    }
+
+    size_t packet_size = m_length_size + length;
+    if (packet_size > m_max_packet_size) {
+        // Not a valid length, we are not synchronized on the packets
+        return -1;
+    }
+    else if (buffer_size < packet_size) {
+        return 0;
+    }
+    return packet_size;
+}
+
+DelimiterFraming::DelimiterFraming(uint8_t delimiter, size_t max_packet_size)
+    : m_delimiter(delimiter)
+    , m_max_packet_size(max_packet_size)
+{
+}
+
+int DelimiterFraming::extractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    return extractDelimited(buffer, buffer_size, m_delimiter, m_max_packet_size);
+}
+
+SLIPFraming::SLIPFraming(size_t max_packet_size)
+    : m_max_packet_size(max_packet_size)
+{
+}
+
+int SLIPFraming::extractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    if (buffer_size && buffer[0] == END) {
+        return -1;
+    }
+    return extractDelimited(buffer, buffer_size, END, m_max_packet_size);
+}
+
+COBSFraming::COBSFraming(size_t max_packet_size)
+    : m_max_packet_size(max_packet_size)
+{
+}
+
+int COBSFraming::extractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    if (buffer_size && buffer[0] == 0) {
+        return -1;
+    }
+
+    int packet_size = extractDelimited(buffer, buffer_size, 0, m_max_packet_size);
+    if (packet_size <= 0) {
+        return packet_size;
+    }
+
+    // Each code byte is the offset of the next one. In a valid frame, the
+    // chain ends exactly on the delimiter
+    size_t delimiter = packet_size - 1;
+    size_t code = 0;
+    while (code < delimiter) {
+        code += buffer[code];
+    }
+    if (code != delimiter) {
+        return -packet_size;
+    }
+    return packet_size;
+}
+
+PluginFraming::PluginFraming(string const& path, string const& symbol)
+    : m_handle(dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL))
+    , m_extract(nullptr)
+{
+    if (!m_handle) {
+        throw std::runtime_error("cannot load framing plugin " + path + ": " + dlerror());
+    }
+
+    m_extract = reinterpret_cast<ExtractPacket>(dlsym(m_handle, symbol.c_str()));
+    if (!m_extract) {
+        string error = dlerror();
+        dlclose(m_handle);
+        throw std::runtime_error(
+            "cannot find " + symbol + " in framing plugin " + path + ": " + error
+        );
+    }
+}
+
+PluginFraming::~PluginFraming()
+{
+    dlclose(m_handle);
+}
+
+int PluginFraming::extractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    return m_extract(buffer, buffer_size);
+}
+
+FramingDriver::FramingDriver(int max_packet_size, unique_ptr<Framing> framing)
+    : Driver(max_packet_size)
+    , m_framing(move(framing))
+{
+}
+
+Framing const* FramingDriver::getFraming() const
+{
+    return m_framing.get();
+}
+
+int FramingDriver::extractPacket(uint8_t const* buffer, size_t buffer_size) const
+{
+    if (!m_framing) {
+        return 0;
+    }
+    return m_framing->extractPacket(buffer, buffer_size);
+}
@@ -0,0 +1,159 @@
+#ifndef IODRIVERS_BASE_FRAMING_HPP
+#define IODRIVERS_BASE_FRAMING_HPP
+
+#include <iodrivers_base/Driver.hpp>
+
+#include <memory>
+#include <string>
+
+namespace iodrivers_base {
+    /** Packet extraction logic that can be chosen at runtime
+     *
+     * It allows generic tools such as iodrivers_base_forwarder and
+     * iodrivers_base_cat to preserve the packet boundaries of a protocol they
+     * do not know about. Use it through FramingDriver.
+     */
+    class Framing
+    {
+    public:
+        virtual ~Framing() {}
+
+        /** Finds a packet at the beginning of the buffer
+         *
+         * The semantics of the return value are the ones of
+         * Driver::extractPacket
+         */
+        virtual int extractPacket(uint8_t const* buffer, size_t buffer_size) const = 0;
+
+        /** Creates a framing from its textual description
+         *
+         * The following descriptions are recognized:
+         * - raw: no framing, returns a null pointer
+         * - length:N[:le|be]: packets start with their payload size, as an
+         *   unsigned integer of N bytes (1, 2 or 4). The default byte order
+         *   is little endian
+         * - delimiter:BYTE: packets end with the given byte, e.g.
+         *   delimiter:0x0a
+         * - slip: SLIP frames (RFC 1055), delimited by END bytes
+         * - cobs: COBS-encoded frames, delimited by zero bytes
+         * - plugin:PATH[:SYMBOL]: a shared library that exports a
+         *   <tt>int SYMBOL(uint8_t const* buffer, size_t size)</tt> C function
+         *   with the semantics of Driver::extractPacket. SYMBOL defaults to
+         *   extractPacket
+         *
+         * @param max_packet_size the maximum packet size of the driver the
+         *   framing will be used with
+         * @throws std::invalid_argument if the description is invalid
+         * @throws std::runtime_error if the plugin cannot be loaded
+         */
+        static std::unique_ptr<Framing> fromString(std::string const& description,
+                                                   size_t max_packet_size);
+    };
+
+    /** Packets that start with the size of their payload */
+    class LengthPrefixedFraming : public Framing
+    {
+        int m_length_size;
+        bool m_big_endian;
+        size_t m_max_packet_size;
+
+    public:
+        /**
+         * @param length_size the size of the length field, 1, 2 or 4 bytes
+         * @param big_endian the byte order of the length field
+         * @param max_packet_size packets bigger than this, length field
+         *   included, are skipped
+         */
+        LengthPrefixedFraming(int length_size, bool big_endian,
+                              size_t max_packet_size);
+
+        int extractPacket(uint8_t const* buffer, size_t buffer_size) const override;
+    };
+
+    /** Packets that end with a given byte */
+    class DelimiterFraming : public Framing
+    {
+        uint8_t m_delimiter;
+        size_t m_max_packet_size;
+
+    public:
+        DelimiterFraming(uint8_t delimiter, size_t max_packet_size);
+
+        int extractPacket(uint8_t const* buffer, size_t buffer_size) const override;
+    };
+
+    /** SLIP frames (RFC 1055)
+     *
+     * Packets are the frames, trailing END byte included. They are not
+     * decoded. The END bytes that start a frame, or separate empty frames,
+     * are skipped.
+     */
+    class SLIPFraming : public Framing
+    {
+        size_t m_max_packet_size;
+
+    public:
+        static const uint8_t END = 0xC0;
+
+        SLIPFraming(size_t max_packet_size);
+
+        int extractPacket(uint8_t const* buffer, size_t buffer_size) const override;
+    };
+
+    /** COBS-encoded frames, delimited by a zero byte
+     *
+     * Packets are the encoded frames, trailing zero included. Frames whose
+     * encoding is invalid are skipped.
+     */
+    class COBSFraming : public Framing
+    {
+        size_t m_max_packet_size;
+
+    public:
+        COBSFraming(size_t max_packet_size);
+
+        int extractPacket(uint8_t const* buffer, size_t buffer_size) const override;
+    };
+
+    /** Framing implemented by a function of a shared library */
+    class PluginFraming : public Framing
+    {
+    public:
+        typedef int (*ExtractPacket)(uint8_t const* buffer, size_t buffer_size);
+
+        /**
+         * @throws std::runtime_error if the library cannot be loaded or does
+         *   not export the symbol
+         */
+        PluginFraming(std::string const& path,
+                      std::string const& symbol = "extractPacket");
+        ~PluginFraming();
+
+        int extractPacket(uint8_t const* buffer, size_t buffer_size) const override;
+
+    private:
+        void* m_handle;
+        ExtractPacket m_extract;
+    };
+
+    /** A driver whose packet extraction is done by a Framing object
+     *
+     * Without a framing, extractPacket always returns zero and the driver
+     * can only be used with readRaw
+     */
+    class FramingDriver : public Driver
+    {
+        std::unique_ptr<Framing> m_framing;
+
+    public:
+        FramingDriver(int max_packet_size,
+                      std::unique_ptr<Framing> framing = std::unique_ptr<Framing>());
+
+        /** The framing, or null if there is none */
+        Framing const* getFraming() const;
+
+        int extractPacket(uint8_t const* buffer, size_t buffer_size) const override;
+    };
+}
+
+#endif
@@ -5,6 +5,12 @@ using namespace iodrivers_base;
 
 IOListener::~IOListener() {}
 
+BufferListener::BufferListener(size_t reserve)
+{
+    m_writeBuffer.reserve(reserve);
+    m_readBuffer.reserve(reserve);
+}
+
 std::vector<boost::uint8_t> BufferListener::flushRead()
 {
     std::vector<boost::uint8_t> ret;
@@ -17,6 +23,16 @@ std::vector<boost::uint8_t> BufferListener::flushWrite()
     ret.swap(m_writeBuffer);
     return ret;
 }
+void BufferListener::flushRead(std::vector<boost::uint8_t>& buffer)
+{
+    buffer.clear();
+    buffer.swap(m_readBuffer);
+}
+void BufferListener::flushWrite(std::vector<boost::uint8_t>& buffer)
+{
+    buffer.clear();
+    buffer.swap(m_writeBuffer);
+}
 
 /** Used to pass data that has been written to the device to the
  * listener
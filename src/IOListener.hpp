@@ -30,9 +30,28 @@ namespace iodrivers_base
         std::vector<boost::uint8_t> m_writeBuffer;
         std::vector<boost::uint8_t> m_readBuffer;
     public:
+        /**
+         * @param reserve the number of bytes that are reserved upfront in
+         *   the read and write buffers
+         */
+        explicit BufferListener(size_t reserve = 0);
+
         std::vector<boost::uint8_t> flushRead();
         std::vector<boost::uint8_t> flushWrite();
 
+        /** Swaps the read buffer with the given vector, after clearing it
+         *
+         * Passing back the vector returned by the previous flush allows to
+         * reuse its memory instead of allocating a new buffer each time
+         */
+        void flushRead(std::vector<boost::uint8_t>& buffer);
+
+        /** Swaps the write buffer with the given vector, after clearing it
+         *
+         * @see flushRead
+         */
+        void flushWrite(std::vector<boost::uint8_t>& buffer);
+
         /** Used to pass data that has been written to the device to the
          * listener
          */
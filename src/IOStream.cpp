@@ -1,24 +1,153 @@
 #include <iodrivers_base/IOStream.hpp>
 #include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/Timeout.hpp>
 #include <base-logging/Logging.hpp>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <tuple>
+#include <vector>
 
 using namespace std;
 using namespace iodrivers_base;
 
+/** Wait for events on a single file descriptor
+ *
+ * This is used instead of select(), which does not support file descriptors
+ * greater or equal to FD_SETSIZE and needs to scan the whole fd_set
+ *
+ * @param events the poll() events to wait for (POLLIN or POLLOUT)
+ * @param context the method name, used in the error messages
+ */
+static bool pollFileDescriptor(int fd, short events, base::Time const& timeout,
+                               string const& context)
+{
+    pollfd pfd = { fd, events, 0 };
+    int64_t timeout_us = std::max<int64_t>(0, timeout.toMicroseconds());
+
+#ifdef __APPLE__
+    int ret = poll(&pfd, 1, (timeout_us + 999) / 1000);
+#else
+    timespec timeout_spec = {
+        static_cast<time_t>(timeout_us / 1000000),
+        static_cast<long>(timeout_us % 1000000) * 1000
+    };
+    int ret = ppoll(&pfd, 1, &timeout_spec, NULL);
+#endif
+    if (ret < 0 && errno != EINTR)
+        throw UnixError(context + ": error in poll()");
+    else if (ret > 0 && (pfd.revents & POLLNVAL))
+        throw UnixError(context + ": invalid file descriptor", EBADF);
+
+    return (ret > 0);
+}
+
+/** recvfrom() that also returns the kernel receive timestamp
+ *
+ * The timestamps must have been enabled with setReceiveTimestamps
+ *
+ * @return the value returned by recvmsg() and errno
+ */
+static pair<ssize_t, int> recvWithTimestamp(
+    int fd, uint8_t* buffer, size_t buffer_size, int flags,
+    sockaddr* from, socklen_t* from_len, base::Time& timestamp)
+{
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(timespec))];
+    iovec iov = { buffer, buffer_size };
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = from;
+    msg.msg_namelen = from ? *from_len : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t ret = ::recvmsg(fd, &msg, flags);
+    if (ret < 0)
+        return make_pair(ret, errno);
+
+    if (from_len)
+        *from_len = msg.msg_namelen;
+    timestamp = getReceiveTimestamp(msg);
+    return make_pair(ret, 0);
+}
+
+/** Number of segments that writev() passes to the kernel without allocating
+ * memory
+ */
+static const size_t STACK_SEGMENTS = 64;
+
+/** Sends segments with sendmsg, as a single datagram on datagram sockets
+ *
+ * @return the value returned by sendmsg() and errno
+ */
+static pair<ssize_t, int> sendSegments(
+    int fd, PacketView const* segments, size_t count, int flags,
+    sockaddr const* to, socklen_t to_len)
+{
+    iovec stack_iov[STACK_SEGMENTS];
+    vector<iovec> heap_iov;
+    iovec* iov = stack_iov;
+    if (count > STACK_SEGMENTS) {
+        heap_iov.resize(count);
+        iov = heap_iov.data();
+    }
+    for (size_t i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<uint8_t*>(segments[i].data);
+        iov[i].iov_len = segments[i].size;
+    }
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = const_cast<sockaddr*>(to);
+    msg.msg_namelen = to ? to_len : 0;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    ssize_t ret = ::sendmsg(fd, &msg, flags);
+    return make_pair(ret, ret < 0 ? errno : 0);
+}
+
+/** Total size of a set of segments */
+static size_t getSegmentsSize(PacketView const* segments, size_t count)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i)
+        size += segments[i].size;
+    return size;
+}
+
 IOStream::~IOStream() {}
+size_t IOStream::writev(PacketView const* segments, size_t count)
+{
+    size_t written = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t c = write(segments[i].data, segments[i].size);
+        written += c;
+        if (c < static_cast<size_t>(segments[i].size))
+            break;
+    }
+    return written;
+}
 int IOStream::getFileDescriptor() const { return FDStream::INVALID_FD; }
 bool IOStream::eof() const { return false; }
+bool IOStream::setReceiveTimestamps(bool) { return false; }
+base::Time IOStream::getLastReceiveTime() const { return base::Time(); }
+bool IOStream::hasBufferedData() const { return false; }
 bool IOStream::hasIO(base::Time const& timeout) { return waitRead(timeout); };
 bool IOStream::hasIO() { return hasIO(base::Time()); };
 
@@ -39,41 +168,42 @@ FDStream::~FDStream()
     if (m_auto_close)
         ::close(m_fd);
 }
+void FDStream::setQuickAck(bool enable) {
+    m_quickack = enable;
+}
+bool FDStream::getQuickAck() const {
+    return m_quickack;
+}
+
 void FDStream::setAutoClose(bool flag) {
     m_auto_close = flag;
 }
+bool FDStream::getAutoClose() const {
+    return m_auto_close;
+}
+bool FDStream::hasEOF() const {
+    return m_has_eof;
+}
 
 bool FDStream::waitRead(base::Time const& timeout)
 {
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(m_fd, &set);
-
-    timeval timeout_spec = { static_cast<time_t>(timeout.toSeconds()), suseconds_t(timeout.toMicroseconds() % 1000000)};
-    int ret = select(m_fd + 1, &set, NULL, NULL, &timeout_spec);
-    if (ret < 0 && errno != EINTR)
-        throw UnixError("waitRead(): error in select()");
-
-    return (ret > 0);
+    return pollFileDescriptor(m_fd, POLLIN, timeout, "waitRead()");
 }
 bool FDStream::waitWrite(base::Time const& timeout)
 {
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(m_fd, &set);
-
-    timeval timeout_spec = { static_cast<time_t>(timeout.toSeconds()), suseconds_t(timeout.toMicroseconds() % 1000000) };
-    int ret = select(m_fd + 1, NULL, &set, NULL, &timeout_spec);
-    if (ret < 0 && errno != EINTR)
-        throw UnixError("waitWrite(): error in select()");
-
-    return (ret > 0);
+    return pollFileDescriptor(m_fd, POLLOUT, timeout, "waitWrite()");
 }
 size_t FDStream::read(uint8_t* buffer, size_t buffer_size)
 {
     int c = ::read(m_fd, buffer, buffer_size);
-    if (c > 0)
+    if (c > 0) {
+        if (m_quickack) {
+            // The kernel leaves the quick ACK mode on its own, re-arm it
+            int value = 1;
+            setsockopt(m_fd, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value));
+        }
         return c;
+    }
     else if (c == 0)
     {
         m_eof = m_has_eof;
@@ -99,6 +229,23 @@ size_t FDStream::write(uint8_t const* buffer, size_t buffer_size)
         return 0;
     return c;
 }
+size_t FDStream::writev(PacketView const* segments, size_t count)
+{
+    // Streams accept partial writes, no need to pass all the segments
+    iovec iov[STACK_SEGMENTS];
+    count = std::min(count, STACK_SEGMENTS);
+    for (size_t i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<uint8_t*>(segments[i].data);
+        iov[i].iov_len = segments[i].size;
+    }
+
+    ssize_t c = ::writev(m_fd, iov, count);
+    if (c == -1 && errno != EAGAIN && errno != ENOBUFS)
+        throw UnixError("writePacket(): error during write");
+    if (c == -1)
+        return 0;
+    return c;
+}
 void FDStream::clear()
 {
 }
@@ -143,36 +290,34 @@ void SocketStream::setRecvFlags(int flags) {
 void SocketStream::setAutoClose(bool flag) {
     m_auto_close = flag;
 }
+bool SocketStream::getAutoClose() const {
+    return m_auto_close;
+}
+bool SocketStream::hasEOF() const {
+    return m_has_eof;
+}
 
 bool SocketStream::waitRead(base::Time const& timeout)
 {
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(m_fd, &set);
-
-    timeval timeout_spec = { static_cast<time_t>(timeout.toSeconds()), suseconds_t(timeout.toMicroseconds() % 1000000)};
-    int ret = select(m_fd + 1, &set, NULL, NULL, &timeout_spec);
-    if (ret < 0 && errno != EINTR)
-        throw UnixError("waitRead(): error in select()");
-
-    return (ret > 0);
+    return pollFileDescriptor(m_fd, POLLIN, timeout, "waitRead()");
 }
 bool SocketStream::waitWrite(base::Time const& timeout)
 {
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(m_fd, &set);
-
-    timeval timeout_spec = { static_cast<time_t>(timeout.toSeconds()), suseconds_t(timeout.toMicroseconds() % 1000000) };
-    int ret = select(m_fd + 1, NULL, &set, NULL, &timeout_spec);
-    if (ret < 0 && errno != EINTR)
-        throw UnixError("waitWrite(): error in select()");
-
-    return (ret > 0);
+    return pollFileDescriptor(m_fd, POLLOUT, timeout, "waitWrite()");
 }
 size_t SocketStream::read(uint8_t* buffer, size_t buffer_size)
 {
-    int c = ::recv(m_fd, buffer, buffer_size, m_recv_flags);
+    ssize_t c;
+    int err;
+    if (m_receive_timestamps) {
+        tie(c, err) = recvWithTimestamp(m_fd, buffer, buffer_size, m_recv_flags,
+                                        NULL, NULL, m_last_receive_time);
+    }
+    else {
+        c = ::recv(m_fd, buffer, buffer_size, m_recv_flags);
+        err = errno;
+    }
+
     if (c > 0)
         return c;
     else if (c == 0)
@@ -182,11 +327,22 @@ size_t SocketStream::read(uint8_t* buffer, size_t buffer_size)
     }
     else
     {
-        if (errno == EAGAIN)
+        if (err == EAGAIN)
             return 0;
-        throw UnixError("readPacket(): error reading the file descriptor");
+        throw UnixError("readPacket(): error reading the file descriptor", err);
     }
 }
+bool SocketStream::setReceiveTimestamps(bool enable)
+{
+    iodrivers_base::setReceiveTimestamps(m_fd, enable);
+    m_receive_timestamps = enable;
+    m_last_receive_time = base::Time();
+    return true;
+}
+base::Time SocketStream::getLastReceiveTime() const
+{
+    return m_last_receive_time;
+}
 bool SocketStream::eof() const
 {
     return m_eof;
@@ -200,6 +356,17 @@ size_t SocketStream::write(uint8_t const* buffer, size_t buffer_size)
         return 0;
     return c;
 }
+size_t SocketStream::writev(PacketView const* segments, size_t count)
+{
+    ssize_t c;
+    int err;
+    tie(c, err) = sendSegments(m_fd, segments, count, m_send_flags, NULL, 0);
+    if (c == -1 && err != EAGAIN && err != ENOBUFS)
+        throw UnixError("writePacket(): error during write", err);
+    if (c == -1)
+        return 0;
+    return c;
+}
 void SocketStream::clear()
 {
 }
@@ -253,18 +420,62 @@ void UDPServerStream::setIgnoreEconnRefused(bool enable) {
     m_ignore_econnrefused = enable;
 }
 
+void UDPServerStream::setBatchSize(size_t count, size_t max_datagram_size) {
+    m_batch = DatagramBatch(count, max_datagram_size);
+    m_batch.setTimestamps(m_receive_timestamps);
+}
+
+bool UDPServerStream::setReceiveTimestamps(bool enable) {
+    iodrivers_base::setReceiveTimestamps(m_fd, enable);
+    m_receive_timestamps = enable;
+    m_last_receive_time = base::Time();
+    m_batch.setTimestamps(enable);
+    return true;
+}
+
+base::Time UDPServerStream::getLastReceiveTime() const {
+    return m_last_receive_time;
+}
+
+bool UDPServerStream::hasBufferedData() const {
+    return m_batch.isEnabled() && !m_batch.empty();
+}
+
+bool UDPServerStream::isIgnoredError(int err) const {
+    return (m_ignore_econnrefused && err == ECONNREFUSED) ||
+           (m_ignore_ehostunreach && err == EHOSTUNREACH) ||
+           (m_ignore_enetunreach && err == ENETUNREACH);
+}
+
 bool UDPServerStream::waitRead(base::Time const& timeout) {
     if (m_wait_read_error) {
         return false;
     }
+    else if (m_batch.isEnabled() && !m_batch.empty()) {
+        return true;
+    }
 
-    base::Time now = base::Time::now();
+    base::Time now = Timeout::now();
     base::Time deadline = now + timeout;
     while (now <= deadline) {
         if (!FDStream::waitRead(deadline - now))
             return false;
 
-        now = base::Time::now();
+        now = Timeout::now();
+
+        // In batch mode, receive the batch right away. This reports the
+        // socket errors the same way than the zero-size read below
+        if (m_batch.isEnabled()) {
+            int ret, err;
+            tie(ret, err) = m_batch.receive(m_fd);
+            if (ret < 0) {
+                if (err == EAGAIN || isIgnoredError(err)) {
+                    continue;
+                }
+                m_wait_read_error = err;
+            }
+            return true;
+        }
 
         // We do a zero-size read to read the error from the socket, and ignore
         // the ones we want to ignore
@@ -308,13 +519,19 @@ size_t UDPServerStream::read(uint8_t* buffer, size_t buffer_size)
         m_wait_read_error = 0;
         throw UnixError("readPacket(): error reading the file descriptor", err);
     }
+    else if (m_batch.isEnabled()) {
+        return readFromBatch(buffer, buffer_size);
+    }
 
     sockaddr si_other;
     unsigned int s_len = sizeof(si_other);
 
     ssize_t ret;
     int err;
-    if (m_si_other_dynamic)
+    if (m_receive_timestamps)
+        tie(ret, err) = recvWithTimestamp(m_fd, buffer, buffer_size, 0,
+                                          &si_other, &s_len, m_last_receive_time);
+    else if (m_si_other_dynamic)
         tie(ret, err) = recvfrom(buffer, buffer_size, 0, &si_other, &s_len);
     else
         tie(ret, err) = recvfrom(buffer, buffer_size, 0, NULL, NULL);
@@ -349,6 +566,37 @@ size_t UDPServerStream::read(uint8_t* buffer, size_t buffer_size)
     }
 }
 
+size_t UDPServerStream::readFromBatch(uint8_t* buffer, size_t buffer_size)
+{
+    if (m_batch.empty()) {
+        int ret, err;
+        tie(ret, err) = m_batch.receive(m_fd);
+        if (ret < 0) {
+            if (err == EAGAIN || isIgnoredError(err)) {
+                return 0;
+            }
+            throw UnixError("readPacket(): error reading the file descriptor", err);
+        }
+        else if (m_batch.empty()) {
+            return 0;
+        }
+    }
+
+    sockaddr si_other;
+    socklen_t s_len = sizeof(si_other);
+    size_t size = m_batch.pop(buffer, buffer_size, &si_other, &s_len);
+    m_last_receive_time = m_batch.getLastTimestamp();
+    m_has_other = true;
+    if (m_si_other_dynamic) {
+        m_si_other = si_other;
+        m_s_len = s_len;
+    }
+    if (size == 0) {
+        m_eof = true;
+    }
+    return size;
+}
+
 pair<ssize_t, int> UDPServerStream::sendto(uint8_t const* buffer, size_t buffer_size) {
     ssize_t ret = ::sendto(m_fd, buffer, buffer_size, 0, &m_si_other, m_s_len);
     return make_pair(ret, errno);
@@ -381,6 +629,54 @@ size_t UDPServerStream::write(uint8_t const* buffer, size_t buffer_size)
     return ret;
 }
 
+size_t UDPServerStream::writev(PacketView const* segments, size_t count)
+{
+    size_t size = getSegmentsSize(segments, count);
+    if (! m_has_other)
+        return size;
+
+    ssize_t ret;
+    int err;
+    tie(ret, err) = sendSegments(m_fd, segments, count, 0, &m_si_other, m_s_len);
+    if (ret == -1) {
+        if (err == EAGAIN || err == ENOBUFS) {
+            return 0;
+        }
+        else if (isIgnoredError(err)) {
+            return size;
+        }
+        throw UnixError("UDPServerStream: writePacket(): error during write", err);
+    }
+    return ret;
+}
+
+size_t UDPServerStream::writeBatch(PacketView const* datagrams, size_t count)
+{
+    if (! m_has_other)
+        return count;
+
+    size_t sent = 0;
+    while (sent < count) {
+        int ret, err;
+        tie(ret, err) = DatagramBatch::send(
+            m_fd, datagrams + sent, count - sent, &m_si_other, m_s_len
+        );
+        if (ret > 0) {
+            sent += ret;
+        }
+        else if (ret == 0 || err == EAGAIN || err == ENOBUFS) {
+            break;
+        }
+        else if (isIgnoredError(err)) {
+            ++sent;
+        }
+        else {
+            throw UnixError("UDPServerStream: writePacket(): error during write", err);
+        }
+    }
+    return sent;
+}
+
 UnixDatagramStream::UnixDatagramStream(int fd, bool auto_close)
     : FDStream(fd, auto_close)
     , m_si_other_dynamic(true)
@@ -409,18 +705,89 @@ pair<ssize_t, int> UnixDatagramStream::recvfrom(uint8_t* buffer,
     return make_pair(ret, errno);
 }
 
+void UnixDatagramStream::setBatchSize(size_t count, size_t max_datagram_size)
+{
+    m_batch = DatagramBatch(count, max_datagram_size);
+    m_batch.setTimestamps(m_receive_timestamps);
+}
+
+bool UnixDatagramStream::setReceiveTimestamps(bool enable)
+{
+    iodrivers_base::setReceiveTimestamps(m_fd, enable);
+    m_receive_timestamps = enable;
+    m_last_receive_time = base::Time();
+    m_batch.setTimestamps(enable);
+    return true;
+}
+
+base::Time UnixDatagramStream::getLastReceiveTime() const
+{
+    return m_last_receive_time;
+}
+
+bool UnixDatagramStream::hasBufferedData() const
+{
+    return m_batch.isEnabled() && !m_batch.empty();
+}
+
+bool UnixDatagramStream::waitRead(base::Time const& timeout)
+{
+    if (m_batch.isEnabled() && !m_batch.empty()) {
+        return true;
+    }
+    return FDStream::waitRead(timeout);
+}
+
 size_t UnixDatagramStream::read(uint8_t* buffer, size_t buffer_size)
 {
     sockaddr_un si_other;
     socklen_t s_len = sizeof(si_other);
 
+    if (m_batch.isEnabled()) {
+        if (m_batch.empty()) {
+            int ret, err;
+            tie(ret, err) = m_batch.receive(m_fd);
+            if (ret < 0 && err != EAGAIN) {
+                throw UnixError("readPacket(): error reading the file descriptor", err);
+            }
+            else if (m_batch.empty()) {
+                return 0;
+            }
+        }
+
+        size_t size = m_batch.pop(
+            buffer, buffer_size, reinterpret_cast<sockaddr*>(&si_other), &s_len
+        );
+        m_last_receive_time = m_batch.getLastTimestamp();
+        m_has_other = true;
+        if (m_si_other_dynamic) {
+            m_si_other = si_other;
+            m_si_other_len = s_len;
+        }
+        if (size == 0) {
+            m_eof = true;
+        }
+        return size;
+    }
+
     ssize_t ret;
     int err;
-    tie(ret, err) = recvfrom(buffer,
-        buffer_size,
-        0,
-        reinterpret_cast<sockaddr*>(&si_other),
-        &s_len);
+    if (m_receive_timestamps) {
+        tie(ret, err) = recvWithTimestamp(m_fd,
+            buffer,
+            buffer_size,
+            0,
+            reinterpret_cast<sockaddr*>(&si_other),
+            &s_len,
+            m_last_receive_time);
+    }
+    else {
+        tie(ret, err) = recvfrom(buffer,
+            buffer_size,
+            0,
+            reinterpret_cast<sockaddr*>(&si_other),
+            &s_len);
+    }
 
     if (ret >= 0) {
         m_has_other = true;
@@ -466,6 +833,52 @@ size_t UnixDatagramStream::write(uint8_t const* buffer, size_t buffer_size)
     return ret;
 }
 
+size_t UnixDatagramStream::writev(PacketView const* segments, size_t count)
+{
+    size_t size = getSegmentsSize(segments, count);
+    if (!m_has_other)
+        return size;
+
+    ssize_t ret;
+    int err;
+    tie(ret, err) = sendSegments(
+        m_fd, segments, count, 0,
+        reinterpret_cast<sockaddr const*>(&m_si_other), m_si_other_len
+    );
+    if (ret == -1) {
+        if (err == EAGAIN || err == ENOBUFS) {
+            return 0;
+        }
+        throw UnixError("UnixDatagramStream: writePacket(): error during write", err);
+    }
+    return ret;
+}
+
+size_t UnixDatagramStream::writeBatch(PacketView const* datagrams, size_t count)
+{
+    if (!m_has_other)
+        return count;
+
+    size_t sent = 0;
+    while (sent < count) {
+        int ret, err;
+        tie(ret, err) = DatagramBatch::send(
+            m_fd, datagrams + sent, count - sent,
+            reinterpret_cast<sockaddr const*>(&m_si_other), m_si_other_len
+        );
+        if (ret > 0) {
+            sent += ret;
+        }
+        else if (ret == 0 || err == EAGAIN || err == ENOBUFS) {
+            break;
+        }
+        else {
+            throw UnixError("UnixDatagramStream: writePacket(): error during write", err);
+        }
+    }
+    return sent;
+}
+
 UnixServerStream::UnixServerStream(int fd, bool auto_close)
     : m_server_fd(fd)
     , m_auto_close(auto_close)
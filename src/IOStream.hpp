@@ -2,6 +2,7 @@
 #define IODRIVERS_BASE_IOSTREAM_HH
 
 #include <base/Time.hpp>
+#include <iodrivers_base/DatagramBatch.hpp>
 
 #include <unistd.h>
 #include <netinet/in.h>
@@ -29,6 +30,17 @@ namespace iodrivers_base
         virtual size_t write(uint8_t const* buffer, size_t buffer_size) = 0;
         virtual void clear() = 0;
 
+        /** Writes the concatenation of several buffers
+         *
+         * Streams based on file descriptors do it with a single writev or
+         * sendmsg call. Datagram streams send the segments as a single
+         * datagram. The default implementation calls write() for each
+         * segment, and stops at the first incomplete write.
+         *
+         * @return the number of bytes written
+         */
+        virtual size_t writev(PacketView const* segments, size_t count);
+
         virtual bool eof() const;
         virtual bool hasIO(base::Time const& timeout);
         virtual bool hasIO();
@@ -39,12 +51,40 @@ namespace iodrivers_base
          * The default implementation returns INVALID_FD
          */
         virtual int getFileDescriptor() const;
+
+        /** Enables or disables kernel receive timestamps
+         *
+         * When enabled, getLastReceiveTime() returns the time at which the
+         * kernel received the data returned by the last read()
+         *
+         * The default implementation does not support them
+         *
+         * @return true if the stream supports receive timestamps
+         */
+        virtual bool setReceiveTimestamps(bool enable);
+
+        /** Kernel reception time of the data returned by the last read()
+         *
+         * It is null if receive timestamps are not enabled or not available.
+         * The default implementation always returns a null time
+         */
+        virtual base::Time getLastReceiveTime() const;
+
+        /** Whether the stream holds data it already received, that
+         * the next read() returns without calling into the kernel
+         *
+         * The file descriptor does not report this data as readable, so
+         * callers that wait on it must check this first. The default
+         * implementation returns false
+         */
+        virtual bool hasBufferedData() const;
     };
 
     /** Implementation of IOStream for file descriptors */
     class FDStream : public IOStream
     {
         bool m_auto_close;
+        bool m_quickack = false;
 
     protected:
         bool m_has_eof;
@@ -60,6 +100,7 @@ namespace iodrivers_base
         virtual bool waitWrite(base::Time const& timeout);
         virtual size_t read(uint8_t* buffer, size_t buffer_size);
         virtual size_t write(uint8_t const* buffer, size_t buffer_size);
+        size_t writev(PacketView const* segments, size_t count) override;
         virtual void clear();
         virtual bool eof() const;
 
@@ -70,7 +111,19 @@ namespace iodrivers_base
 
         virtual int getFileDescriptor() const;
 
+        /** Sets TCP_QUICKACK again after each successful read
+         *
+         * The kernel only keeps the quick ACK mode for a while. This keeps
+         * delayed ACKs disabled on request/response protocols, at the cost
+         * of one system call per read. The file descriptor must be a TCP
+         * socket.
+         */
+        void setQuickAck(bool enable);
+        bool getQuickAck() const;
+
         void setAutoClose(bool flag);
+        bool getAutoClose() const;
+        bool hasEOF() const;
     };
 
     /** Implementation of IOStream for file descriptors */
@@ -86,6 +139,9 @@ namespace iodrivers_base
         int m_send_flags = 0;
         int m_recv_flags = 0;
 
+        bool m_receive_timestamps = false;
+        base::Time m_last_receive_time;
+
     public:
         static const int INVALID_FD      = -1;
 
@@ -99,6 +155,7 @@ namespace iodrivers_base
         virtual bool waitWrite(base::Time const& timeout);
         virtual size_t read(uint8_t* buffer, size_t buffer_size);
         virtual size_t write(uint8_t const* buffer, size_t buffer_size);
+        size_t writev(PacketView const* segments, size_t count) override;
         virtual void clear();
         virtual bool eof() const;
 
@@ -109,7 +166,12 @@ namespace iodrivers_base
 
         virtual int getFileDescriptor() const;
 
+        bool setReceiveTimestamps(bool enable) override;
+        base::Time getLastReceiveTime() const override;
+
         void setAutoClose(bool flag);
+        bool getAutoClose() const;
+        bool hasEOF() const;
     };
 
     class UDPServerStream : public FDStream
@@ -119,12 +181,39 @@ namespace iodrivers_base
         UDPServerStream(int fd, bool auto_close, struct sockaddr *si_other, size_t *s_len);
         virtual size_t read(uint8_t* buffer, size_t buffer_size);
         virtual size_t write(uint8_t const* buffer, size_t buffer_size);
+        size_t writev(PacketView const* segments, size_t count) override;
         void setIgnoreEconnRefused(bool enable);
         void setIgnoreEhostUnreach(bool enable);
         void setIgnoreEnetUnreach(bool enable);
 
+        /** Receive datagrams in batches of up to count using recvmmsg
+         *
+         * read() still returns a single datagram per call, but only calls
+         * into the kernel once the whole batch has been read. Set count to
+         * zero to go back to one recvfrom per datagram.
+         */
+        void setBatchSize(size_t count, size_t max_datagram_size = 65536);
+
+        /** Send several datagrams using sendmmsg
+         *
+         * Datagrams that fail with one of the ignored errors are dropped and
+         * counted as sent, as with write()
+         *
+         * @return the number of datagrams sent. It is less than count if the
+         *   socket's send buffer is full
+         */
+        size_t writeBatch(PacketView const* datagrams, size_t count);
+
         bool waitRead(base::Time const& timeout);
 
+        bool setReceiveTimestamps(bool enable) override;
+        base::Time getLastReceiveTime() const override;
+
+        /** Whether some of the datagrams of the last batch have not been
+         * read yet
+         */
+        bool hasBufferedData() const override;
+
     protected:
         /** Internal implementation of recvfrom to allow for mocking */
         virtual std::pair<ssize_t, int> recvfrom(
@@ -145,6 +234,13 @@ namespace iodrivers_base
         bool m_ignore_enetunreach;
 
         int m_wait_read_error;
+        DatagramBatch m_batch;
+        bool m_receive_timestamps = false;
+        base::Time m_last_receive_time;
+
+    private:
+        bool isIgnoredError(int err) const;
+        size_t readFromBatch(uint8_t* buffer, size_t buffer_size);
     };
 
     class UnixDatagramStream : public FDStream {
@@ -156,6 +252,20 @@ namespace iodrivers_base
 
         size_t read(uint8_t* buffer, size_t buffer_size) override;
         size_t write(uint8_t const* buffer, size_t buffer_size) override;
+        size_t writev(PacketView const* segments, size_t count) override;
+        bool waitRead(base::Time const& timeout) override;
+
+        /** @see UDPServerStream::setBatchSize */
+        void setBatchSize(size_t count, size_t max_datagram_size = 65536);
+
+        /** @see UDPServerStream::writeBatch */
+        size_t writeBatch(PacketView const* datagrams, size_t count);
+
+        bool setReceiveTimestamps(bool enable) override;
+        base::Time getLastReceiveTime() const override;
+
+        /** @see UDPServerStream::hasBufferedData */
+        bool hasBufferedData() const override;
 
     protected:
         /** Internal implementation of recvfrom to allow for mocking */
@@ -171,6 +281,9 @@ namespace iodrivers_base
         socklen_t m_si_other_len;
         bool m_si_other_dynamic;
         bool m_has_other;
+        DatagramBatch m_batch;
+        bool m_receive_timestamps = false;
+        base::Time m_last_receive_time;
     };
 
     /** Server for a server of Unix stream sockets */
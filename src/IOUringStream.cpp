@@ -0,0 +1,596 @@
+#include <base-logging/Logging.hpp>
+#include <iodrivers_base/IOUringStream.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/Timeout.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// io_uring is used directly through its system calls, to avoid a dependency
+// on liburing. We need the extended io_uring_enter arguments (Linux 5.11) to
+// wait with a timeout
+#if defined(IORING_ENTER_EXT_ARG) && defined(__NR_io_uring_setup)
+#define IODRIVERS_BASE_HAS_IO_URING
+#endif
+
+using namespace std;
+using namespace iodrivers_base;
+
+#ifdef IODRIVERS_BASE_HAS_IO_URING
+
+/** user_data of the write requests. Reads use their slot index */
+static const uint64_t WRITE_ID = ~0ULL;
+/** user_data of the cancellation requests */
+static const uint64_t CANCEL_ID = ~0ULL - 1;
+/** How long the destructor waits for the cancelled requests to complete */
+static const base::Time CANCEL_TIMEOUT = base::Time::fromSeconds(5);
+
+/** Minimal management of an io_uring instance */
+struct IOUringStream::Ring
+{
+    int fd = -1;
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_size = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    /** Number of SQEs that have been queued but not submitted yet */
+    unsigned to_submit = 0;
+
+    explicit Ring(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            throw UnixError("IOUringStream: cannot create the io_uring instance");
+        if (!(params.features & IORING_FEAT_EXT_ARG)) {
+            cleanup();
+            throw UnixError("IOUringStream: the kernel's io_uring is too old", ENOSYS);
+        }
+
+        sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+        sq_map = mmap(0, sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) {
+            cleanup();
+            throw UnixError("IOUringStream: cannot map the submission queue");
+        }
+        if (single_mmap)
+            cq_map = sq_map;
+        else {
+            cq_map = mmap(0, cq_map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_map == MAP_FAILED) {
+                cleanup();
+                throw UnixError("IOUringStream: cannot map the completion queue");
+            }
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(
+            mmap(0, sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)
+        );
+        if (sqes == MAP_FAILED) {
+            cleanup();
+            throw UnixError("IOUringStream: cannot map the submission entries");
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(sq_map);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+
+        uint8_t* cq = static_cast<uint8_t*>(cq_map);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~Ring()
+    {
+        cleanup();
+    }
+
+    void cleanup()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        if (cq_map != MAP_FAILED && cq_map != sq_map)
+            munmap(cq_map, cq_map_size);
+        if (sq_map != MAP_FAILED)
+            munmap(sq_map, sq_map_size);
+        if (fd != -1)
+            ::close(fd);
+    }
+
+    /** Returns a zeroed SQE that will be submitted by the next call to enter */
+    io_uring_sqe* getSQE()
+    {
+        unsigned tail = *sq_tail;
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries)
+            throw std::logic_error("IOUringStream: submission queue full");
+
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++to_submit;
+        return sqe;
+    }
+
+    /** Submits the queued SQEs and optionally waits for a completion
+     *
+     * @return false if the wait timed out or was interrupted
+     */
+    bool enter(bool wait, timespec* timeout)
+    {
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(timeout);
+
+        unsigned flags = IORING_ENTER_EXT_ARG;
+        if (wait)
+            flags |= IORING_ENTER_GETEVENTS;
+
+        int ret = syscall(__NR_io_uring_enter, fd, to_submit, wait ? 1 : 0,
+                          flags, &arg, sizeof(arg));
+        if (ret >= 0) {
+            to_submit -= std::min<unsigned>(ret, to_submit);
+            return true;
+        }
+        else if (errno == ETIME || errno == EINTR)
+            return false;
+        throw UnixError("IOUringStream: error in io_uring_enter()");
+    }
+};
+
+bool IOUringStream::isSupported()
+{
+    static int supported = -1;
+    if (supported == -1) {
+        try {
+            Ring ring(2);
+            supported = 1;
+        }
+        catch(UnixError const&) {
+            supported = 0;
+        }
+    }
+    return supported;
+}
+
+IOUringStream::IOUringStream(int fd, bool auto_close, bool has_eof,
+                             int read_depth, size_t read_size,
+                             size_t write_buffer_size)
+    : m_ring(new Ring(2 * (read_depth + 1)))
+    , m_fd(fd)
+    , m_auto_close(auto_close)
+    , m_has_eof(has_eof)
+    , m_read_slots(read_depth)
+    , m_write_buffer_size(write_buffer_size)
+{
+    m_saved_fd_flags = fcntl(fd, F_GETFL);
+    if (m_saved_fd_flags == -1)
+        throw UnixError("IOUringStream: cannot read the file descriptor flags");
+    if (fcntl(fd, F_SETFL, m_saved_fd_flags & ~O_NONBLOCK) == -1) {
+        m_saved_fd_flags = -1;
+        throw UnixError("IOUringStream: cannot reset the O_NONBLOCK flag");
+    }
+
+    try {
+        // A TTY whose VMIN is zero would make the posted reads return right
+        // away without data
+        termios tio;
+        if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+            m_saved_tty = tio;
+            m_has_saved_tty = true;
+            tio.c_cc[VMIN] = 1;
+            tio.c_cc[VTIME] = 0;
+            if (tcsetattr(fd, TCSANOW, &tio) != 0)
+                throw UnixError("IOUringStream: cannot configure the TTY");
+        }
+
+        m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_event_fd == -1)
+            throw UnixError("IOUringStream: cannot create the readiness eventfd");
+        if (syscall(__NR_io_uring_register, m_ring->fd, IORING_REGISTER_EVENTFD,
+                    &m_event_fd, 1) != 0) {
+            throw UnixError("IOUringStream: cannot register the readiness eventfd");
+        }
+
+        struct stat fd_stat;
+        m_is_socket = (fstat(fd, &fd_stat) == 0) && S_ISSOCK(fd_stat.st_mode);
+
+        for (int i = 0; i < read_depth; ++i) {
+            m_read_slots[i].buffer.resize(read_size);
+            postRead(i);
+        }
+        m_ring->enter(false, nullptr);
+    }
+    catch(...) {
+        if (m_outstanding)
+            cancelAll();
+        m_ring.reset();
+        if (m_event_fd != -1)
+            ::close(m_event_fd);
+        restoreDevice();
+        throw;
+    }
+}
+
+IOUringStream::~IOUringStream()
+{
+    cancelAll();
+    m_ring.reset();
+    ::close(m_event_fd);
+    restoreDevice();
+    if (m_auto_close)
+        ::close(m_fd);
+}
+
+void IOUringStream::restoreDevice()
+{
+    if (m_has_saved_tty)
+        tcsetattr(m_fd, TCSANOW, &m_saved_tty);
+    if (m_saved_fd_flags != -1)
+        fcntl(m_fd, F_SETFL, m_saved_fd_flags);
+}
+
+void IOUringStream::updateReadiness()
+{
+    // Reset the counter first, so that the completions that arrive from now
+    // on set it again
+    uint64_t value;
+    while (::read(m_event_fd, &value, sizeof(value)) == -1 && errno == EINTR);
+
+    unsigned head = *m_ring->cq_head;
+    unsigned tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head != tail || !m_ready_slots.empty() || m_eof || m_read_error) {
+        value = 1;
+        while (::write(m_event_fd, &value, sizeof(value)) == -1 && errno == EINTR);
+    }
+}
+
+void IOUringStream::cancelAll()
+{
+    m_closing = true;
+    for (size_t i = 0; i < m_read_slots.size(); ++i) {
+        io_uring_sqe* sqe = m_ring->getSQE();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = i;
+        sqe->user_data = CANCEL_ID;
+    }
+    if (m_write_posted) {
+        io_uring_sqe* sqe = m_ring->getSQE();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = WRITE_ID;
+        sqe->user_data = CANCEL_ID;
+    }
+
+    // The kernel may write in the read buffers until the requests are
+    // actually finished, so we really have to wait for them
+    base::Time deadline = Timeout::now() + CANCEL_TIMEOUT;
+    do {
+        try {
+            timespec timeout = { 1, 0 };
+            m_ring->enter(m_outstanding > 0, &timeout);
+            processCompletions();
+        }
+        catch(UnixError const&) {
+        }
+    }
+    while (m_outstanding && Timeout::now() < deadline);
+
+    if (m_outstanding) {
+        LOG_ERROR_S << "IOUringStream: " << m_outstanding << " requests did "
+                    << "not complete after being cancelled, giving up on them"
+                    << endl;
+        // The kernel may still write in their buffers, leak them instead of
+        // freeing them
+        new vector<ReadSlot>(std::move(m_read_slots));
+        new vector<uint8_t>(std::move(m_write_in_flight));
+    }
+}
+
+void IOUringStream::postRead(int slot)
+{
+    ReadSlot& read_slot = m_read_slots[slot];
+    io_uring_sqe* sqe = m_ring->getSQE();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(read_slot.buffer.data());
+    sqe->len = read_slot.buffer.size();
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = slot;
+    ++m_outstanding;
+}
+
+void IOUringStream::postWrite()
+{
+    io_uring_sqe* sqe = m_ring->getSQE();
+    if (m_is_socket) {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    else {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->off = static_cast<uint64_t>(-1);
+    }
+    sqe->fd = m_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(m_write_in_flight.data() + m_write_offset);
+    sqe->len = m_write_in_flight.size() - m_write_offset;
+    sqe->user_data = WRITE_ID;
+    m_write_posted = true;
+    ++m_outstanding;
+}
+
+void IOUringStream::processCompletions()
+{
+    unsigned head = *m_ring->cq_head;
+    unsigned tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        io_uring_cqe const& cqe = m_ring->cqes[head & m_ring->cq_mask];
+        uint64_t id = cqe.user_data;
+        int res = cqe.res;
+        if (id == CANCEL_ID)
+            continue;
+
+        --m_outstanding;
+        if (id == WRITE_ID) {
+            m_write_posted = false;
+            if (res >= 0)
+                m_write_offset += res;
+            else if (res != -EAGAIN && res != -EINTR && res != -ENOBUFS) {
+                if (res != -ECANCELED)
+                    m_write_error = -res;
+                m_write_offset = m_write_in_flight.size();
+            }
+
+            if (m_closing)
+                continue;
+            else if (m_write_offset < m_write_in_flight.size())
+                postWrite();
+            else if (!m_write_pending.empty()) {
+                // Coalesce all the writes that were queued in the meantime
+                m_write_in_flight.swap(m_write_pending);
+                m_write_pending.clear();
+                m_write_offset = 0;
+                postWrite();
+            }
+        }
+        else {
+            ReadSlot& slot = m_read_slots[id];
+            if (res > 0) {
+                slot.size = res;
+                slot.offset = 0;
+                m_ready_slots.push_back(id);
+            }
+            else if (res == 0 && m_has_eof)
+                m_eof = true;
+            else if (res == -ECANCELED || m_eof || m_closing)
+                continue;
+            else if (res == 0 || res == -EAGAIN || res == -EINTR)
+                postRead(id);
+            else
+                m_read_error = -res;
+        }
+    }
+    __atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void IOUringStream::submitAndWait(bool wait, base::Time const& timeout)
+{
+    if (wait) {
+        int64_t timeout_us = std::max<int64_t>(0, timeout.toMicroseconds());
+        timespec timeout_spec = {
+            static_cast<time_t>(timeout_us / 1000000),
+            static_cast<long>(timeout_us % 1000000) * 1000
+        };
+        m_ring->enter(true, &timeout_spec);
+    }
+    else if (m_ring->to_submit)
+        m_ring->enter(false, nullptr);
+
+    processCompletions();
+
+    // Completions may have re-posted requests
+    if (m_ring->to_submit)
+        m_ring->enter(false, nullptr);
+}
+
+void IOUringStream::throwPendingError(int& error, char const* message)
+{
+    if (!error)
+        return;
+
+    int error_code = error;
+    error = 0;
+    throw UnixError(message, error_code);
+}
+
+bool IOUringStream::waitRead(base::Time const& timeout)
+{
+    base::Time deadline = Timeout::now() + timeout;
+    while (true) {
+        submitAndWait(false, base::Time());
+        if (!m_ready_slots.empty() || m_eof || m_read_error)
+            return true;
+
+        base::Time now = Timeout::now();
+        if (now >= deadline) {
+            updateReadiness();
+            return false;
+        }
+        submitAndWait(true, deadline - now);
+    }
+}
+
+bool IOUringStream::waitWrite(base::Time const& timeout)
+{
+    base::Time deadline = Timeout::now() + timeout;
+    while (true) {
+        submitAndWait(false, base::Time());
+        throwPendingError(m_write_error, "writePacket(): error during write");
+        if (m_write_pending.size() < m_write_buffer_size)
+            return true;
+
+        base::Time now = Timeout::now();
+        if (now >= deadline)
+            return false;
+        submitAndWait(true, deadline - now);
+    }
+}
+
+size_t IOUringStream::read(uint8_t* buffer, size_t buffer_size)
+{
+    // Data that is already in the completion queue does not need a system
+    // call
+    processCompletions();
+
+    size_t result = 0;
+    while (!m_ready_slots.empty() && result < buffer_size) {
+        int slot_index = m_ready_slots.front();
+        ReadSlot& slot = m_read_slots[slot_index];
+        size_t size = std::min(slot.size - slot.offset, buffer_size - result);
+        memcpy(buffer + result, slot.buffer.data() + slot.offset, size);
+        slot.offset += size;
+        result += size;
+
+        if (slot.offset == slot.size) {
+            m_ready_slots.pop_front();
+            if (!m_eof)
+                postRead(slot_index);
+        }
+    }
+
+    // Re-post all the slots that have been consumed at once
+    if (m_ring->to_submit)
+        m_ring->enter(false, nullptr);
+    updateReadiness();
+
+    if (!result)
+        throwPendingError(m_read_error, "readPacket(): error reading the file descriptor");
+    return result;
+}
+
+size_t IOUringStream::write(uint8_t const* buffer, size_t buffer_size)
+{
+    processCompletions();
+    throwPendingError(m_write_error, "writePacket(): error during write");
+
+    size_t size = std::min(buffer_size, m_write_buffer_size - m_write_pending.size());
+    m_write_pending.insert(m_write_pending.end(), buffer, buffer + size);
+    if (!m_write_posted) {
+        m_write_in_flight.swap(m_write_pending);
+        m_write_pending.clear();
+        m_write_offset = 0;
+        postWrite();
+    }
+
+    if (m_ring->to_submit)
+        m_ring->enter(false, nullptr);
+    return size;
+}
+
+void IOUringStream::clear()
+{
+    processCompletions();
+    while (!m_ready_slots.empty()) {
+        int slot_index = m_ready_slots.front();
+        m_ready_slots.pop_front();
+        if (!m_eof)
+            postRead(slot_index);
+    }
+    if (m_ring->to_submit)
+        m_ring->enter(false, nullptr);
+    updateReadiness();
+}
+
+bool IOUringStream::eof() const
+{
+    return m_eof && m_ready_slots.empty();
+}
+
+int IOUringStream::getFileDescriptor() const
+{
+    return m_event_fd;
+}
+
+int IOUringStream::getDeviceFileDescriptor() const
+{
+    return m_fd;
+}
+
+#else
+
+struct IOUringStream::Ring {};
+
+bool IOUringStream::isSupported()
+{
+    return false;
+}
+
+IOUringStream::IOUringStream(int fd, bool auto_close, bool has_eof,
+                             int read_depth, size_t read_size,
+                             size_t write_buffer_size)
+    : m_fd(fd)
+    , m_auto_close(auto_close)
+    , m_has_eof(has_eof)
+    , m_write_buffer_size(write_buffer_size)
+{
+    throw UnixError("IOUringStream: io_uring is not available on this system", ENOSYS);
+}
+
+IOUringStream::~IOUringStream() {}
+bool IOUringStream::waitRead(base::Time const&) { return false; }
+bool IOUringStream::waitWrite(base::Time const&) { return false; }
+size_t IOUringStream::read(uint8_t*, size_t) { return 0; }
+size_t IOUringStream::write(uint8_t const*, size_t) { return 0; }
+void IOUringStream::clear() {}
+bool IOUringStream::eof() const { return true; }
+int IOUringStream::getFileDescriptor() const { return m_event_fd; }
+int IOUringStream::getDeviceFileDescriptor() const { return m_fd; }
+
+#endif
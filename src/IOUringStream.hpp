@@ -0,0 +1,135 @@
+#ifndef IODRIVERS_BASE_IOURINGSTREAM_HPP
+#define IODRIVERS_BASE_IOURINGSTREAM_HPP
+
+#include <iodrivers_base/IOStream.hpp>
+
+#include <deque>
+#include <termios.h>
+#include <memory>
+#include <vector>
+
+namespace iodrivers_base
+{
+    /** Implementation of IOStream for file descriptors based on Linux's
+     * io_uring
+     *
+     * The stream keeps a configurable number of reads posted on the file
+     * descriptor at all times, so that data is already in user space when
+     * the driver calls read(). Written data is queued and submitted
+     * asynchronously, with writes issued while another one is in flight
+     * being coalesced into a single request.
+     *
+     * The kernel does the waiting, so the file descriptor is switched to
+     * blocking mode. TTYs are additionally configured so that a read waits
+     * for at least one byte (VMIN=1). Both settings are restored when the
+     * stream is destroyed.
+     *
+     * Since the posted reads drain the device, its file descriptor never
+     * becomes readable. getFileDescriptor() returns instead an eventfd that
+     * is readable whenever read() has data to return, so that the stream
+     * can be used with poll-based code such as DriverReactor or forward().
+     * This eventfd is always writable. Use getDeviceFileDescriptor() to
+     * access the device itself.
+     *
+     * Use isSupported() to check whether the running kernel supports it.
+     * Driver::openURI does it automatically when given the io_uring=1
+     * option, and falls back to FDStream otherwise.
+     */
+    class IOUringStream : public IOStream
+    {
+    public:
+        /**
+         * @param fd the file descriptor
+         * @param auto_close whether the file descriptor should be closed
+         *   when the stream is deleted
+         * @param has_eof whether a zero-sized read means end-of-file
+         * @param read_depth how many reads are kept posted on the file
+         *   descriptor
+         * @param read_size the size of each posted read
+         * @param write_buffer_size how many bytes may be queued for writing.
+         *   write() accepts less data than given once it is full.
+         *
+         * @throws UnixError if the io_uring instance cannot be created
+         */
+        IOUringStream(int fd, bool auto_close, bool has_eof = true,
+                      int read_depth = 4, size_t read_size = 16384,
+                      size_t write_buffer_size = 65536);
+        ~IOUringStream();
+
+        /** Whether io_uring is supported by the library and by the running
+         * kernel
+         */
+        static bool isSupported();
+
+        bool waitRead(base::Time const& timeout) override;
+        bool waitWrite(base::Time const& timeout) override;
+        size_t read(uint8_t* buffer, size_t buffer_size) override;
+        size_t write(uint8_t const* buffer, size_t buffer_size) override;
+        void clear() override;
+        bool eof() const override;
+
+        /** An eventfd that is readable when there is data to read
+         *
+         * It is not the device's file descriptor. Use
+         * getDeviceFileDescriptor() for that
+         */
+        int getFileDescriptor() const override;
+
+        /** The file descriptor of the device */
+        int getDeviceFileDescriptor() const;
+
+    private:
+        struct Ring;
+        std::unique_ptr<Ring> m_ring;
+
+        int m_fd;
+        int m_event_fd = -1;
+        bool m_auto_close;
+        bool m_has_eof;
+        bool m_eof = false;
+        bool m_is_socket = false;
+        /** File status flags of the device before the stream changed them */
+        long m_saved_fd_flags = -1;
+        /** TTY configuration of the device before the stream changed it */
+        termios m_saved_tty;
+        bool m_has_saved_tty = false;
+
+        /** Set by the destructor so that completions do not re-post requests */
+        bool m_closing = false;
+
+        struct ReadSlot
+        {
+            std::vector<uint8_t> buffer;
+            size_t size = 0;
+            size_t offset = 0;
+        };
+        std::vector<ReadSlot> m_read_slots;
+        /** Slots whose read completed, in completion order */
+        std::deque<int> m_ready_slots;
+        int m_read_error = 0;
+
+        size_t m_write_buffer_size;
+        /** Data accepted by write() but not yet submitted */
+        std::vector<uint8_t> m_write_pending;
+        /** Data of the write request currently in flight */
+        std::vector<uint8_t> m_write_in_flight;
+        size_t m_write_offset = 0;
+        bool m_write_posted = false;
+        int m_write_error = 0;
+
+        /** Number of requests whose completion has not been processed yet */
+        int m_outstanding = 0;
+
+        void postRead(int slot);
+        void postWrite();
+        void submitAndWait(bool wait, base::Time const& timeout);
+        void processCompletions();
+        void cancelAll();
+        void restoreDevice();
+        /** Makes the eventfd readable iff there is data to read */
+        void updateReadiness();
+        void throwPendingError(int& error, char const* message);
+    };
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include <iodrivers_base/LatencyHistogram.hpp>
+
+#include <cmath>
+#include <limits>
+#include <time.h>
+
+using namespace std;
+using namespace iodrivers_base;
+
+static const uint64_t NO_MIN = numeric_limits<uint64_t>::max();
+
+LatencyHistogram::Snapshot::Snapshot()
+    : count(0)
+    , min_ns(0)
+    , max_ns(0)
+    , sum_ns(0)
+{
+    counts.fill(0);
+}
+
+uint64_t LatencyHistogram::Snapshot::getMean() const
+{
+    if (count == 0)
+        return 0;
+    return sum_ns / count;
+}
+
+uint64_t LatencyHistogram::Snapshot::getPercentile(double percentile) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t target = ceil(count * percentile / 100);
+    if (target == 0)
+        target = 1;
+
+    uint64_t cumulated = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        cumulated += counts[i];
+        if (cumulated >= target)
+            return min(getBucketUpperBound(i), max_ns);
+    }
+    return max_ns;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : m_min(NO_MIN)
+    , m_max(0)
+    , m_sum(0)
+{
+    for (auto& counter : m_counts)
+        counter.store(0, memory_order_relaxed);
+}
+
+size_t LatencyHistogram::getBucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude > MAX_MAGNITUDE)
+        return BUCKET_COUNT - 1;
+
+    int shift = magnitude - SUB_BUCKET_BITS;
+    return SUB_BUCKETS * (shift + 1) + (value >> shift) - SUB_BUCKETS;
+}
+
+uint64_t LatencyHistogram::getBucketLowerBound(size_t index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+
+    int shift = index / SUB_BUCKETS - 1;
+    return static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::getBucketUpperBound(size_t index)
+{
+    if (index == BUCKET_COUNT - 1)
+        return numeric_limits<uint64_t>::max();
+    return getBucketLowerBound(index + 1) - 1;
+}
+
+uint64_t LatencyHistogram::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+void LatencyHistogram::add(atomic<uint64_t>& counter, uint64_t value)
+{
+    // There is a single writer, no need for a read-modify-write operation
+    counter.store(counter.load(memory_order_relaxed) + value,
+                  memory_order_relaxed);
+}
+
+void LatencyHistogram::record(uint64_t value_ns)
+{
+    add(m_counts[getBucketIndex(value_ns)], 1);
+    add(m_sum, value_ns);
+    if (value_ns < m_min.load(memory_order_relaxed))
+        m_min.store(value_ns, memory_order_relaxed);
+    if (value_ns > m_max.load(memory_order_relaxed))
+        m_max.store(value_ns, memory_order_relaxed);
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto& counter : m_counts)
+        counter.store(0, memory_order_relaxed);
+    m_min.store(NO_MIN, memory_order_relaxed);
+    m_max.store(0, memory_order_relaxed);
+    m_sum.store(0, memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot result;
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+        result.counts[i] = m_counts[i].load(memory_order_relaxed);
+        result.count += result.counts[i];
+    }
+    if (result.count) {
+        result.min_ns = m_min.load(memory_order_relaxed);
+        result.max_ns = m_max.load(memory_order_relaxed);
+        result.sum_ns = m_sum.load(memory_order_relaxed);
+        if (result.min_ns == NO_MIN)
+            result.min_ns = 0;
+    }
+    return result;
+}
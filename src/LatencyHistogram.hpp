@@ -0,0 +1,110 @@
+#ifndef IODRIVERS_BASE_LATENCY_HISTOGRAM_HPP
+#define IODRIVERS_BASE_LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace iodrivers_base {
+    /** Fixed-size log-linear histogram of durations, in nanoseconds
+     *
+     * Values are sorted into 16 linear sub-buckets per power of two, which
+     * bounds the relative error of a reported value to 1/16th. Values
+     * above 2^41ns (about 36 minutes) all end up in the last bucket.
+     *
+     * record() and reset() may only be called by one thread at a time, but
+     * snapshot() can be called from any thread.
+     */
+    class LatencyHistogram
+    {
+    public:
+        static const int SUB_BUCKET_BITS = 4;
+        static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const int MAX_MAGNITUDE = 40;
+        static const int BUCKET_COUNT = SUB_BUCKETS * (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2);
+
+        /** A copy of the histogram's content at a given time */
+        struct Snapshot
+        {
+            std::array<uint64_t, BUCKET_COUNT> counts;
+            uint64_t count;
+            uint64_t min_ns;
+            uint64_t max_ns;
+            uint64_t sum_ns;
+
+            Snapshot();
+
+            /** Mean of the recorded values, or zero if there are none */
+            uint64_t getMean() const;
+
+            /** Value below which the given percentage of the recorded values
+             * are
+             *
+             * It is the upper bound of the bucket that contains the
+             * percentile, clamped to max_ns
+             *
+             * @param percentile between 0 and 100
+             */
+            uint64_t getPercentile(double percentile) const;
+        };
+
+        LatencyHistogram();
+
+        /** Returns the bucket a value falls into */
+        static size_t getBucketIndex(uint64_t value);
+
+        /** Returns the smallest value that falls into the given bucket */
+        static uint64_t getBucketLowerBound(size_t index);
+
+        /** Returns the largest value that falls into the given bucket */
+        static uint64_t getBucketUpperBound(size_t index);
+
+        /** Current time of a monotonic clock, in nanoseconds, to be used to
+         * compute the durations given to record()
+         */
+        static uint64_t now();
+
+        /** Adds a value to the histogram */
+        void record(uint64_t value_ns);
+
+        /** Removes all values from the histogram */
+        void reset();
+
+        /** Returns a copy of the histogram
+         *
+         * Updates are not blocked while the copy is made, so it may include
+         * part of a concurrent record(). The count is always the sum of the
+         * copied buckets.
+         */
+        Snapshot snapshot() const;
+
+    private:
+        static void add(std::atomic<uint64_t>& counter, uint64_t value);
+
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> m_counts;
+        std::atomic<uint64_t> m_min;
+        std::atomic<uint64_t> m_max;
+        std::atomic<uint64_t> m_sum;
+    };
+
+    /** The latencies measured by a driver
+     *
+     * @see Driver::setLatencyMonitoring
+     */
+    struct Latencies
+    {
+        /** Time between the reception of the first byte of a packet and its
+         * extraction from the driver's internal buffer
+         */
+        LatencyHistogram::Snapshot packet;
+        /** Time spent waiting for data in readPacket and readRaw */
+        LatencyHistogram::Snapshot wait_read;
+        /** Time spent in each call to extractPacket */
+        LatencyHistogram::Snapshot extract;
+        /** Time writePacket took to write a whole packet */
+        LatencyHistogram::Snapshot write;
+    };
+}
+
+#endif
@@ -1,100 +1,289 @@
-#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/Framing.hpp>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
 #include <iostream>
-#include <iomanip>
 #include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
 
 using namespace std;
 using namespace iodrivers_base;
 
 static void usage(ostream& out) {
-    out << "iodrivers_base_cat URI [--raw] [TIMEOUT]\n"
+    out << "iodrivers_base_cat URI [--raw] [--timestamps] [--framing=FRAMING] [TIMEOUT]\n"
         << "  displays data coming from a iodrivers_base-compatible URI"
         << "\n"
         << "  TIMEOUT defines how long (in milliseconds) the program should\n"
         << "  wait on read before displaying it. Defaults to 100ms\n"
+        << "\n"
+        << "  --timestamps starts the data of each read on a new line, prefixed\n"
+        << "  with the time at which it was received. With a FRAMING, this is\n"
+        << "  the reception time of the packet's first byte (the kernel's on\n"
+        << "  sockets). Otherwise, it is the time at which the read returned\n"
+        << "\n"
+        << "  FRAMING makes the program extract packets from the stream and\n"
+        << "  display one packet per line. See iodrivers_base_forwarder for\n"
+        << "  the list of framings\n"
         << flush;
 }
 
 static const int BUFFER_SIZE = 32768;
 static const int COLUMN_SIZE = 8;
 static const int LINE_SIZE = COLUMN_SIZE * 3;
+static const int TIMESTAMP_SIZE = 16;
+/** Upper bound of the size of a formatted line of LINE_SIZE bytes:
+ * timestamp, hex with separators, ascii with separators and newline
+ */
+static const int MAX_LINE_LENGTH = TIMESTAMP_SIZE + LINE_SIZE * 3 + 4 + 3 + LINE_SIZE + 2 + 1;
 
-class RawIODriver : public iodrivers_base::Driver {
-    int extractPacket(uint8_t const* buffer, size_t buffer_size) const {
-        return 0;
+/** Writes the whole buffer to a file descriptor */
+static void writeAll(int fd, char const* buffer, size_t size) {
+    while (size) {
+        ssize_t c = ::write(fd, buffer, size);
+        if (c < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw UnixError("cannot write to the output");
+        }
+        buffer += c;
+        size -= c;
     }
+}
+
+/** Table-driven hexdump formatter
+ *
+ * Each chunk of data is formatted in a buffer, which is written with a
+ * single system call
+ */
+class HexDump {
+    int m_fd;
+    bool m_timestamps;
+    vector<char> m_output;
+    char* m_out = nullptr;
+    char m_line[LINE_SIZE];
+    int m_pos = 0;
+    /** The timestamp of the current read, or blanks for the lines after
+     * the first
+     *
+     * Only the first TIMESTAMP_SIZE characters are used. The buffer is sized
+     * for the worst case of the format so that snprintf never truncates
+     */
+    char m_prefix[64];
+
+    char m_hex[256][2];
+    char m_printable[256];
+
 public:
-    RawIODriver()
-        : Driver(BUFFER_SIZE) {}
-};
+    HexDump(int fd, bool timestamps)
+        : m_fd(fd)
+        , m_timestamps(timestamps) {
+        char const* digits = "0123456789abcdef";
+        for (int i = 0; i < 256; ++i) {
+            m_hex[i][0] = digits[i >> 4];
+            m_hex[i][1] = digits[i & 0xF];
+            m_printable[i] = isprint(i) ? i : '.';
+        }
+    }
 
-void displayAscii(char* line) {
-    for (int i = 0; i < LINE_SIZE; ++i) {
-        if (i && i % COLUMN_SIZE == 0) {
-            cout << " ";
+    /** Displays data from a stream
+     *
+     * Without timestamps, the data continues the current line. Otherwise,
+     * the data is displayed on its own lines, prefixed with \c time
+     */
+    void displayChunk(uint8_t const* buffer, int size, base::Time const& time) {
+        begin(size);
+        if (m_timestamps) {
+            formatTimestamp(time);
         }
 
-        cout << line[i];
+        for (int i = 0; i < size; ++i) {
+            if (m_pos) {
+                *m_out++ = ' ';
+                if (m_pos % COLUMN_SIZE == 0) {
+                    *m_out++ = ' ';
+                    *m_out++ = ' ';
+                }
+            }
+            else if (m_timestamps) {
+                appendPrefix();
+            }
+
+            m_out[0] = m_hex[buffer[i]][0];
+            m_out[1] = m_hex[buffer[i]][1];
+            m_out += 2;
+            m_line[m_pos++] = m_printable[buffer[i]];
+            if (m_pos == LINE_SIZE) {
+                endLine();
+            }
+        }
+        if (m_timestamps) {
+            endLine();
+        }
+        flush();
     }
-}
+
+    /** Displays a packet on its own line, prefixed with \c time if
+     * timestamps are enabled
+     */
+    void displayPacket(uint8_t const* buffer, int size, base::Time const& time) {
+        begin(size);
+        if (m_timestamps) {
+            formatTimestamp(time);
+            appendPrefix();
+        }
+
+        for (int i = 0; i < size; ++i) {
+            if (i) {
+                *m_out++ = ' ';
+            }
+            m_out[0] = m_hex[buffer[i]][0];
+            m_out[1] = m_hex[buffer[i]][1];
+            m_out += 2;
+        }
+        *m_out++ = ' ';
+        *m_out++ = ' ';
+        for (int i = 0; i < size; ++i) {
+            *m_out++ = m_printable[buffer[i]];
+        }
+        *m_out++ = '\n';
+        flush();
+    }
+
+private:
+    void begin(int size) {
+        // A packet line is at most 4 bytes per byte of data, a stream line
+        // at most MAX_LINE_LENGTH per LINE_SIZE bytes of data. Keep room for
+        // the end of the current line
+        size_t needed = max<size_t>(
+            (size / LINE_SIZE + 2) * MAX_LINE_LENGTH,
+            TIMESTAMP_SIZE + size * 4 + 4
+        );
+        if (m_output.size() < needed) {
+            m_output.resize(needed);
+        }
+        m_out = m_output.data();
+    }
+
+    void flush() {
+        writeAll(m_fd, m_output.data(), m_out - m_output.data());
+    }
+
+    void formatTimestamp(base::Time const& time) {
+        int64_t us = time.toMicroseconds();
+        time_t seconds = us / 1000000;
+        tm local;
+        localtime_r(&seconds, &local);
+        snprintf(m_prefix, sizeof(m_prefix), "%02d:%02d:%02d.%06d ",
+                 local.tm_hour, local.tm_min, local.tm_sec,
+                 static_cast<int>(us % 1000000));
+    }
+
+    void appendPrefix() {
+        m_out = copy(m_prefix, m_prefix + TIMESTAMP_SIZE, m_out);
+        fill(m_prefix, m_prefix + TIMESTAMP_SIZE, ' ');
+    }
+
+    /** Terminates the current line, if there is one, with its ascii
+     * representation
+     */
+    void endLine() {
+        if (!m_pos) {
+            return;
+        }
+
+        // Align the ascii column of incomplete lines
+        for (int i = m_pos; i < LINE_SIZE; ++i) {
+            int padding = (i % COLUMN_SIZE == 0) ? 5 : 3;
+            m_out = fill_n(m_out, padding, ' ');
+        }
+
+        m_out = fill_n(m_out, 3, ' ');
+        for (int i = 0; i < m_pos; ++i) {
+            if (i && i % COLUMN_SIZE == 0) {
+                *m_out++ = ' ';
+            }
+            *m_out++ = m_line[i];
+        }
+        *m_out++ = '\n';
+        m_pos = 0;
+    }
+};
 
 int main(int argc, char** argv) {
-    if (argc != 2 && argc > 4) {
+    if (argc < 2 || argc > 6) {
         usage(argc == 1 ? cout : cerr);
         return argc == 1 ? 0 : 1;
     }
 
     string uri = argv[1];
     bool raw = false;
+    bool timestamps = false;
+    string framing = "raw";
     int timeout_ms = 100;
 
-    int arg_i = 2;
-    if (argc > 2 && string(argv[2]) == "--raw") {
-        raw = true;
-        arg_i++;
-    }
-
-    if (argc > arg_i) {
-        timeout_ms = atoi(argv[arg_i]);
+    for (int arg_i = 2; arg_i < argc; ++arg_i) {
+        string arg = argv[arg_i];
+        if (arg == "--raw") {
+            raw = true;
+        }
+        else if (arg == "--timestamps") {
+            timestamps = true;
+        }
+        else if (arg.substr(0, 10) == "--framing=") {
+            framing = arg.substr(10);
+        }
+        else {
+            timeout_ms = atoi(arg.c_str());
+        }
     }
 
     base::Time timeout = base::Time::fromMilliseconds(timeout_ms);
 
     uint8_t buffer[BUFFER_SIZE];
-    int pos = 0;
-    char line[LINE_SIZE];
+    HexDump dump(fileno(stdout), timestamps);
 
     while (true) {
-        RawIODriver driver;
+        FramingDriver driver(BUFFER_SIZE, Framing::fromString(framing, BUFFER_SIZE));
         driver.openURI(uri);
+        if (timestamps) {
+            driver.setReceiveTimestamps(true);
+        }
+
+        while (driver.getFraming()) {
+            int count;
+            try {
+                count = driver.readPacket(buffer, BUFFER_SIZE, timeout);
+            }
+            catch (TimeoutError const&) {
+                continue;
+            }
+
+            if (raw) {
+                writeAll(fileno(stdout), reinterpret_cast<char*>(buffer), count);
+            }
+            else {
+                base::Time time = driver.getLastPacketTime();
+                dump.displayPacket(buffer, count,
+                                   time.isNull() ? base::Time::now() : time);
+            }
+        }
 
         while (true) {
             int count = driver.readRaw(buffer, BUFFER_SIZE, timeout);
-            if (raw) {
-                write(fileno(stdout), buffer, count);
+            if (!count) {
                 continue;
             }
-            
-            for (int i = 0; i < count; ++i) {
-                if (pos) {
-                    cout << " ";
-                    if (pos % LINE_SIZE == 0) {
-                        cout << "  ";
-                        displayAscii(line);
-                        cout << "\n";
-                        pos = 0;
-                    }
-                    else if (pos % COLUMN_SIZE == 0) {
-                        cout << "  ";
-                    }
-                }
-
-                line[pos] = isprint(buffer[i]) ? buffer[i] : '.';
-                cout << hex << setw(2) << setfill('0') << static_cast<int>(buffer[i]);
-                ++pos;
+            else if (raw) {
+                writeAll(fileno(stdout), reinterpret_cast<char*>(buffer), count);
+            }
+            else {
+                dump.displayChunk(buffer, count, base::Time::now());
             }
         }
     }
     return 0;
 }
-
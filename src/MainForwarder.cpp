@@ -1,13 +1,16 @@
 #include <iodrivers_base/Forward.hpp>
-#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/Framing.hpp>
 #include <iostream>
+#include <memory>
+#include <signal.h>
 #include <thread>
+#include <vector>
 
 using namespace std;
 using namespace iodrivers_base;
 
 static void usage(ostream& out) {
-    out << "iodrivers_base_forwarder URI1 TIMEOUT1 URI2 TIMEOUT2 [PACKET_SIZE]\n"
+    out << "iodrivers_base_forwarder [--framing=FRAMING] URI1 TIMEOUT1 URI2 TIMEOUT2 [PACKET_SIZE]\n"
         << "  forwards data (two-way) between URI1 and URI2, which must both\n"
         << "  be valid iodrivers_base URIs\n"
         << "\n"
@@ -15,22 +18,91 @@ static void usage(ostream& out) {
         << "  wait on read before forwarding the data, to avoid unnecessary fragmentation\n"
         << "\n"
         << "  PACKET_SIZE is the max size in bytes after which data is being forwarded\n"
-        << "  regardless of the timeouts. The default is 32768"
+        << "  regardless of the timeouts. The default is 32768\n"
+        << "\n"
+        << "iodrivers_base_forwarder [--framing=FRAMING] --fan-out SOURCE_URI TIMEOUT SINK_URI [SINK_URI...]\n"
+        << "  forwards the data received from SOURCE_URI to all the SINK_URIs, and the\n"
+        << "  data received from the sinks to SOURCE_URI\n"
+        << "\n"
+        << "  TIMEOUT is the time (in milliseconds) the forwarder waits on the source\n"
+        << "  before forwarding the data. Data is dropped for the sinks that can't keep\n"
+        << "  up, and sinks that disconnect are removed. All URIs are reopened when\n"
+        << "  the source closes or all sinks are gone. Use the ignore_connrefused=1\n"
+        << "  option on udp sinks that may have no listener\n"
+        << "\n"
+        << "  FRAMING makes the forwarder extract packets from the streams and forward\n"
+        << "  whole packets, instead of forwarding bytes as they come. The timeouts are\n"
+        << "  then unused. It is one of:\n"
+        << "    raw                   no framing (the default)\n"
+        << "    length:N[:le|be]      packets start with their payload size on N bytes\n"
+        << "    delimiter:BYTE        packets end with BYTE, e.g. delimiter:0x0a\n"
+        << "    slip                  SLIP frames\n"
+        << "    cobs                  COBS frames\n"
+        << "    plugin:PATH[:SYMBOL]  a shared library exporting\n"
+        << "                          int SYMBOL(uint8_t const* buffer, size_t size)\n"
+        << "                          with the semantics of Driver::extractPacket"
         << flush;
 }
 
 static const int DEFAULT_BUFFER_SIZE = 32768;
 
-class RawIODriver : public iodrivers_base::Driver {
-    int extractPacket(uint8_t const* buffer, size_t buffer_size) const {
-        return 0;
-    }
+static string framing = "raw";
+
+class ForwardingDriver : public FramingDriver {
 public:
-    RawIODriver(int buffer_size)
-        : Driver(buffer_size) {}
+    ForwardingDriver(int buffer_size)
+        : FramingDriver(buffer_size, Framing::fromString(framing, buffer_size)) {}
 };
 
+static int fanOutMain(int argc, char** argv) {
+    if (argc < 5) {
+        usage(cerr);
+        return 1;
+    }
+
+    // Disconnected TCP sinks are reported by write errors instead
+    signal(SIGPIPE, SIG_IGN);
+
+    string source_uri = argv[2];
+    base::Time timeout = base::Time::fromMilliseconds(atoi(argv[3]));
+    vector<string> sink_uris(argv + 4, argv + argc);
+
+    while(true) {
+        ForwardingDriver source(DEFAULT_BUFFER_SIZE);
+        source.openURI(source_uri);
+        vector<unique_ptr<ForwardingDriver>> sinks;
+        vector<Driver*> sink_ptrs;
+        for (auto const& uri : sink_uris) {
+            sinks.emplace_back(new ForwardingDriver(DEFAULT_BUFFER_SIZE));
+            sinks.back()->openURI(uri);
+            sink_ptrs.push_back(sinks.back().get());
+        }
+
+        auto status = fanOut(framing == "raw", source, sink_ptrs, timeout, DEFAULT_BUFFER_SIZE);
+        for (size_t i = 0; i < status.size(); ++i) {
+            if (status[i].dropped_bytes) {
+                cerr << sink_uris[i] << ": dropped "
+                     << status[i].dropped_bytes << " bytes" << endl;
+            }
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]).substr(0, 10) == "--framing=") {
+        framing = string(argv[1]).substr(10);
+        // Validate it before any URI is opened
+        Framing::fromString(framing, DEFAULT_BUFFER_SIZE);
+        argv[1] = argv[0];
+        --argc;
+        ++argv;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--fan-out") {
+        return fanOutMain(argc, argv);
+    }
+
     if (argc != 5 && argc != 6) {
         usage(argc == 1 ? cout : cerr);
         return argc == 1 ? 0 : 1;
@@ -47,12 +119,12 @@ int main(int argc, char** argv) {
     base::Time timeout2 = base::Time::fromMilliseconds(atoi(argv[4]));
 
     while(true) {
-        RawIODriver driver1(buffer_size);
+        ForwardingDriver driver1(buffer_size);
         driver1.openURI(uri1);
-        RawIODriver driver2(buffer_size);
+        ForwardingDriver driver2(buffer_size);
         driver2.openURI(uri2);
 
-        forward(true, driver1, driver2, timeout1, timeout2, buffer_size);
+        forward(framing == "raw", driver1, driver2, timeout1, timeout2, buffer_size);
     }
     return 0;
 }
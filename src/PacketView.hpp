@@ -0,0 +1,24 @@
+#ifndef IODRIVERS_BASE_PACKET_VIEW_HPP
+#define IODRIVERS_BASE_PACKET_VIEW_HPP
+
+#include <stdint.h>
+
+namespace iodrivers_base {
+    /** A read-only view on a packet that is stored in a Driver's internal
+     * buffer
+     *
+     * @see Driver::readPacketView
+     */
+    struct PacketView
+    {
+        uint8_t const* data; //! pointer to the first byte of the packet
+        int size; //! size of the packet in bytes
+
+        PacketView()
+            : data(nullptr), size(0) {}
+        PacketView(uint8_t const* data, int size)
+            : data(data), size(size) {}
+    };
+}
+
+#endif
@@ -0,0 +1,48 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <iodrivers_base/SocketConfiguration.hpp>
+#include <iodrivers_base/URI.hpp>
+
+using namespace std;
+using namespace iodrivers_base;
+
+static int parseOption(URI const& uri, string const& key, int min, int max)
+{
+    string value = uri.getOption(key);
+    if (value.empty()) {
+        return -1;
+    }
+
+    char* end;
+    errno = 0;
+    long result = strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || result < min || result > max) {
+        throw std::invalid_argument(
+            "invalid " + key + " parameter " + value + " in URI, expected "
+            "a value between " + to_string(min) + " and " + to_string(max) +
+            " (inclusive)"
+        );
+    }
+    return result;
+}
+
+bool SocketConfiguration::empty() const {
+    return nodelay == -1 && quickack == -1 &&
+           receive_buffer_size == -1 && send_buffer_size == -1 &&
+           busy_poll == -1 && priority == -1;
+}
+
+SocketConfiguration SocketConfiguration::fromURI(URI const& uri) {
+    SocketConfiguration result;
+    result.nodelay = parseOption(uri, "nodelay", 0, 1);
+    result.quickack = parseOption(uri, "quickack", 0, 1);
+    // The kernel doubles the buffer sizes, stay below the overflow
+    result.receive_buffer_size = parseOption(uri, "rcvbuf", 1, INT_MAX / 2);
+    result.send_buffer_size = parseOption(uri, "sndbuf", 1, INT_MAX / 2);
+    result.busy_poll = parseOption(uri, "busy_poll", 0, INT_MAX);
+    result.priority = parseOption(uri, "priority", 0, INT_MAX);
+    return result;
+}
@@ -0,0 +1,54 @@
+#ifndef IODRIVERS_BASE_SOCKET_CONFIGURATION_HPP
+#define IODRIVERS_BASE_SOCKET_CONFIGURATION_HPP
+
+namespace iodrivers_base {
+    struct URI;
+
+    /** This struct holds the options of a TCP or UDP socket
+     *
+     * Fields set to -1 are left to their current value when the configuration
+     * is applied with Driver::setSocketConfiguration
+     */
+    struct SocketConfiguration {
+        SocketConfiguration()
+            : nodelay(-1)
+            , quickack(-1)
+            , receive_buffer_size(-1)
+            , send_buffer_size(-1)
+            , busy_poll(-1)
+            , priority(-1) { }
+
+        /** TCP_NODELAY, 1 to disable Nagle's algorithm, 0 to enable it */
+        int nodelay;
+        /** TCP_QUICKACK, 1 to acknowledge received data immediately */
+        int quickack;
+        /** SO_RCVBUF, in bytes */
+        int receive_buffer_size;
+        /** SO_SNDBUF, in bytes */
+        int send_buffer_size;
+        /** SO_BUSY_POLL, time in microseconds the kernel busy-waits for
+         * incoming data before blocking
+         */
+        int busy_poll;
+        /** SO_PRIORITY, the priority of the packets sent on the socket */
+        int priority;
+
+        /** Whether none of the options is set */
+        bool empty() const;
+
+        /** Create a socket configuration from the options of an URI
+         *
+         * The following parameters are recognized:
+         * - nodelay: 0 or 1
+         * - quickack: 0 or 1
+         * - rcvbuf: the receive buffer size in bytes
+         * - sndbuf: the send buffer size in bytes
+         * - busy_poll: the busy poll time in microseconds
+         * - priority: the socket priority, from 0 to 6 (higher values
+         *   require CAP_NET_ADMIN)
+         */
+        static SocketConfiguration fromURI(URI const& uri);
+    };
+}
+
+#endif
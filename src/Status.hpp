@@ -2,6 +2,7 @@
 #define IODRIVERS_BASE_STATUS_HPP
 
 #include <base/Time.hpp>
+#include <stdint.h>
 
 namespace iodrivers_base {
     /** This structure holds IO statistics */
@@ -9,15 +10,17 @@ namespace iodrivers_base {
     {
         base::Time stamp;
 
-	unsigned int tx; //! count of bytes received
-	unsigned int good_rx; //! count of bytes received and accepted
-	unsigned int bad_rx; //! count of bytes received and rejected
-        unsigned int queued_bytes; //! count of bytes currently queued in the driver's internal buffer
+	uint64_t tx; //! count of bytes sent
+	uint64_t good_rx; //! count of bytes received and accepted
+	uint64_t bad_rx; //! count of bytes received and rejected
+	uint64_t tx_packets; //! count of packets sent
+	uint64_t rx_packets; //! count of packets received and accepted
+        uint64_t queued_bytes; //! count of bytes currently queued in the driver's internal buffer
 
 	Status()
-	    : tx(0), good_rx(0), bad_rx(0), queued_bytes(0) {}
+	    : tx(0), good_rx(0), bad_rx(0)
+	    , tx_packets(0), rx_packets(0), queued_bytes(0) {}
     };
 }
 
 #endif
-
@@ -0,0 +1,130 @@
+#include <iodrivers_base/StatusCounters.hpp>
+
+#include <thread>
+
+using namespace std;
+using namespace iodrivers_base;
+
+StatusCounters::StatusCounters()
+    : m_auto_stamp(true)
+    , m_sequence(0)
+    , m_stamp(0)
+    , m_tx(0)
+    , m_good_rx(0)
+    , m_bad_rx(0)
+    , m_tx_packets(0)
+    , m_rx_packets(0)
+    , m_queued_bytes(0)
+{
+}
+
+void StatusCounters::beginUpdate()
+{
+    m_sequence.store(m_sequence.load(memory_order_relaxed) + 1,
+                     memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void StatusCounters::endUpdate(bool stamp)
+{
+    if (stamp && m_auto_stamp) {
+        m_stamp.store(base::Time::now().toMicroseconds(),
+                      memory_order_relaxed);
+    }
+    m_sequence.store(m_sequence.load(memory_order_relaxed) + 1,
+                     memory_order_release);
+}
+
+void StatusCounters::add(atomic<uint64_t>& counter, uint64_t value)
+{
+    // There is a single writer, no need for a read-modify-write operation
+    counter.store(counter.load(memory_order_relaxed) + value,
+                  memory_order_relaxed);
+}
+
+void StatusCounters::addTx(uint64_t bytes, uint64_t packets)
+{
+    beginUpdate();
+    add(m_tx, bytes);
+    add(m_tx_packets, packets);
+    endUpdate();
+}
+
+void StatusCounters::addRx(uint64_t good, uint64_t bad, uint64_t packets)
+{
+    if (!good && !bad)
+        return;
+
+    beginUpdate();
+    if (good) {
+        add(m_good_rx, good);
+        add(m_rx_packets, packets);
+    }
+    add(m_bad_rx, bad);
+    endUpdate();
+}
+
+void StatusCounters::setQueuedBytes(uint64_t bytes)
+{
+    if (m_queued_bytes.load(memory_order_relaxed) == bytes)
+        return;
+
+    beginUpdate();
+    m_queued_bytes.store(bytes, memory_order_relaxed);
+    endUpdate(false);
+}
+
+void StatusCounters::setAutoStamp(bool enable)
+{
+    m_auto_stamp = enable;
+}
+
+bool StatusCounters::getAutoStamp() const
+{
+    return m_auto_stamp;
+}
+
+void StatusCounters::setStamp(base::Time const& time)
+{
+    beginUpdate();
+    m_stamp.store(time.toMicroseconds(), memory_order_relaxed);
+    endUpdate(false);
+}
+
+void StatusCounters::reset()
+{
+    beginUpdate();
+    m_stamp.store(0, memory_order_relaxed);
+    m_tx.store(0, memory_order_relaxed);
+    m_good_rx.store(0, memory_order_relaxed);
+    m_bad_rx.store(0, memory_order_relaxed);
+    m_tx_packets.store(0, memory_order_relaxed);
+    m_rx_packets.store(0, memory_order_relaxed);
+    endUpdate(false);
+}
+
+Status StatusCounters::snapshot() const
+{
+    Status result;
+    while (true) {
+        uint64_t sequence = m_sequence.load(memory_order_acquire);
+        if (sequence & 1) {
+            this_thread::yield();
+            continue;
+        }
+
+        int64_t stamp = m_stamp.load(memory_order_relaxed);
+        result.tx = m_tx.load(memory_order_relaxed);
+        result.good_rx = m_good_rx.load(memory_order_relaxed);
+        result.bad_rx = m_bad_rx.load(memory_order_relaxed);
+        result.tx_packets = m_tx_packets.load(memory_order_relaxed);
+        result.rx_packets = m_rx_packets.load(memory_order_relaxed);
+        result.queued_bytes = m_queued_bytes.load(memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (m_sequence.load(memory_order_relaxed) == sequence) {
+            result.stamp = base::Time::fromMicroseconds(stamp);
+            return result;
+        }
+    }
+}
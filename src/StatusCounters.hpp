@@ -0,0 +1,84 @@
+#ifndef IODRIVERS_BASE_STATUS_COUNTERS_HPP
+#define IODRIVERS_BASE_STATUS_COUNTERS_HPP
+
+#include <iodrivers_base/Status.hpp>
+
+#include <atomic>
+
+namespace iodrivers_base {
+    /** Storage for the I/O statistics of a driver
+     *
+     * The counters are updated by the thread that does the I/O and can be
+     * read from any other thread with snapshot(), without locking. It is a
+     * sequence lock: an update costs a few plain stores, and snapshot()
+     * retries if an update happened while it was reading.
+     *
+     * Only one thread may update the counters at a given time.
+     */
+    class StatusCounters
+    {
+    public:
+        StatusCounters();
+
+        /** Counts sent bytes
+         *
+         * @param packets the number of packets these bytes completed
+         */
+        void addTx(uint64_t bytes, uint64_t packets = 1);
+
+        /** Counts received bytes
+         *
+         * @param good bytes that belong to accepted packets
+         * @param bad bytes that have been rejected
+         * @param packets the number of packets the good bytes belong to. It
+         *   is only counted if good is non-zero
+         */
+        void addRx(uint64_t good, uint64_t bad, uint64_t packets = 1);
+
+        /** Updates the number of bytes queued in the driver's buffer */
+        void setQueuedBytes(uint64_t bytes);
+
+        /** Sets whether the counter updates also set the stamp to the
+         * current time
+         *
+         * This is the default. Disable it to set the stamp explicitly with
+         * setStamp instead, which avoids a clock read per update
+         */
+        void setAutoStamp(bool enable);
+
+        /** Whether the counter updates set the stamp
+         *
+         * @see setAutoStamp
+         */
+        bool getAutoStamp() const;
+
+        /** Explicitly sets the stamp */
+        void setStamp(base::Time const& time);
+
+        /** Sets all the counters back to zero, except queued_bytes */
+        void reset();
+
+        /** Returns a consistent copy of the counters
+         *
+         * It is safe to call from any thread
+         */
+        Status snapshot() const;
+
+    private:
+        void beginUpdate();
+        void endUpdate(bool stamp = true);
+        static void add(std::atomic<uint64_t>& counter, uint64_t value);
+
+        bool m_auto_stamp;
+        std::atomic<uint64_t> m_sequence;
+        std::atomic<int64_t> m_stamp;
+        std::atomic<uint64_t> m_tx;
+        std::atomic<uint64_t> m_good_rx;
+        std::atomic<uint64_t> m_bad_rx;
+        std::atomic<uint64_t> m_tx_packets;
+        std::atomic<uint64_t> m_rx_packets;
+        std::atomic<uint64_t> m_queued_bytes;
+    };
+}
+
+#endif
@@ -1,14 +1,23 @@
 #include <iodrivers_base/Timeout.hpp>
 
+#include <time.h>
+
 using namespace iodrivers_base;
 
 Timeout::Timeout(unsigned int timeout)
-    : timeout(timeout) {
-    gettimeofday(&start_time, 0);
+    : timeout(timeout)
+    , start_time(now()) {
+}
+
+base::Time Timeout::now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return base::Time::fromMicroseconds(
+        static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
 }
 
 void Timeout::restart() {
-    gettimeofday(&start_time, 0);
+    start_time = now();
 }
 
 bool Timeout::elapsed() const
@@ -18,12 +27,7 @@ bool Timeout::elapsed() const
 
 bool Timeout::elapsed(unsigned int timeout) const
 {
-    timeval current_time;
-    gettimeofday(&current_time, 0);
-    unsigned int elapsed =
-	(current_time.tv_sec - start_time.tv_sec) * 1000
-	+ (static_cast<int>(current_time.tv_usec) -
-	   static_cast<int>(start_time.tv_usec)) / 1000;
+    int64_t elapsed = (now() - start_time).toMilliseconds();
     return timeout < elapsed;
 }
 
@@ -34,16 +38,9 @@ unsigned int Timeout::timeLeft() const
 
 unsigned int Timeout::timeLeft(unsigned int timeout) const
 {
-    timeval current_time;
-    gettimeofday(&current_time, 0);
-    int elapsed =
-	(current_time.tv_sec - start_time.tv_sec) * 1000
-	+ (static_cast<int>(current_time.tv_usec) -
-	   static_cast<int>(start_time.tv_usec)) / 1000;
-    if ((int)timeout < elapsed)
+    int64_t elapsed = (now() - start_time).toMilliseconds();
+    if (timeout < elapsed)
 	return 0;
     return timeout - elapsed;
 }
 
-
-
@@ -1,16 +1,19 @@
 #ifndef IODRIVERS_BASE_TIMEOUT_HPP
 #define IODRIVERS_BASE_TIMEOUT_HPP
 
-#include <sys/time.h>
+#include <base/Time.hpp>
 
 namespace iodrivers_base {
 
 /** A timeout tracking class
+ *
+ * It is based on a monotonic clock, and is therefore not affected by
+ * changes of the system time
  */
 class Timeout {
 private:
     unsigned int timeout;
-    timeval start_time;
+    base::Time start_time;
 
 public:
     /**
@@ -19,6 +22,15 @@ public:
      */
     Timeout(unsigned int timeout = 0);
 
+    /**
+     * Current time of the monotonic clock used for timeouts
+     *
+     * Unlike base::Time::now(), it does not jump when the system time is
+     * changed (e.g. by NTP). Use it to compute deadlines and durations, not
+     * as a timestamp.
+     */
+    static base::Time now();
+
     /**
      * Restarts the timeout
      */
@@ -26,14 +38,14 @@ public:
 
     /**
      * Checks if the timeout is already elapsed.
-     * This uses a syscall, so use sparingly and cache results
+     * This reads the clock, so use sparingly and cache results
      * @returns  true if the timeout is elapsed
      */
     bool elapsed() const;
 
     /**
      * Checks if the timeout is already elapsed.
-     * This uses a syscall, so use sparingly and cache results
+     * This reads the clock, so use sparingly and cache results
      * @param timeout  a custom timeout
      * @returns  true if the timeout is elapsed
      */
@@ -41,14 +53,14 @@ public:
 
     /**
      * Calculates the time left for this timeout
-     * This uses a syscall, so use sparingly and cache results
+     * This reads the clock, so use sparingly and cache results
      * @returns  number of milliseconds this timeout as left
      */
     unsigned int timeLeft() const;
 
     /**
      * Calculates the time left for this timeout
-     * This uses a syscall, so use sparingly and cache results
+     * This reads the clock, so use sparingly and cache results
      * @param timeout  a custom timeout
      * @returns  number of milliseconds this timeout as left
      */
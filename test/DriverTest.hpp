@@ -0,0 +1,66 @@
+#ifndef IODRIVERS_BASE_TEST_DRIVERTEST_HPP
+#define IODRIVERS_BASE_TEST_DRIVERTEST_HPP
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdexcept>
+#include <unistd.h>
+
+#include <iodrivers_base/Driver.hpp>
+
+/** Driver used by the tests
+ *
+ * Its packets are 4 bytes long and start and end with a zero byte
+ */
+class DriverTest : public iodrivers_base::Driver
+{
+public:
+    DriverTest()
+        : iodrivers_base::Driver(100) {}
+
+    int extractPacket(uint8_t const* buffer, size_t buffer_size) const
+    {
+        if (buffer[0] != 0)
+            return -1;
+        else if (buffer_size < 4)
+            return 0;
+        else if (buffer[3] == 0)
+            return 4;
+        else
+            return -4;
+    }
+};
+
+/** A pipe the tests use to feed data to a driver
+ *
+ * The read end is meant to be handed over to a driver or stream, so only
+ * the write end is closed on destruction. Set tx to -1 after closing it
+ */
+struct TestPipe
+{
+    int rx = -1;
+    int tx = -1;
+
+    TestPipe()
+    {
+        int pipes[2];
+        BOOST_REQUIRE(pipe(pipes) == 0);
+        rx = pipes[0];
+        tx = pipes[1];
+    }
+
+    ~TestPipe()
+    {
+        if (tx != -1)
+            close(tx);
+    }
+
+    void write(void const* data, int size)
+    {
+        if (::write(tx, data, size) != size) {
+            throw std::runtime_error("failed writing the test data");
+        }
+    }
+};
+
+#endif
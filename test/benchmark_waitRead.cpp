@@ -0,0 +1,72 @@
+#include <iodrivers_base/IOStream.hpp>
+#include <iostream>
+#include <sys/select.h>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace iodrivers_base;
+
+/** Measures the per-call cost of FDStream::waitRead, compared with the
+ * select()-based implementation it replaced
+ */
+
+static const int ITERATIONS = 1000000;
+
+static bool selectWaitRead(int fd, base::Time const& timeout)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+
+    timeval timeout_spec = { static_cast<time_t>(timeout.toSeconds()), suseconds_t(timeout.toMicroseconds() % 1000000)};
+    return select(fd + 1, &set, NULL, NULL, &timeout_spec) > 0;
+}
+
+static void report(string const& name, base::Time const& start)
+{
+    base::Time duration = base::Time::now() - start;
+    cout << name << ": "
+         << static_cast<double>(duration.toMicroseconds()) * 1000 / ITERATIONS
+         << " ns/call" << endl;
+}
+
+int main(int argc, char const* const* argv)
+{
+    int fd = argc > 1 ? atoi(argv[1]) : 3;
+    int pipes[2];
+    if (pipe(pipes) != 0) {
+        cerr << "failed to create pipe" << endl;
+        return 1;
+    }
+
+    // Use a file descriptor that is still valid for select() so that both
+    // can be compared
+    if (fd >= FD_SETSIZE) {
+        cerr << "fd must be lower than FD_SETSIZE=" << FD_SETSIZE << endl;
+        return 1;
+    }
+    if (pipes[0] != fd) {
+        dup2(pipes[0], fd);
+        close(pipes[0]);
+    }
+    if (write(pipes[1], "a", 1) != 1) {
+        cerr << "failed to write to pipe" << endl;
+        return 1;
+    }
+
+    FDStream stream(fd, true);
+    cout << "waiting on fd=" << fd << ", " << ITERATIONS << " iterations" << endl;
+
+    base::Time start = base::Time::now();
+    for (int i = 0; i < ITERATIONS; ++i)
+        selectWaitRead(fd, base::Time());
+    report("select", start);
+
+    start = base::Time::now();
+    for (int i = 0; i < ITERATIONS; ++i)
+        stream.waitRead(base::Time());
+    report("FDStream::waitRead", start);
+
+    close(pipes[1]);
+    return 0;
+}
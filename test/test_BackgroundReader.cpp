@@ -0,0 +1,143 @@
+#include <boost/test/unit_test.hpp>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+
+#include <iodrivers_base/BackgroundReader.hpp>
+#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/IOStream.hpp>
+
+#include "DriverTest.hpp"
+
+using namespace std;
+using namespace iodrivers_base;
+
+struct BackgroundReaderFixture : TestPipe {
+    DriverTest driver;
+
+    BackgroundReaderFixture() {
+        driver.setFileDescriptor(rx);
+    }
+
+    /** Waits until the reader has at least the given number of packets */
+    void waitForPackets(BackgroundReader& reader, size_t count) {
+        base::Time deadline = base::Time::now() + base::Time::fromSeconds(1);
+        while (reader.size() < count && base::Time::now() < deadline) {
+            usleep(1000);
+        }
+        BOOST_REQUIRE_EQUAL(count, reader.size());
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(BackgroundReaderSuite, BackgroundReaderFixture)
+
+BOOST_AUTO_TEST_CASE(it_returns_an_empty_view_if_no_packets_are_available)
+{
+    BackgroundReader reader(driver);
+    BOOST_REQUIRE_EQUAL(0, reader.front().size);
+    reader.pop();
+    BOOST_REQUIRE_EQUAL(0, reader.size());
+}
+
+BOOST_AUTO_TEST_CASE(it_queues_the_packets_read_in_the_background)
+{
+    BackgroundReader reader(driver);
+    reader.setPollPeriod(base::Time::fromMilliseconds(10));
+    reader.start();
+
+    uint8_t msg[] = { 0, 'a', 'b', 0, 1, 0, 'c', 'd', 0 };
+    write(msg, 9);
+    waitForPackets(reader, 2);
+    reader.stop();
+
+    PacketView packet = reader.front();
+    BOOST_REQUIRE_EQUAL(4, packet.size);
+    BOOST_REQUIRE(!memcmp(msg, packet.data, 4));
+    reader.pop();
+    packet = reader.front();
+    BOOST_REQUIRE_EQUAL(4, packet.size);
+    BOOST_REQUIRE(!memcmp(msg + 5, packet.data, 4));
+    reader.pop();
+    BOOST_REQUIRE_EQUAL(0, reader.size());
+}
+
+BOOST_AUTO_TEST_CASE(it_drops_packets_when_the_ring_is_full)
+{
+    BackgroundReader reader(driver, 2);
+    reader.setPollPeriod(base::Time::fromMilliseconds(10));
+    reader.start();
+
+    uint8_t msg[] = { 0, 'a', 'b', 0 };
+    for (int i = 0; i < 3; ++i)
+        write(msg, 4);
+
+    base::Time deadline = base::Time::now() + base::Time::fromSeconds(1);
+    while (reader.getDroppedCount() == 0 && base::Time::now() < deadline) {
+        usleep(1000);
+    }
+    reader.stop();
+    BOOST_REQUIRE_EQUAL(2, reader.size());
+    BOOST_REQUIRE_EQUAL(1, reader.getDroppedCount());
+}
+
+BOOST_AUTO_TEST_CASE(it_stops_by_itself_at_end_of_file)
+{
+    BackgroundReader reader(driver);
+    int rx = driver.getFileDescriptor();
+    dynamic_cast<FDStream&>(*driver.getMainStream()).setAutoClose(false);
+    driver.setFileDescriptor(rx, true, true);
+    reader.setPollPeriod(base::Time::fromMilliseconds(10));
+    reader.start();
+
+    close(tx);
+    tx = -1;
+    base::Time deadline = base::Time::now() + base::Time::fromSeconds(1);
+    while (reader.isRunning() && base::Time::now() < deadline) {
+        usleep(1000);
+    }
+    BOOST_REQUIRE(!reader.isRunning());
+    reader.stop();
+}
+
+BOOST_AUTO_TEST_CASE(it_pins_the_reader_thread)
+{
+    BackgroundReader reader(driver);
+    reader.setPollPeriod(base::Time::fromMilliseconds(10));
+    reader.start(0);
+    BOOST_REQUIRE(reader.isRunning());
+    reader.stop();
+}
+
+BOOST_AUTO_TEST_CASE(it_does_not_read_if_the_reader_thread_cannot_be_pinned)
+{
+    uint8_t msg[] = { 0, 1, 2, 0 };
+    write(msg, 4);
+
+    // Valid for cpu_set_t, but there is no such CPU
+    BackgroundReader reader(driver);
+    BOOST_REQUIRE_THROW(reader.start(CPU_SETSIZE - 1), UnixError);
+    BOOST_REQUIRE(!reader.isRunning());
+    BOOST_REQUIRE_EQUAL(0, reader.size());
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, driver.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_cpu_indexes_out_of_range)
+{
+    BackgroundReader reader(driver);
+    BOOST_REQUIRE_THROW(reader.start(CPU_SETSIZE), std::invalid_argument);
+    BOOST_REQUIRE(!reader.isRunning());
+}
+
+BOOST_AUTO_TEST_CASE(it_refuses_to_start_twice)
+{
+    BackgroundReader reader(driver);
+    reader.setPollPeriod(base::Time::fromMilliseconds(10));
+    reader.start();
+    BOOST_REQUIRE_THROW(reader.start(), std::logic_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
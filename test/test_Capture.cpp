@@ -0,0 +1,248 @@
+#include <boost/test/unit_test.hpp>
+
+#include <iodrivers_base/Capture.hpp>
+#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/TestStream.hpp>
+
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+using namespace iodrivers_base;
+using namespace iodrivers_base::capture;
+
+BOOST_AUTO_TEST_SUITE(CaptureSuite)
+
+struct Driver : iodrivers_base::Driver
+{
+    Driver()
+        : iodrivers_base::Driver(100) {}
+
+    int extractPacket(uint8_t const* buffer, size_t size) const
+    {
+        return size;
+    }
+};
+
+struct Record
+{
+    uint64_t time;
+    Direction direction;
+    vector<uint8_t> data;
+};
+
+struct CaptureFixture
+{
+    string path;
+
+    CaptureFixture()
+    {
+        char path_template[] = "/tmp/iodrivers_base_capture_XXXXXX";
+        int fd = mkstemp(path_template);
+        if (fd == -1)
+            throw UnixError("cannot create temporary file");
+        close(fd);
+        path = path_template;
+    }
+
+    ~CaptureFixture()
+    {
+        unlink(path.c_str());
+    }
+
+    vector<uint8_t> readFile()
+    {
+        ifstream file(path, ios::binary);
+        return vector<uint8_t>(istreambuf_iterator<char>(file),
+                               istreambuf_iterator<char>());
+    }
+
+    vector<Record> readRecords()
+    {
+        vector<uint8_t> data = readFile();
+        BOOST_REQUIRE(data.size() >= sizeof(FileHeader));
+        BOOST_REQUIRE(equal(MAGIC, MAGIC + sizeof(MAGIC), data.begin()));
+
+        vector<Record> records;
+        size_t pos = sizeof(FileHeader);
+        while (pos < data.size()) {
+            RecordHeader header;
+            BOOST_REQUIRE(pos + sizeof(header) <= data.size());
+            memcpy(&header, &data[pos], sizeof(header));
+            pos += sizeof(header);
+            BOOST_REQUIRE(pos + header.size <= data.size());
+
+            Record record;
+            record.time = header.time;
+            record.direction = static_cast<Direction>(header.direction);
+            record.data = vector<uint8_t>(&data[pos], &data[pos] + header.size);
+            records.push_back(record);
+            pos += header.size;
+        }
+        return records;
+    }
+
+    /** Creates a capture file with the given records */
+    void writeCapture(vector<Record> const& records)
+    {
+        ofstream file(path, ios::binary | ios::trunc);
+        FileHeader file_header;
+        memcpy(file_header.magic, MAGIC, sizeof(MAGIC));
+        file_header.version = VERSION;
+        file_header.start_time = 42;
+        file.write(reinterpret_cast<char const*>(&file_header), sizeof(file_header));
+        for (auto const& record : records) {
+            RecordHeader header;
+            memset(&header, 0, sizeof(header));
+            header.time = record.time;
+            header.size = record.data.size();
+            header.direction = record.direction;
+            file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            file.write(reinterpret_cast<char const*>(record.data.data()),
+                       record.data.size());
+        }
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(it_captures_the_driver_data_with_its_direction, CaptureFixture)
+{
+    Driver driver;
+    driver.openURI("test://");
+    CaptureListener* listener = new CaptureListener(path);
+    driver.addListener(listener);
+
+    uint8_t written[] = { 1, 2, 3 };
+    driver.writePacket(written, 3);
+    static_cast<TestStream*>(driver.getMainStream())->pushDataToDriver({ 4, 5 });
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(2, driver.readPacket(buffer, 100));
+    listener->flush();
+
+    vector<Record> records = readRecords();
+    BOOST_REQUIRE_EQUAL(2, records.size());
+    BOOST_TEST(records[0].direction == DIRECTION_WRITE);
+    BOOST_TEST(records[0].data == vector<uint8_t>({ 1, 2, 3 }));
+    BOOST_TEST(records[1].direction == DIRECTION_READ);
+    BOOST_TEST(records[1].data == vector<uint8_t>({ 4, 5 }));
+    BOOST_TEST(records[0].time <= records[1].time);
+}
+
+BOOST_FIXTURE_TEST_CASE(it_writes_the_remaining_data_on_destruction, CaptureFixture)
+{
+    {
+        CaptureListener listener(path);
+        uint8_t data[] = { 1, 2 };
+        listener.readData(data, 2);
+    }
+
+    vector<Record> records = readRecords();
+    BOOST_REQUIRE_EQUAL(1, records.size());
+    BOOST_TEST(records[0].data == vector<uint8_t>({ 1, 2 }));
+}
+
+BOOST_FIXTURE_TEST_CASE(it_drops_and_counts_the_data_that_does_not_fit_in_the_buffer,
+                        CaptureFixture)
+{
+    CaptureListener listener(path, sizeof(RecordHeader) + 10);
+    uint8_t data[20] = { 0 };
+    listener.readData(data, 11);
+    listener.readData(data, 10);
+    listener.flush();
+
+    BOOST_TEST(listener.getDroppedBytes() == 11);
+    vector<Record> records = readRecords();
+    BOOST_REQUIRE_EQUAL(1, records.size());
+    BOOST_TEST(records[0].data.size() == 10);
+}
+
+BOOST_FIXTURE_TEST_CASE(it_replays_the_read_records_only, CaptureFixture)
+{
+    writeCapture({
+        { 0, DIRECTION_READ, { 1, 2 } },
+        { 10, DIRECTION_WRITE, { 3 } },
+        { 20, DIRECTION_READ, { 4, 5, 6 } }
+    });
+
+    ReplayStream stream(path, false);
+    BOOST_TEST(stream.getCaptureStartTime() == base::Time::fromMicroseconds(42));
+    uint8_t buffer[100];
+    BOOST_REQUIRE(stream.waitRead(base::Time()));
+    BOOST_REQUIRE_EQUAL(2, stream.read(buffer, 100));
+    BOOST_TEST(vector<uint8_t>(buffer, buffer + 2) == vector<uint8_t>({ 1, 2 }));
+    BOOST_REQUIRE_EQUAL(2, stream.read(buffer, 2));
+    BOOST_TEST(vector<uint8_t>(buffer, buffer + 2) == vector<uint8_t>({ 4, 5 }));
+    BOOST_REQUIRE_EQUAL(1, stream.read(buffer, 100));
+    BOOST_TEST(buffer[0] == 6);
+
+    BOOST_TEST(!stream.eof());
+    BOOST_REQUIRE_EQUAL(0, stream.read(buffer, 100));
+    BOOST_TEST(stream.eof());
+}
+
+BOOST_FIXTURE_TEST_CASE(it_replays_the_reads_at_their_original_timing, CaptureFixture)
+{
+    writeCapture({
+        { 1000000, DIRECTION_READ, { 1 } },
+        { 201000000, DIRECTION_READ, { 2 } }
+    });
+
+    ReplayStream stream(path, true);
+    uint8_t buffer[100];
+    BOOST_REQUIRE(stream.waitRead(base::Time()));
+    BOOST_REQUIRE_EQUAL(1, stream.read(buffer, 100));
+
+    base::Time start = base::Time::now();
+    BOOST_TEST(!stream.waitRead(base::Time::fromMilliseconds(50)));
+    BOOST_REQUIRE_EQUAL(0, stream.read(buffer, 100));
+    BOOST_REQUIRE(stream.waitRead(base::Time::fromSeconds(1)));
+    base::Time elapsed = base::Time::now() - start;
+    BOOST_TEST(elapsed.toMilliseconds() >= 190);
+    BOOST_TEST(elapsed.toMilliseconds() < 500);
+    BOOST_REQUIRE_EQUAL(1, stream.read(buffer, 100));
+    BOOST_TEST(buffer[0] == 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(it_ignores_a_truncated_last_record, CaptureFixture)
+{
+    writeCapture({
+        { 0, DIRECTION_READ, { 1, 2 } },
+        { 0, DIRECTION_READ, { 3, 4 } }
+    });
+    truncate(path.c_str(), readFile().size() - 1);
+
+    ReplayStream stream(path, false);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(2, stream.read(buffer, 100));
+    BOOST_REQUIRE_EQUAL(0, stream.read(buffer, 100));
+    BOOST_TEST(stream.eof());
+}
+
+BOOST_FIXTURE_TEST_CASE(it_rejects_files_that_are_not_captures, CaptureFixture)
+{
+    ofstream(path) << "not a capture file";
+    BOOST_REQUIRE_THROW(ReplayStream(path, false), invalid_argument);
+}
+
+BOOST_FIXTURE_TEST_CASE(it_feeds_a_capture_back_into_a_driver, CaptureFixture)
+{
+    {
+        Driver driver;
+        driver.openURI("test://");
+        driver.addListener(new CaptureListener(path));
+        static_cast<TestStream*>(driver.getMainStream())->pushDataToDriver({ 1, 2 });
+        uint8_t buffer[100];
+        driver.readPacket(buffer, 100);
+        static_cast<TestStream*>(driver.getMainStream())->pushDataToDriver({ 3 });
+        driver.readPacket(buffer, 100);
+    }
+
+    Driver driver;
+    driver.openURI("replay://" + path + "?realtime=0");
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(2, driver.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(1, driver.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_TEST(buffer[0] == 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
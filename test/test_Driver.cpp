@@ -5,37 +5,23 @@
 #include <iostream>
 #include <netinet/in.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <thread>
 
 #include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/IOListener.hpp>
 #include <iodrivers_base/IOStream.hpp>
 
+#include "DriverTest.hpp"
+
 using namespace std;
 using base::Time;
 using namespace iodrivers_base;
 
-class DriverTest : public Driver
-{
-public:
-    DriverTest()
-        : Driver(100) {}
-
-    int extractPacket(uint8_t const* buffer, size_t buffer_size) const
-    {
-        if (buffer[0] != 0)
-            return -1;
-        else if (buffer_size < 4)
-            return 0;
-        else if (buffer[3] == 0)
-            return 4;
-        else
-            return -4;
-    }
-};
-
 int setupDriver(Driver& driver)
 {
     int pipes[2];
@@ -106,6 +92,37 @@ BOOST_AUTO_TEST_CASE(it_auto_closes_by_default)
     close(fds[1]);
 }
 
+BOOST_AUTO_TEST_CASE(it_handles_file_descriptors_above_FD_SETSIZE)
+{
+    int const high_fd = FD_SETSIZE + 10;
+    rlimit limit;
+    BOOST_REQUIRE(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    if (limit.rlim_cur <= static_cast<rlim_t>(high_fd)) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, high_fd + 1);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        BOOST_REQUIRE(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    }
+    if (limit.rlim_cur <= static_cast<rlim_t>(high_fd)) {
+        BOOST_TEST_MESSAGE("cannot open enough file descriptors, skipping");
+        return;
+    }
+
+    int pipes[2];
+    BOOST_REQUIRE(pipe(pipes) == 0);
+    FileGuard tx_guard(pipes[1]);
+    BOOST_REQUIRE_EQUAL(high_fd, dup2(pipes[0], high_fd));
+    close(pipes[0]);
+
+    DriverTest test;
+    test.setFileDescriptor(high_fd);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_THROW(test.readPacket(buffer, 100, 10), TimeoutError);
+
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, pipes[1], msg, 4);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+}
+
 BOOST_AUTO_TEST_CASE(it_does_not_auto_close_if_configured)
 {
     int fds[2];
@@ -297,101 +314,960 @@ void common_rx_garbage_removal(Driver& test, int tx)
     BOOST_REQUIRE_EQUAL(8, test.getStats().bad_rx);
     BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
 }
-BOOST_AUTO_TEST_CASE(test_rx_garbage_removal)
+BOOST_AUTO_TEST_CASE(test_rx_garbage_removal)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+    common_rx_garbage_removal(test, tx);
+}
+
+void common_rx_packet_extraction_mode(Driver& test, int tx)
+{
+    uint8_t buffer[100];
+    uint8_t msg[16] = { 'g', 'a', 'r', 'b', 0, 'a', 'b', 0, 'b', 'a', 'g', 'e', 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 16);
+    test.setExtractLastPacket(false);
+
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
+    BOOST_REQUIRE_EQUAL(4, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(4, test.getStats().bad_rx);
+    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
+    BOOST_REQUIRE_EQUAL(8, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(8, test.getStats().bad_rx);
+    BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(8, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(8, test.getStats().bad_rx);
+
+    writeToDriver(test, tx, msg, 16);
+    test.setExtractLastPacket(true);
+
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
+    // 16 bytes: even though one package has not been returned, it should still
+    // be counted
+    BOOST_REQUIRE_EQUAL(16, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(16, test.getStats().bad_rx);
+    BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
+
+    writeToDriver(test, tx, msg, 16);
+    test.setExtractLastPacket(false);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
+    BOOST_REQUIRE_EQUAL(20, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(20, test.getStats().bad_rx);
+    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+    writeToDriver(test, tx, msg, 14);
+    // We have now one packet from the first write and one packet from the 2nd
+    // write. We should get the packet from the second write
+    test.setExtractLastPacket(true);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
+    BOOST_REQUIRE_EQUAL(28, test.getStats().good_rx);
+    // The garbage after the returned packet is only counted once it gets
+    // consumed
+    BOOST_REQUIRE_EQUAL(28, test.getStats().bad_rx);
+    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+
+    if (test.isValid())
+    {
+        // The garbage that was at the end of the second write should have been
+        // removed as well
+        BOOST_REQUIRE_EQUAL(-1, read(test.getFileDescriptor(), buffer, 1));
+        BOOST_REQUIRE_EQUAL(EAGAIN, errno);
+        writeToDriver(test, tx, msg + 14, 2);
+        BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+        BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
+        BOOST_REQUIRE_EQUAL(32, test.getStats().good_rx);
+        BOOST_REQUIRE_EQUAL(32, test.getStats().bad_rx);
+    }
+}
+BOOST_AUTO_TEST_CASE(test_rx_packet_extraction_mode)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+    common_rx_packet_extraction_mode(test, tx);
+}
+
+BOOST_AUTO_TEST_CASE(test_hasPacket_returns_false_on_empty_internal_buffer)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+    BOOST_REQUIRE(!test.hasPacket());
+}
+
+BOOST_AUTO_TEST_CASE(test_hasPacket_returns_false_on_internal_buffer_with_garbage)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+    writeToDriver(test, tx, reinterpret_cast<uint8_t const*>("12\x0  \x0 3"), 8);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10, 1));
+    BOOST_REQUIRE(!test.hasPacket());
+}
+
+BOOST_AUTO_TEST_CASE(test_rx_extracts_packets_across_internal_buffer_compaction)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    // Fill most of the internal buffer, leaving an incomplete packet at the end
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    for (int i = 0; i < 24; ++i)
+        writeToDriver(test, tx, msg, 4);
+    uint8_t partial[4] = { 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, partial, 2);
+
+    uint8_t buffer[100];
+    for (int i = 0; i < 24; ++i) {
+        BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+        BOOST_REQUIRE( !memcmp(msg, buffer, 4) );
+    }
+
+    writeToDriver(test, tx, partial + 2, 2);
+    writeToDriver(test, tx, msg, 4);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE( !memcmp(partial, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE( !memcmp(msg, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(26 * 4, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(0, test.getStats().bad_rx);
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_buffer_can_be_bigger_than_MAX_PACKET_SIZE)
+{
+    DriverTest test;
+    test.setReceiveBufferSize(400);
+    BOOST_REQUIRE_EQUAL(400, test.getReceiveBufferSize());
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    for (int i = 0; i < 50; ++i)
+        writeToDriver(test, tx, msg, 4);
+
+    PacketView packets[100];
+    BOOST_REQUIRE_EQUAL(50, test.readPackets(packets, 100));
+}
+
+BOOST_AUTO_TEST_CASE(test_setReceiveBufferSize_keeps_the_buffered_data)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[8] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 6);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+
+    test.setReceiveBufferSize(200);
+    writeToDriver(test, tx, msg + 6, 2);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+}
+
+BOOST_AUTO_TEST_CASE(test_setReceiveBufferSize_rejects_sizes_smaller_than_MAX_PACKET_SIZE)
+{
+    DriverTest test;
+    BOOST_REQUIRE_THROW(test.setReceiveBufferSize(99), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_driver_receives_data_in_an_external_buffer)
+{
+    DriverTest test;
+    uint8_t external[200];
+    test.setReceiveBuffer(external, 200);
+    BOOST_REQUIRE_EQUAL(200, test.getReceiveBufferSize());
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 4);
+    PacketView packet = test.readPacketView(base::Time::fromMilliseconds(10));
+    BOOST_REQUIRE(packet.data >= external && packet.data < external + 200);
+    BOOST_REQUIRE( !memcmp(msg, packet.data, 4) );
+}
+
+BOOST_AUTO_TEST_CASE(test_driver_locks_its_receive_buffer)
+{
+    DriverTest test;
+    test.setReceiveBufferLocked(true);
+    BOOST_REQUIRE(test.isReceiveBufferLocked());
+    test.setReceiveBufferSize(400);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 4);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    test.setReceiveBufferLocked(false);
+    BOOST_REQUIRE(!test.isReceiveBufferLocked());
+}
+
+BOOST_AUTO_TEST_CASE(test_readPacketView_returns_the_packet_in_place)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[12] = { 'g', 0, 'a', 'b', 0, 0, 'c', 'd', 0, 0, 'e', 'f' };
+    writeToDriver(test, tx, msg, 12);
+
+    PacketView view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(msg + 1, view.data, 4) );
+    BOOST_REQUIRE_EQUAL(4, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(1, test.getStats().bad_rx);
+
+    view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(msg + 5, view.data, 4) );
+
+    BOOST_REQUIRE_THROW(test.readPacketView(Time::fromMilliseconds(10)), TimeoutError);
+    writeToDriver(test, tx, msg + 4, 1);
+    view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(msg + 9, view.data, 3) );
+    BOOST_REQUIRE_EQUAL(12, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(1, test.getStats().bad_rx);
+}
+
+BOOST_AUTO_TEST_CASE(test_readPacketView_packet_is_removed_by_releasePacket)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[8] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 8);
+
+    PacketView view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE( !memcmp(msg, view.data, 4) );
+    BOOST_REQUIRE(test.hasPacket());
+    test.releasePacket();
+    BOOST_REQUIRE(test.hasPacket());
+    test.releasePacket();
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
+    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+    BOOST_REQUIRE(!test.hasPacket());
+}
+
+BOOST_AUTO_TEST_CASE(test_readPacketView_returns_the_last_packet_in_extract_last_mode)
+{
+    DriverTest test;
+    test.setExtractLastPacket(true);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[16] = { 'g', 'a', 'r', 'b', 0, 'a', 'b', 0, 'b', 'a', 'g', 'e', 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 14);
+    PacketView view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(msg + 4, view.data, 4) );
+
+    writeToDriver(test, tx, msg + 14, 2);
+    view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(msg + 12, view.data, 4) );
+    BOOST_REQUIRE_EQUAL(8, test.getStats().good_rx);
+}
+
+BOOST_AUTO_TEST_CASE(test_readPacketView_removes_garbage_after_the_last_packet_in_extract_last_mode)
+{
+    DriverTest test;
+    test.setExtractLastPacket(true);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    // 102 bytes, i.e. more than what the internal buffer can hold. The first
+    // read gets the packets and the garbage, the second the partial packet
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    for (int i = 0; i < 24; ++i)
+        writeToDriver(test, tx, msg, 4);
+    uint8_t partial[8] = { 'g', 'g', 'g', 'g', 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, partial, 6);
+
+    PacketView view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(msg, view.data, 4) );
+
+    writeToDriver(test, tx, partial + 6, 2);
+    view = test.readPacketView(Time::fromMilliseconds(10));
+    BOOST_REQUIRE_EQUAL(4, view.size);
+    BOOST_REQUIRE( !memcmp(partial + 4, view.data, 4) );
+}
+
+BOOST_AUTO_TEST_CASE(test_readPackets_returns_all_available_packets)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[15] = { 0, 'a', 'b', 0, 'g', 0, 'c', 'd', 0, 0, 'e', 'f', 0, 'g', 0 };
+    writeToDriver(test, tx, msg, 15);
+
+    PacketView packets[10];
+    BOOST_REQUIRE_EQUAL(3, test.readPackets(packets, 10));
+    BOOST_REQUIRE_EQUAL(4, packets[0].size);
+    BOOST_REQUIRE( !memcmp(msg, packets[0].data, 4) );
+    BOOST_REQUIRE_EQUAL(4, packets[1].size);
+    BOOST_REQUIRE( !memcmp(msg + 5, packets[1].data, 4) );
+    BOOST_REQUIRE_EQUAL(4, packets[2].size);
+    BOOST_REQUIRE( !memcmp(msg + 9, packets[2].data, 4) );
+    BOOST_REQUIRE_EQUAL(12, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(2, test.getStats().bad_rx);
+
+    BOOST_REQUIRE_EQUAL(0, test.readPackets(packets, 10));
+    uint8_t end[3] = { 'g', 'h', 0 };
+    writeToDriver(test, tx, end, 3);
+    BOOST_REQUIRE_EQUAL(1, test.readPackets(packets, 10));
+    BOOST_REQUIRE_EQUAL(4, packets[0].size);
+    BOOST_REQUIRE( !memcmp(msg + 14, packets[0].data, 1) );
+    BOOST_REQUIRE( !memcmp(end, packets[0].data + 1, 3) );
+    BOOST_REQUIRE_EQUAL(16, test.getStats().good_rx);
+    BOOST_REQUIRE_EQUAL(2, test.getStats().bad_rx);
+}
+
+BOOST_AUTO_TEST_CASE(test_readPackets_returns_at_most_max_packets)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[12] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0, 0, 'e', 'f', 0 };
+    writeToDriver(test, tx, msg, 12);
+
+    PacketView packets[2];
+    BOOST_REQUIRE_EQUAL(2, test.readPackets(packets, 2));
+    BOOST_REQUIRE( !memcmp(msg + 4, packets[1].data, 4) );
+    BOOST_REQUIRE_EQUAL(1, test.readPackets(packets, 2, false));
+    BOOST_REQUIRE( !memcmp(msg + 8, packets[0].data, 4) );
+}
+
+BOOST_AUTO_TEST_CASE(test_readPackets_does_not_read_the_stream_if_read_is_false)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[4] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 4);
+
+    PacketView packets[2];
+    BOOST_REQUIRE_EQUAL(0, test.readPackets(packets, 2, false));
+    BOOST_REQUIRE_EQUAL(1, test.readPackets(packets, 2));
+}
+
+BOOST_AUTO_TEST_CASE(test_readPackets_returns_only_the_last_packet_in_extract_last_mode)
+{
+    DriverTest test;
+    test.setExtractLastPacket(true);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[12] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0, 0, 'e', 'f', 0 };
+    writeToDriver(test, tx, msg, 12);
+
+    PacketView packets[10];
+    BOOST_REQUIRE_EQUAL(1, test.readPackets(packets, 10));
+    BOOST_REQUIRE( !memcmp(msg + 8, packets[0].data, 4) );
+    BOOST_REQUIRE_EQUAL(0, test.readPackets(packets, 10));
+}
+
+class ScanCountingDriver : public DriverTest
+{
+public:
+    mutable int extract_calls = 0;
+    using Driver::findPacket;
+
+    int extractPacket(uint8_t const* buffer, size_t buffer_size) const
+    {
+        ++extract_calls;
+        return DriverTest::extractPacket(buffer, buffer_size);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_findPacket_does_not_recurse_on_garbage)
+{
+    ScanCountingDriver test;
+    std::vector<uint8_t> garbage(10000000, 1);
+    pair<uint8_t const*, int> packet = test.findPacket(garbage.data(), garbage.size());
+    BOOST_REQUIRE(packet.first == garbage.data() + garbage.size());
+    BOOST_REQUIRE_EQUAL(0, packet.second);
+}
+
+BOOST_AUTO_TEST_CASE(test_hasPacket_does_not_rescan_garbage)
+{
+    ScanCountingDriver test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 1, 1, 1, 1, 1, 1, 0, 'a' };
+    writeToDriver(test, tx, msg, 8);
+    test.readPackets(nullptr, 0);
+    BOOST_REQUIRE(!test.hasPacket());
+    BOOST_REQUIRE_EQUAL(7, test.extract_calls);
+    BOOST_REQUIRE(!test.hasPacket());
+    BOOST_REQUIRE_EQUAL(8, test.extract_calls);
+}
+
+BOOST_AUTO_TEST_CASE(test_readPacket_reuses_the_packet_found_by_hasPacket)
+{
+    ScanCountingDriver test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 1, 1, 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 10);
+    test.readPackets(nullptr, 0);
+
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE_EQUAL(3, test.extract_calls);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE( !memcmp(msg + 2, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(3, test.extract_calls);
+    BOOST_REQUIRE_EQUAL(2, test.getStatus().bad_rx);
+
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE( !memcmp(msg + 6, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(4, test.extract_calls);
+}
+
+BOOST_AUTO_TEST_CASE(test_extract_last_does_not_reuse_a_packet_found_before_new_data_arrived)
+{
+    ScanCountingDriver test;
+    test.setExtractLastPacket(true);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 4);
+    test.readPackets(nullptr, 0);
+    BOOST_REQUIRE(test.hasPacket());
+
+    writeToDriver(test, tx, msg + 4, 4);
+    test.readPackets(nullptr, 0);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+}
+
+BOOST_AUTO_TEST_CASE(test_readPacket_searches_the_whole_buffer_with_a_scan_budget)
+{
+    ScanCountingDriver test;
+    test.setScanBudget(4);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 14);
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE( !memcmp(msg + 10, buffer, 4) );
+    BOOST_REQUIRE_EQUAL(10, test.getStatus().bad_rx);
+}
+
+BOOST_AUTO_TEST_CASE(test_hasPacket_stops_at_the_scan_budget_and_resumes_there)
+{
+    ScanCountingDriver test;
+    test.setScanBudget(4);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 1, 1, 1, 1, 1, 1, 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 10);
+    test.readPackets(nullptr, 0);
+
+    BOOST_REQUIRE(!test.hasPacket());
+    BOOST_REQUIRE_EQUAL(4, test.extract_calls);
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE_EQUAL(7, test.extract_calls);
+}
+
+BOOST_AUTO_TEST_CASE(test_status_counts_bytes_once_in_extract_last_mode_with_a_scan_budget)
+{
+    DriverTest test;
+    test.setExtractLastPacket(true);
+    test.setScanBudget(4);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 1, 0, 'a', 'b', 0, 0, 'c', 'd', 0, 0, 'e', 'f', 0 };
+    writeToDriver(test, tx, msg, 13);
+    test.readPackets(nullptr, 0);
+
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE_EQUAL(0, test.getStatus().good_rx);
+    BOOST_REQUIRE_EQUAL(0, test.getStatus().bad_rx);
+
+    uint8_t buffer[100];
+    while (test.getStatus().queued_bytes) {
+        test.readPacket(buffer, 100, base::Time::fromMilliseconds(100));
+    }
+    BOOST_REQUIRE_EQUAL('e', buffer[1]);
+
+    Status status = test.getStatus();
+    BOOST_REQUIRE_EQUAL(12, status.good_rx);
+    BOOST_REQUIRE_EQUAL(1, status.bad_rx);
+    BOOST_REQUIRE_EQUAL(3, status.rx_packets);
+}
+
+BOOST_AUTO_TEST_CASE(test_status_counts_received_packets_and_queued_bytes)
+{
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 1, 0, 'a', 'b', 0, 0, 'c', 'd', 0, 0, 'e' };
+    writeToDriver(test, tx, msg, 11);
+    test.readPackets(nullptr, 0);
+    BOOST_REQUIRE_EQUAL(11, test.getStatus().queued_bytes);
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(6, test.getStatus().queued_bytes);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+
+    Status status = test.getStatus();
+    BOOST_REQUIRE_EQUAL(2, status.queued_bytes);
+    BOOST_REQUIRE_EQUAL(2, status.rx_packets);
+    BOOST_REQUIRE_EQUAL(8, status.good_rx);
+    BOOST_REQUIRE_EQUAL(1, status.bad_rx);
+
+    test.clear();
+    BOOST_REQUIRE_EQUAL(0, test.getStatus().queued_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(test_status_counts_dropped_datagrams_once_in_extract_last_mode)
+{
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_DGRAM, 0, fds);
+    BOOST_REQUIRE(ret != -1);
+    FileGuard guard(fds[1]);
+
+    DriverTest test;
+    test.openURI("fd://" + to_string(fds[0]));
+    test.setDatagramMode(true);
+    test.setExtractLastPacket(true);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    BOOST_REQUIRE_EQUAL(4, write(fds[1], msg, 4));
+    BOOST_REQUIRE_EQUAL(4, write(fds[1], msg + 4, 4));
+    test.readPackets(nullptr, 0);
+    test.readPackets(nullptr, 0);
+
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE(test.hasPacket());
+    BOOST_REQUIRE_EQUAL(0, test.getStatus().good_rx);
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL('c', buffer[1]);
+    Status status = test.getStatus();
+    BOOST_REQUIRE_EQUAL(8, status.good_rx);
+    BOOST_REQUIRE_EQUAL(2, status.rx_packets);
+}
+
+BOOST_AUTO_TEST_CASE(test_status_counts_sent_packets)
+{
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_DGRAM, 0, fds);
+    BOOST_REQUIRE(ret != -1);
+    FileGuard guard(fds[1]);
+
+    DriverTest test;
+    test.openURI("fd://" + to_string(fds[0]));
+    uint8_t data[4] = { 0, 1, 2, 0 };
+    test.writePacket(data, 4);
+    test.writePacket(data, 3);
+
+    Status status = test.getStatus();
+    BOOST_REQUIRE_EQUAL(7, status.tx);
+    BOOST_REQUIRE_EQUAL(2, status.tx_packets);
+
+    test.resetStatus();
+    BOOST_REQUIRE_EQUAL(0, test.getStatus().tx);
+    BOOST_REQUIRE_EQUAL(0, test.getStatus().tx_packets);
+}
+
+BOOST_AUTO_TEST_CASE(test_status_stamp_is_not_updated_with_STAMP_NEVER)
+{
+    DriverTest test;
+    test.setStatusStampMode(Driver::STAMP_NEVER);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 4);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+
+    Status status = test.getStatus();
+    BOOST_REQUIRE_EQUAL(4, status.good_rx);
+    BOOST_REQUIRE(status.stamp.isNull());
+}
+
+BOOST_AUTO_TEST_CASE(test_status_stamp_is_the_reception_time_with_STAMP_ON_IO)
+{
+    DriverTest test;
+    test.setStatusStampMode(Driver::STAMP_ON_IO);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 8);
+    base::Time before = base::Time::now();
+    test.readPackets(nullptr, 0);
+    base::Time received = test.getStatus().stamp;
+    BOOST_REQUIRE(received >= before);
+
+    usleep(10000);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+
+    Status status = test.getStatus();
+    BOOST_REQUIRE_EQUAL(8, status.good_rx);
+    BOOST_REQUIRE_EQUAL(received, status.stamp);
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_timestamps_are_the_time_of_the_first_byte)
+{
+    DriverTest test;
+    test.setReceiveTimestamps(true);
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 6);
+    test.readPackets(nullptr, 0);
+    base::Time first_read = base::Time::now();
+    usleep(10000);
+    writeToDriver(test, tx, msg + 6, 2);
+    test.readPackets(nullptr, 0);
+    base::Time second_read = base::Time::now();
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE(test.getLastPacketTime() <= first_read);
+    BOOST_REQUIRE(!test.getLastPacketTime().isNull());
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE(test.getLastPacketTime() <= first_read);
+
+    writeToDriver(test, tx, msg, 4);
+    usleep(10000);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE(test.getLastPacketTime() > second_read);
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_timestamps_of_packet_views)
 {
     DriverTest test;
+    test.setReceiveTimestamps(true);
     int tx = setupDriver(test);
     FileGuard tx_guard(tx);
-    common_rx_garbage_removal(test, tx);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    writeToDriver(test, tx, msg, 4);
+    test.readPackets(nullptr, 0);
+    base::Time first_read = base::Time::now();
+    usleep(10000);
+    writeToDriver(test, tx, msg + 4, 4);
+
+    PacketView packets[2];
+    BOOST_REQUIRE_EQUAL(2, test.readPackets(packets, 2));
+    BOOST_REQUIRE(test.getPacketTime(packets[0]) <= first_read);
+    BOOST_REQUIRE(test.getPacketTime(packets[1]) > first_read);
 }
 
-void common_rx_packet_extraction_mode(Driver& test, int tx)
+BOOST_AUTO_TEST_CASE(test_receive_timestamps_are_disabled_by_default)
 {
+    DriverTest test;
+    int tx = setupDriver(test);
+    FileGuard tx_guard(tx);
+
+    uint8_t msg[] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 4);
     uint8_t buffer[100];
-    uint8_t msg[16] = { 'g', 'a', 'r', 'b', 0, 'a', 'b', 0, 'b', 'a', 'g', 'e', 0, 'c', 'd', 0 };
-    writeToDriver(test, tx, msg, 16);
-    test.setExtractLastPacket(false);
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE(test.getLastPacketTime().isNull());
+}
 
-    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
-    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
-    BOOST_REQUIRE_EQUAL(4, test.getStats().good_rx);
-    BOOST_REQUIRE_EQUAL(4, test.getStats().bad_rx);
-    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
-    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
-    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
-    BOOST_REQUIRE_EQUAL(8, test.getStats().good_rx);
-    BOOST_REQUIRE_EQUAL(8, test.getStats().bad_rx);
-    BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
-    BOOST_REQUIRE_EQUAL(8, test.getStats().good_rx);
-    BOOST_REQUIRE_EQUAL(8, test.getStats().bad_rx);
+BOOST_AUTO_TEST_CASE(test_writePacket_writes_segments)
+{
+    int pipes[2];
+    BOOST_REQUIRE(pipe(pipes) == 0);
+    FileGuard rx_guard(pipes[0]);
 
-    writeToDriver(test, tx, msg, 16);
-    test.setExtractLastPacket(true);
+    DriverTest test;
+    test.setFileDescriptor(pipes[1], true);
+    BufferListener* listener = new BufferListener;
+    test.addListener(listener);
+
+    uint8_t header[] = { 0, 1 };
+    uint8_t payload[] = { 2, 3, 4 };
+    uint8_t checksum[] = { 5 };
+    PacketView segments[] = {
+        PacketView(header, 2), PacketView(payload, 3),
+        PacketView(), PacketView(checksum, 1)
+    };
+    test.writePacket(segments, 4, base::Time::fromMilliseconds(100));
+
+    uint8_t expected[] = { 0, 1, 2, 3, 4, 5 };
+    uint8_t buffer[6];
+    BOOST_REQUIRE_EQUAL(6, read(pipes[0], buffer, 6));
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(expected, expected + 6, buffer, buffer + 6);
+    vector<uint8_t> notified = listener->flushWrite();
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(expected, expected + 6,
+                                    notified.begin(), notified.end());
+    BOOST_REQUIRE_EQUAL(6, test.getStatus().tx);
+    BOOST_REQUIRE_EQUAL(1, test.getStatus().tx_packets);
+}
 
-    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
-    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
-    // 16 bytes: even though one package has not been returned, it should still
-    // be counted
-    BOOST_REQUIRE_EQUAL(16, test.getStats().good_rx);
-    BOOST_REQUIRE_EQUAL(16, test.getStats().bad_rx);
-    BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
+/** A stream that accepts at most three bytes per write */
+class ShortWriteStream : public IOStream
+{
+public:
+    vector<uint8_t> data;
+    int write_calls = 0;
+
+    bool waitRead(base::Time const&) { return false; }
+    bool waitWrite(base::Time const&) { return true; }
+    size_t read(uint8_t*, size_t) { return 0; }
+    size_t write(uint8_t const* buffer, size_t buffer_size) {
+        ++write_calls;
+        size_t size = std::min<size_t>(buffer_size, 3);
+        data.insert(data.end(), buffer, buffer + size);
+        return size;
+    }
+    void clear() {}
+};
 
-    writeToDriver(test, tx, msg, 16);
-    test.setExtractLastPacket(false);
-    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
-    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
-    BOOST_REQUIRE_EQUAL(20, test.getStats().good_rx);
-    BOOST_REQUIRE_EQUAL(20, test.getStats().bad_rx);
-    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
-    writeToDriver(test, tx, msg, 14);
-    // We have now one packet from the first write and one packet from the 2nd
-    // write. We should get the packet from the second write
-    test.setExtractLastPacket(true);
-    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
-    BOOST_REQUIRE_EQUAL(0, test.getStats().tx);
-    BOOST_REQUIRE_EQUAL(28, test.getStats().good_rx);
-    if (test.isValid())
-        BOOST_REQUIRE_EQUAL(32, test.getStats().bad_rx);
-    else
-        BOOST_REQUIRE_EQUAL(36, test.getStats().bad_rx);
-    BOOST_REQUIRE( !memcmp(msg + 4, buffer, 4) );
+BOOST_AUTO_TEST_CASE(test_writePacket_resumes_partial_segment_writes)
+{
+    DriverTest test;
+    ShortWriteStream* stream = new ShortWriteStream;
+    test.setMainStream(stream);
+    BufferListener* listener = new BufferListener;
+    test.addListener(listener);
+
+    uint8_t header[] = { 0, 1 };
+    uint8_t payload[] = { 2, 3, 4, 5, 6 };
+    PacketView segments[] = { PacketView(header, 2), PacketView(payload, 5) };
+    test.writePacket(segments, 2, base::Time::fromMilliseconds(100));
+
+    uint8_t expected[] = { 0, 1, 2, 3, 4, 5, 6 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(expected, expected + 7,
+                                    stream->data.begin(), stream->data.end());
+    vector<uint8_t> notified = listener->flushWrite();
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(expected, expected + 7,
+                                    notified.begin(), notified.end());
+}
 
-    if (test.isValid())
-    {
-        // The garbage that was at the end of the second write should have been
-        // removed as well
-        BOOST_REQUIRE_EQUAL(-1, read(test.getFileDescriptor(), buffer, 1));
-        BOOST_REQUIRE_EQUAL(EAGAIN, errno);
-        writeToDriver(test, tx, msg + 14, 2);
-        BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10));
-        BOOST_REQUIRE( !memcmp(msg + 12, buffer, 4) );
+/** A stream that accepts a configurable number of bytes per write */
+class ThrottledWriteStream : public ShortWriteStream
+{
+public:
+    size_t accepted = 0;
+
+    size_t write(uint8_t const* buffer, size_t buffer_size) {
+        ++write_calls;
+        size_t size = std::min(buffer_size, accepted);
+        data.insert(data.end(), buffer, buffer + size);
+        return size;
     }
+};
+
+BOOST_AUTO_TEST_CASE(test_queuePacket_throws_if_the_write_queue_is_disabled)
+{
+    DriverTest test;
+    test.setMainStream(new ThrottledWriteStream);
+    uint8_t packet[] = { 0, 1, 2, 0 };
+    BOOST_REQUIRE_THROW(test.queuePacket(packet, 4), std::logic_error);
 }
-BOOST_AUTO_TEST_CASE(test_rx_packet_extraction_mode)
+
+BOOST_AUTO_TEST_CASE(test_queuePacket_coalesces_the_queued_packets)
 {
     DriverTest test;
-    int tx = setupDriver(test);
-    FileGuard tx_guard(tx);
-    common_rx_packet_extraction_mode(test, tx);
+    ThrottledWriteStream* stream = new ThrottledWriteStream;
+    test.setMainStream(stream);
+    BufferListener* listener = new BufferListener;
+    test.addListener(listener);
+    test.setWriteQueueSize(16);
+
+    uint8_t packets[] = { 0, 1, 2, 0, 0, 3, 4, 0, 0, 5, 6, 0, 0, 7, 8, 0 };
+    for (int i = 0; i < 4; ++i)
+        BOOST_REQUIRE(test.queuePacket(packets + i * 4, 4));
+    BOOST_REQUIRE(!test.queuePacket(packets, 4));
+    BOOST_REQUIRE_EQUAL(16, test.getQueuedWriteBytes());
+    BOOST_REQUIRE(test.isWriteQueueCongested());
+    BOOST_REQUIRE(stream->data.empty());
+
+    stream->accepted = 100;
+    int calls = stream->write_calls;
+    BOOST_REQUIRE_EQUAL(0, test.flushWriteQueue());
+    BOOST_REQUIRE_EQUAL(calls + 1, stream->write_calls);
+    BOOST_REQUIRE(!test.hasPendingWrites());
+    BOOST_REQUIRE(!test.isWriteQueueCongested());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(packets, packets + 16,
+                                    stream->data.begin(), stream->data.end());
+    vector<uint8_t> notified = listener->flushWrite();
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(packets, packets + 16,
+                                    notified.begin(), notified.end());
+    BOOST_REQUIRE_EQUAL(16, test.getStatus().tx);
+    BOOST_REQUIRE_EQUAL(4, test.getStatus().tx_packets);
 }
 
-BOOST_AUTO_TEST_CASE(test_hasPacket_returns_false_on_empty_internal_buffer)
+BOOST_AUTO_TEST_CASE(test_queuePacket_ignores_empty_packets)
+{
+    DriverTest test;
+    ThrottledWriteStream* stream = new ThrottledWriteStream;
+    test.setMainStream(stream);
+    test.setWriteQueueSize(16);
+
+    uint8_t packet[] = { 0, 1, 2, 0 };
+    BOOST_REQUIRE(test.queuePacket(packet, 0));
+    BOOST_REQUIRE(!test.hasPendingWrites());
+    BOOST_REQUIRE(test.queuePacket(packet, 4));
+
+    stream->accepted = 100;
+    BOOST_REQUIRE_EQUAL(0, test.flushWriteQueue());
+    BOOST_REQUIRE_EQUAL(4, stream->data.size());
+    BOOST_REQUIRE_EQUAL(1, test.getStatus().tx_packets);
+}
+
+BOOST_AUTO_TEST_CASE(test_write_queue_reports_backpressure_with_hysteresis)
+{
+    DriverTest test;
+    ThrottledWriteStream* stream = new ThrottledWriteStream;
+    test.setMainStream(stream);
+    test.setWriteQueueSize(16);
+    test.setWriteQueueWatermarks(4, 8);
+
+    uint8_t packets[] = { 0, 1, 2, 0, 0, 3, 4, 0, 0, 5, 6, 0 };
+    test.queuePacket(packets, 4);
+    BOOST_REQUIRE(!test.isWriteQueueCongested());
+    test.queuePacket(packets + 4, 4);
+    test.queuePacket(packets + 8, 4);
+    BOOST_REQUIRE(test.isWriteQueueCongested());
+
+    stream->accepted = 6;
+    BOOST_REQUIRE_EQUAL(6, test.flushWriteQueue());
+    BOOST_REQUIRE(test.isWriteQueueCongested());
+    BOOST_REQUIRE_EQUAL(1, test.getStatus().tx_packets);
+    BOOST_REQUIRE_EQUAL(6, test.getStatus().tx);
+
+    BOOST_REQUIRE_EQUAL(0, test.flushWriteQueue());
+    BOOST_REQUIRE(!test.isWriteQueueCongested());
+    BOOST_REQUIRE_EQUAL(3, test.getStatus().tx_packets);
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(packets, packets + 12,
+                                    stream->data.begin(), stream->data.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_writePacket_writes_the_queued_packets_first)
+{
+    DriverTest test;
+    ThrottledWriteStream* stream = new ThrottledWriteStream;
+    test.setMainStream(stream);
+    test.setWriteQueueSize(16);
+
+    uint8_t packets[] = { 0, 1, 2, 0, 0, 3, 4, 0 };
+    test.queuePacket(packets, 4);
+    stream->accepted = 100;
+    test.writePacket(packets + 4, 4, base::Time::fromMilliseconds(100));
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(packets, packets + 8,
+                                    stream->data.begin(), stream->data.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_latencies_are_not_measured_by_default)
 {
     DriverTest test;
     int tx = setupDriver(test);
     FileGuard tx_guard(tx);
-    BOOST_REQUIRE(!test.hasPacket());
+
+    uint8_t msg[] = { 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 4);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE(!test.getLatencyMonitoring());
+    BOOST_REQUIRE_EQUAL(0, test.getLatencies().packet.count);
+    BOOST_REQUIRE_EQUAL(0, test.getLatencies().extract.count);
 }
 
-BOOST_AUTO_TEST_CASE(test_hasPacket_returns_false_on_internal_buffer_with_garbage)
+BOOST_AUTO_TEST_CASE(test_latencies_are_measured_if_enabled)
 {
     DriverTest test;
+    test.setLatencyMonitoring(true);
     int tx = setupDriver(test);
     FileGuard tx_guard(tx);
-    writeToDriver(test, tx, reinterpret_cast<uint8_t const*>("12\x0  \x0 3"), 8);
+
+    uint8_t msg[] = { 1, 0, 'a', 'b', 0 };
+    writeToDriver(test, tx, msg, 5);
+    test.readPackets(nullptr, 0);
+    usleep(10000);
+
     uint8_t buffer[100];
-    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, 10, 1));
-    BOOST_REQUIRE(!test.hasPacket());
+    BOOST_REQUIRE_EQUAL(4, test.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_THROW(test.readPacket(buffer, 100, base::Time::fromMilliseconds(10)),
+                        TimeoutError);
+
+    Latencies latencies = test.getLatencies();
+    BOOST_REQUIRE_EQUAL(1, latencies.packet.count);
+    BOOST_REQUIRE(latencies.packet.min_ns >= 10000000);
+    BOOST_REQUIRE_EQUAL(2, latencies.extract.count);
+    BOOST_REQUIRE(latencies.wait_read.count >= 1);
+    BOOST_REQUIRE(latencies.wait_read.max_ns >= 5000000);
+
+    test.resetLatencies();
+    BOOST_REQUIRE_EQUAL(0, test.getLatencies().packet.count);
+}
+
+BOOST_AUTO_TEST_CASE(test_latencies_measure_writePacket)
+{
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_DGRAM, 0, fds);
+    BOOST_REQUIRE(ret != -1);
+    FileGuard guard(fds[1]);
+
+    DriverTest test;
+    test.setLatencyMonitoring(true);
+    test.openURI("fd://" + to_string(fds[0]));
+    uint8_t data[4] = { 0, 1, 2, 0 };
+    test.writePacket(data, 4);
+    BOOST_REQUIRE_EQUAL(1, test.getLatencies().write.count);
+}
+
+BOOST_AUTO_TEST_CASE(test_status_counters_snapshots_are_consistent_across_threads)
+{
+    StatusCounters counters;
+    std::atomic<bool> quit(false);
+    std::thread writer([&counters, &quit]() {
+        while (!quit)
+            counters.addRx(1, 1);
+    });
+
+    for (int i = 0; i < 100000; ++i) {
+        Status status = counters.snapshot();
+        BOOST_REQUIRE_EQUAL(status.good_rx, status.bad_rx);
+        BOOST_REQUIRE_EQUAL(status.good_rx, status.rx_packets);
+    }
+    quit = true;
+    writer.join();
 }
 
 struct UDPFixture {
@@ -428,6 +1304,26 @@ struct UDPFixture {
     void validateReceiveBuffer() {
         BOOST_TEST(memcmp(sendBuffer, receiveBuffer, 4) == 0);
     }
+
+    void checkKernelReceiveTimestamps(std::string const& options)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112&timestamps=1" + options);
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        // The kernel enables its receive timestamps asynchronously the first
+        // time a socket asks for them. Until then, datagrams are stamped
+        // when they are read
+        usleep(20000);
+
+        base::Time before = base::Time::now();
+        serverWrite();
+        usleep(20000);
+        base::Time after_send = base::Time::now() - base::Time::fromMilliseconds(10);
+        read();
+        validateReceiveBuffer();
+        BOOST_REQUIRE(test.getLastPacketTime() >= before);
+        BOOST_REQUIRE(test.getLastPacketTime() < after_send);
+        BOOST_REQUIRE(!test.getMainStream()->getLastReceiveTime().isNull());
+    }
 };
 
 class UDPServerStreamMock : iodrivers_base::UDPServerStream {
@@ -696,6 +1592,166 @@ BOOST_FIXTURE_TEST_SUITE(general_udp_behavior, UDPFixture)
         BOOST_REQUIRE_THROW(test.readPacket(receiveBuffer, 100), UnixError);
     }
 
+    BOOST_AUTO_TEST_CASE(it_receives_datagrams_in_batches)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112&batch=8");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        uint8_t datagrams[3][4] = { { 0, 1, 2, 0 }, { 0, 3, 4, 0 }, { 0, 5, 6, 0 } };
+        for (int i = 0; i < 3; ++i) {
+            server.writePacket(datagrams[i], 4);
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            BOOST_REQUIRE_EQUAL(test.readPacket(receiveBuffer, 100), 4);
+            BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, datagrams[i], 4), 0);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(it_uses_the_kernel_receive_timestamps)
+    {
+        checkKernelReceiveTimestamps("");
+    }
+
+    BOOST_AUTO_TEST_CASE(it_uses_the_kernel_receive_timestamps_in_batch_mode)
+    {
+        checkKernelReceiveTimestamps("&batch=8");
+    }
+
+    BOOST_AUTO_TEST_CASE(it_sends_segments_as_a_single_datagram)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111&datagram=1");
+        uint8_t header[] = { 0, 1 };
+        uint8_t payload[] = { 2, 0 };
+        PacketView segments[] = { PacketView(header, 2), PacketView(payload, 2) };
+        test.writePacket(segments, 2);
+
+        BOOST_REQUIRE_EQUAL(4, server.readPacket(receiveBuffer, 100, base::Time::fromMilliseconds(100)));
+        uint8_t expected[] = { 0, 1, 2, 0 };
+        BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, expected, 4), 0);
+    }
+
+    BOOST_AUTO_TEST_CASE(it_sends_the_queued_packets_as_separate_datagrams)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        test.setWriteQueueSize(1024);
+        uint8_t datagrams[2][4] = { { 0, 1, 2, 0 }, { 0, 3, 4, 0 } };
+        for (int i = 0; i < 2; ++i)
+            BOOST_REQUIRE(test.queuePacket(datagrams[i], 4));
+        test.flushWriteQueue();
+
+        for (int i = 0; i < 2; ++i) {
+            serverRead();
+            BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, datagrams[i], 4), 0);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(it_reports_connrefused_in_batch_mode)
+    {
+        test.openURI("udp://127.0.0.1:1111?ignore_connrefused=0&batch=8");
+        test.writePacket(sendBuffer, 100);
+        BOOST_REQUIRE_EXCEPTION(
+            test.readPacket(receiveBuffer, 100), UnixError,
+            [](UnixError const& e) -> bool { return e.error == ECONNREFUSED; }
+        );
+    }
+
+    BOOST_AUTO_TEST_CASE(it_sends_datagrams_in_batches)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        uint8_t datagrams[3][4] = { { 0, 1, 2, 0 }, { 0, 3, 4, 0 }, { 0, 5, 6, 0 } };
+        PacketView views[3];
+        for (int i = 0; i < 3; ++i) {
+            views[i] = PacketView(datagrams[i], 4);
+        }
+
+        auto& stream = dynamic_cast<UDPServerStream&>(*test.getMainStream());
+        BOOST_REQUIRE_EQUAL(stream.writeBatch(views, 3), 3);
+        for (int i = 0; i < 3; ++i) {
+            serverRead();
+            BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, datagrams[i], 4), 0);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(it_rejects_the_batch_option_on_non_datagram_streams)
+    {
+        BOOST_REQUIRE_THROW(test.openURI("test://?batch=8"), std::invalid_argument);
+    }
+
+    BOOST_AUTO_TEST_CASE(it_rejects_invalid_batch_sizes)
+    {
+        char const* values[] = { "-1", "1025", "8x" };
+        for (char const* value : values) {
+            BOOST_TEST_CONTEXT("batch=" << value) {
+                DriverTest driver;
+                BOOST_REQUIRE_THROW(
+                    driver.openURI("udp://127.0.0.1:1111?local_port=1112&batch=" +
+                                   string(value)),
+                    std::invalid_argument
+                );
+                BOOST_TEST(!driver.isValid());
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(it_drops_the_bytes_that_follow_the_packet_in_datagram_mode)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112&datagram=1");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        uint8_t datagram[8] = { 0, 1, 2, 0, 0, 3, 4, 0 };
+        server.writePacket(datagram, 8);
+
+        BOOST_REQUIRE_EQUAL(test.readPacket(receiveBuffer, 100), 4);
+        BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, datagram, 4), 0);
+        BOOST_REQUIRE_THROW(test.readPacket(receiveBuffer, 100), TimeoutError);
+        BOOST_REQUIRE_EQUAL(test.getStatus().good_rx, 4);
+        BOOST_REQUIRE_EQUAL(test.getStatus().bad_rx, 4);
+    }
+
+    BOOST_AUTO_TEST_CASE(it_drops_whole_datagrams_that_do_not_start_with_a_packet_in_datagram_mode)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112&datagram=1");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        uint8_t garbage[6] = { 1, 0, 1, 2, 0, 0 };
+        uint8_t packet[4] = { 0, 3, 4, 0 };
+        server.writePacket(garbage, 6);
+        server.writePacket(packet, 4);
+
+        BOOST_REQUIRE_EQUAL(test.readPacket(receiveBuffer, 100), 4);
+        BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, packet, 4), 0);
+        BOOST_REQUIRE_EQUAL(test.getStatus().bad_rx, 6);
+    }
+
+    BOOST_AUTO_TEST_CASE(it_does_not_join_partial_packets_across_datagrams_in_datagram_mode)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112&datagram=1");
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        uint8_t first[2] = { 0, 1 };
+        uint8_t second[2] = { 2, 0 };
+        server.writePacket(first, 2);
+        server.writePacket(second, 2);
+
+        BOOST_REQUIRE_THROW(test.readPacket(receiveBuffer, 100), TimeoutError);
+        BOOST_REQUIRE_EQUAL(test.getStatus().bad_rx, 4);
+    }
+
+    BOOST_AUTO_TEST_CASE(it_returns_the_last_datagram_in_datagram_and_extract_last_mode)
+    {
+        test.openURI("udp://127.0.0.1:1111?local_port=1112&datagram=1&batch=8");
+        test.setExtractLastPacket(true);
+        server.openURI("udp://127.0.0.1:1112?local_port=1111");
+        uint8_t datagrams[3][4] = { { 0, 1, 2, 0 }, { 0, 3, 4, 0 }, { 0, 5, 6, 0 } };
+        for (int i = 0; i < 3; ++i) {
+            server.writePacket(datagrams[i], 4);
+        }
+
+        test.getMainStream()->waitRead(base::Time::fromMilliseconds(100));
+        BOOST_REQUIRE_EQUAL(test.readPacket(receiveBuffer, 100), 4);
+        BOOST_REQUIRE_EQUAL(memcmp(receiveBuffer, datagrams[2], 4), 0);
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_FIXTURE_TEST_SUITE(udp_without_local_port, UDPFixture)
@@ -1510,3 +2566,125 @@ BOOST_AUTO_TEST_CASE(test_it_times_out_reading_on_unix_dgram_server_sockets_whic
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+struct SocketOptionsFixture {
+    int server_fd;
+    int port;
+    DriverTest test;
+
+    SocketOptionsFixture() {
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        BOOST_REQUIRE(bind(server_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        BOOST_REQUIRE(listen(server_fd, 1) == 0);
+        socklen_t size = sizeof(addr);
+        getsockname(server_fd, (sockaddr*)&addr, &size);
+        port = ntohs(addr.sin_port);
+    }
+
+    ~SocketOptionsFixture() {
+        test.close();
+        close(server_fd);
+    }
+
+    string tcpURI(string const& options) const {
+        string uri = "tcp://127.0.0.1:" + to_string(port);
+        return options.empty() ? uri : uri + "?" + options;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(socket_options, SocketOptionsFixture)
+
+BOOST_AUTO_TEST_CASE(it_applies_the_tcp_options_of_the_uri)
+{
+    test.openURI(tcpURI("nodelay=0&quickack=1&rcvbuf=65536&sndbuf=32768&priority=3"));
+    auto conf = test.getSocketConfiguration();
+    BOOST_TEST(conf.nodelay == 0);
+    // The kernel doubles the buffer sizes
+    BOOST_TEST(conf.receive_buffer_size == 2 * 65536);
+    BOOST_TEST(conf.send_buffer_size == 2 * 32768);
+    BOOST_TEST(conf.priority == 3);
+    auto stream = dynamic_cast<FDStream*>(test.getMainStream());
+    BOOST_REQUIRE(stream);
+    BOOST_TEST(stream->getQuickAck());
+}
+
+BOOST_AUTO_TEST_CASE(it_enables_nodelay_on_tcp_by_default)
+{
+    test.openURI(tcpURI(""));
+    BOOST_TEST(test.getSocketConfiguration().nodelay == 1);
+}
+
+BOOST_AUTO_TEST_CASE(it_applies_the_buffer_sizes_on_udp)
+{
+    test.openURI("udpserver://" + to_string(port) + "?rcvbuf=65536");
+    BOOST_TEST(test.getSocketConfiguration().receive_buffer_size == 2 * 65536);
+    BOOST_TEST(test.getSocketConfiguration().nodelay == -1);
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_tcp_options_on_udp)
+{
+    BOOST_REQUIRE_THROW(
+        test.openURI("udpserver://" + to_string(port) + "?nodelay=1"),
+        std::invalid_argument
+    );
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_socket_options_on_non_socket_uris)
+{
+    BOOST_REQUIRE_THROW(test.openURI("test://?rcvbuf=65536"),
+                        std::invalid_argument);
+    BOOST_TEST(!test.isValid());
+}
+
+BOOST_AUTO_TEST_CASE(it_does_not_open_the_socket_if_an_option_is_invalid)
+{
+    BOOST_REQUIRE_THROW(
+        test.openURI("tcp://127.0.0.1:" + to_string(port) + "?rcvbuf=abc"),
+        std::invalid_argument
+    );
+    BOOST_TEST(!test.isValid());
+}
+
+BOOST_AUTO_TEST_CASE(it_does_not_open_the_socket_if_an_option_is_unsupported)
+{
+    BOOST_REQUIRE_THROW(
+        test.openURI("tcp://127.0.0.1:" + to_string(port) + "?batch=8"),
+        std::invalid_argument
+    );
+    BOOST_TEST(!test.isValid());
+    BOOST_REQUIRE_THROW(
+        test.openURI("udpserver://" + to_string(port) + "?io_uring=1"),
+        std::invalid_argument
+    );
+    BOOST_TEST(!test.isValid());
+}
+
+static boost::test_tools::assertion_result isUnprivileged(boost::unit_test::test_unit_id)
+{
+    boost::test_tools::assertion_result result(geteuid() != 0);
+    result.message() << "the test must run as an unprivileged user";
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(it_closes_the_socket_if_an_option_cannot_be_applied,
+                     *boost::unit_test::precondition(isUnprivileged))
+{
+    // Priorities above 6 require CAP_NET_ADMIN
+    BOOST_REQUIRE_THROW(
+        test.openURI("tcp://127.0.0.1:" + to_string(port) + "?priority=7"),
+        UnixError
+    );
+    BOOST_TEST(!test.isValid());
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_if_the_driver_is_not_connected_to_a_socket)
+{
+    test.openURI("test://");
+    BOOST_REQUIRE_THROW(test.getSocketConfiguration(), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,210 @@
+#include <boost/test/unit_test.hpp>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+
+#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/DriverReactor.hpp>
+
+#include "DriverTest.hpp"
+
+using namespace std;
+using namespace iodrivers_base;
+
+struct DriverReactorFixture {
+    DriverReactor reactor;
+    DriverTest drivers[2];
+    TestPipe pipes[2];
+    vector<string> received[2];
+
+    DriverReactorFixture() {
+        for (int i = 0; i < 2; ++i)
+            drivers[i].setFileDescriptor(pipes[i].rx);
+    }
+
+    DriverReactor::PacketCallback recorder(int i) {
+        return [this, i](PacketView const& packet) {
+            received[i].push_back(string(
+                reinterpret_cast<char const*>(packet.data), packet.size
+            ));
+        };
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(DriverReactorSuite, DriverReactorFixture)
+
+BOOST_AUTO_TEST_CASE(it_dispatches_packets_to_the_callback_of_their_driver)
+{
+    reactor.add(drivers[0], recorder(0));
+    reactor.add(drivers[1], recorder(1));
+    BOOST_REQUIRE_EQUAL(2, reactor.size());
+
+    pipes[0].write("\x00" "ab\x00" "g\x00" "cd\x00", 9);
+    pipes[1].write("\x00" "ef\x00", 4);
+    BOOST_REQUIRE_EQUAL(3, reactor.poll(base::Time::fromMilliseconds(100)));
+
+    BOOST_REQUIRE_EQUAL(2, received[0].size());
+    BOOST_REQUIRE_EQUAL(string("\x00" "ab\x00", 4), received[0][0]);
+    BOOST_REQUIRE_EQUAL(string("\x00" "cd\x00", 4), received[0][1]);
+    BOOST_REQUIRE_EQUAL(1, received[1].size());
+    BOOST_REQUIRE_EQUAL(string("\x00" "ef\x00", 4), received[1][0]);
+}
+
+BOOST_AUTO_TEST_CASE(it_keeps_partial_packets_until_they_are_complete)
+{
+    reactor.add(drivers[0], recorder(0));
+
+    pipes[0].write("\x00" "a", 2);
+    BOOST_REQUIRE_EQUAL(0, reactor.poll(base::Time::fromMilliseconds(100)));
+    pipes[0].write("b\x00", 2);
+    BOOST_REQUIRE_EQUAL(1, reactor.poll(base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(string("\x00" "ab\x00", 4), received[0][0]);
+}
+
+BOOST_AUTO_TEST_CASE(it_dispatches_the_packets_already_buffered_when_a_driver_is_added)
+{
+    pipes[0].write("\x00" "ab\x00" "\x00" "cd\x00", 8);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, drivers[0].readPacket(buffer, 100));
+
+    reactor.add(drivers[0], recorder(0));
+    BOOST_REQUIRE_EQUAL(1, received[0].size());
+    BOOST_REQUIRE_EQUAL(string("\x00" "cd\x00", 4), received[0][0]);
+}
+
+BOOST_AUTO_TEST_CASE(it_dispatches_the_packets_beyond_the_scan_budget)
+{
+    drivers[0].setScanBudget(4);
+    reactor.add(drivers[0], recorder(0));
+
+    pipes[0].write("ggggggggg" "\x00" "ab\x00" "ggggggggg" "\x00" "cd\x00", 26);
+    BOOST_REQUIRE_EQUAL(2, reactor.poll(base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(2, received[0].size());
+    BOOST_REQUIRE_EQUAL(string("\x00" "cd\x00", 4), received[0][1]);
+}
+
+BOOST_AUTO_TEST_CASE(it_flushes_the_write_queue_when_the_driver_becomes_writable)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    DriverTest driver;
+    driver.setFileDescriptor(fds[0]);
+    driver.setWriteQueueSize(1 << 20);
+    reactor.add(driver, recorder(0));
+
+    // Fill the socket buffer so that the next packets stay in the queue
+    vector<uint8_t> packet(1024, 0);
+    size_t total = 0;
+    while (!driver.hasPendingWrites()) {
+        BOOST_REQUIRE(driver.queuePacket(packet.data(), packet.size()));
+        total += packet.size();
+    }
+
+    vector<uint8_t> buffer(65536);
+    size_t received = 0;
+    base::Time deadline = base::Time::now() + base::Time::fromSeconds(2);
+    while (received < total && base::Time::now() < deadline) {
+        reactor.poll(base::Time::fromMilliseconds(10));
+        ssize_t c = recv(fds[1], buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (c > 0)
+            received += c;
+    }
+    reactor.remove(driver);
+    close(fds[1]);
+
+    BOOST_REQUIRE_EQUAL(total, received);
+    BOOST_REQUIRE(!driver.hasPendingWrites());
+}
+
+BOOST_AUTO_TEST_CASE(it_returns_zero_on_timeout)
+{
+    reactor.add(drivers[0], recorder(0));
+    BOOST_REQUIRE_EQUAL(0, reactor.poll(base::Time::fromMilliseconds(10)));
+}
+
+BOOST_AUTO_TEST_CASE(it_does_not_dispatch_to_removed_drivers)
+{
+    reactor.add(drivers[0], recorder(0));
+    reactor.remove(drivers[0]);
+    BOOST_REQUIRE_EQUAL(0, reactor.size());
+
+    pipes[0].write("\x00" "ab\x00", 4);
+    BOOST_REQUIRE_EQUAL(0, reactor.poll(base::Time::fromMilliseconds(10)));
+    BOOST_REQUIRE(received[0].empty());
+}
+
+BOOST_AUTO_TEST_CASE(it_allows_removing_a_driver_from_its_callback)
+{
+    reactor.add(drivers[0], [this](PacketView const&) {
+        received[0].push_back("");
+        reactor.remove(drivers[0]);
+    });
+
+    pipes[0].write("\x00" "ab\x00" "\x00" "cd\x00", 8);
+    BOOST_REQUIRE_EQUAL(1, reactor.poll(base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(1, received[0].size());
+    BOOST_REQUIRE_EQUAL(0, reactor.size());
+}
+
+BOOST_AUTO_TEST_CASE(it_drops_the_rest_of_the_batch_when_a_callback_removes_its_driver)
+{
+    reactor.add(drivers[0], [this](PacketView const&) {
+        reactor.remove(drivers[0]);
+    });
+
+    pipes[0].write("\x00" "ab\x00" "\x00" "cd\x00" "\x00" "ef\x00", 12);
+    BOOST_REQUIRE_EQUAL(1, reactor.poll(base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(12, drivers[0].getStatus().good_rx);
+
+    pipes[0].write("\x00" "gh\x00", 4);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, drivers[0].readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(string("\x00" "gh\x00", 4),
+                        string(reinterpret_cast<char*>(buffer), 4));
+}
+
+BOOST_AUTO_TEST_CASE(it_removes_drivers_that_reached_eof)
+{
+    reactor.add(drivers[0], recorder(0));
+    pipes[0].write("\x00" "ab\x00", 4);
+    close(pipes[0].tx);
+    pipes[0].tx = open("/dev/null", O_WRONLY);
+
+    reactor.poll(base::Time::fromMilliseconds(100));
+    reactor.poll(base::Time::fromMilliseconds(100));
+    BOOST_REQUIRE_EQUAL(1, received[0].size());
+    BOOST_REQUIRE_EQUAL(0, reactor.size());
+}
+
+BOOST_AUTO_TEST_CASE(it_dispatches_all_the_datagrams_received_in_a_batch)
+{
+    DriverTest driver;
+    driver.openURI("udp://127.0.0.1:1121?local_port=1122&batch=8");
+    DriverTest sender;
+    sender.openURI("udp://127.0.0.1:1122?local_port=1121");
+    reactor.add(driver, recorder(0));
+
+    char const* datagrams[] = { "\x00" "ab\x00", "\x00" "cd\x00", "\x00" "ef\x00" };
+    for (char const* datagram : datagrams)
+        sender.writePacket(reinterpret_cast<uint8_t const*>(datagram), 4);
+
+    BOOST_REQUIRE_EQUAL(3, reactor.poll(base::Time::fromMilliseconds(100)));
+    for (int i = 0; i < 3; ++i)
+        BOOST_REQUIRE_EQUAL(string(datagrams[i], 4), received[0][i]);
+}
+
+BOOST_AUTO_TEST_CASE(it_refuses_drivers_without_a_file_descriptor)
+{
+    DriverTest driver;
+    BOOST_REQUIRE_THROW(reactor.add(driver, recorder(0)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_refuses_to_register_a_driver_twice)
+{
+    reactor.add(drivers[0], recorder(0));
+    BOOST_REQUIRE_THROW(reactor.add(drivers[0], recorder(0)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
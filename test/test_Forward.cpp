@@ -1,5 +1,7 @@
 #include <boost/test/unit_test.hpp>
 
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -7,11 +9,32 @@
 
 #include <iodrivers_base/Driver.hpp>
 #include <iodrivers_base/Forward.hpp>
+#include <iodrivers_base/IOListener.hpp>
 #include <iodrivers_base/IOStream.hpp>
 
 using namespace std;
 using namespace iodrivers_base;
 
+/** Reads from the given socket until either size bytes are received or no
+ * data came for the given timeout
+ */
+static int readAll(int fd, uint8_t* data, int size, int timeout_ms = 1000)
+{
+    int total = 0;
+    while (total < size) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            break;
+        }
+        int c = ::read(fd, data + total, size - total);
+        if (c <= 0) {
+            break;
+        }
+        total += c;
+    }
+    return total;
+}
+
 /** Flow is
  *
  * RX/TX is defined w.r.t the forwarder. Flow of data is
@@ -100,6 +123,85 @@ BOOST_AUTO_TEST_CASE(it_forwards_data_from_right_to_left)
     t.join();
 }
 
+BOOST_AUTO_TEST_CASE(it_forwards_a_large_stream_unchanged)
+{
+    thread t([this] { forward(true, rxDriver, txDriver); });
+
+    vector<uint8_t> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = i * 7 + i / 256;
+    }
+    thread writer([this, &data] { write(data.data(), data.size()); });
+
+    vector<uint8_t> received(data.size());
+    BOOST_REQUIRE_EQUAL(data.size(),
+                        readAll(txSockets[1], received.data(), received.size()));
+    writer.join();
+    BOOST_REQUIRE(data == received);
+
+    close(rxSockets[0]);
+    close(txSockets[1]);
+    t.join();
+}
+
+BOOST_AUTO_TEST_CASE(it_passes_the_data_to_the_listeners)
+{
+    BufferListener* listener = new BufferListener;
+    txDriver.addListener(listener);
+    thread t([this] { forward(true, rxDriver, txDriver); });
+
+    uint8_t buffer[10] = { 1, 2, 3, 4, 5, 6 };
+    write(buffer, 10);
+    BOOST_REQUIRE_EQUAL(10, readAll(txSockets[1], buffer, 10));
+    close(rxSockets[0]);
+    close(txSockets[1]);
+    t.join();
+
+    auto written = listener->flushWrite();
+    BOOST_REQUIRE_EQUAL(10, written.size());
+    BOOST_REQUIRE_EQUAL(6, written[5]);
+}
+
+BOOST_AUTO_TEST_CASE(it_uses_the_second_timeout_for_the_data_received_from_the_second_driver)
+{
+    thread t([this] {
+        forward(true, rxDriver, txDriver,
+                base::Time(), base::Time::fromMilliseconds(300));
+    });
+
+    uint8_t buffer[10] = { 1, 2 };
+    ::write(txSockets[1], buffer, 1);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    ::write(txSockets[1], buffer + 1, 1);
+
+    BOOST_REQUIRE_EQUAL(2, ::read(rxSockets[0], buffer, 10));
+    close(rxSockets[0]);
+    close(txSockets[1]);
+    t.join();
+}
+
+BOOST_AUTO_TEST_CASE(it_keeps_forwarding_a_direction_while_the_other_is_stalled)
+{
+    thread t([this] { forward(true, rxDriver, txDriver); });
+
+    // Nobody reads on txSockets[1], fill all the buffers in between
+    vector<uint8_t> data(65536);
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(200);
+    while (chrono::steady_clock::now() < deadline) {
+        if (send(rxSockets[0], data.data(), data.size(), MSG_DONTWAIT) < 0) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    uint8_t buffer[4] = { 1, 2, 3, 4 };
+    ::write(txSockets[1], buffer, 4);
+    BOOST_REQUIRE_EQUAL(4, readAll(rxSockets[0], buffer, 4));
+
+    close(rxSockets[0]);
+    while (readAll(txSockets[1], data.data(), data.size()) > 0);
+    t.join();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
@@ -153,6 +255,20 @@ BOOST_AUTO_TEST_CASE(it_forwards_whole_packets_from_left_to_right)
     t.join();
 }
 
+BOOST_AUTO_TEST_CASE(it_forwards_packets_received_together)
+{
+    thread t([this] { forward(false, rxDriver, txDriver); });
+
+    uint8_t buffer[10] = { 1, 0, 2, 0, 3, 0 };
+    write(buffer, 6);
+    uint8_t readBuffer[10];
+    BOOST_REQUIRE_EQUAL(6, readAll(txSockets[1], readBuffer, 6));
+    BOOST_REQUIRE_EQUAL(3, readBuffer[4]);
+
+    close(rxSockets[0]);
+    t.join();
+}
+
 BOOST_AUTO_TEST_CASE(it_does_not_forward_partial_packets_from_left_to_right)
 {
     thread t([this] { forward(false, rxDriver, txDriver); });
@@ -198,3 +314,161 @@ BOOST_AUTO_TEST_CASE(it_does_not_forward_partial_packets_from_right_to_left)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+
+/** Flow is
+ *
+ * sourceSockets[0] <-> source <-> sinks[i] <-> sinkSockets[i][1]
+ */
+template <typename Driver>
+struct FanOutFixture {
+    int sourceSockets[2];
+    Driver source;
+    int sinkSockets[2][2];
+    Driver sinks[2];
+    vector<FanOutSinkStatus> result;
+    thread fanOutThread;
+
+    FanOutFixture() {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sourceSockets);
+        source.setFileDescriptor(sourceSockets[1]);
+        for (int i = 0; i < 2; ++i) {
+            socketpair(AF_UNIX, SOCK_STREAM, 0, sinkSockets[i]);
+            sinks[i].setFileDescriptor(sinkSockets[i][0]);
+        }
+    }
+
+    ~FanOutFixture() {
+        close(sourceSockets[0]);
+        if (fanOutThread.joinable()) {
+            fanOutThread.join();
+        }
+        for (int i = 0; i < 2; ++i) {
+            close(sinkSockets[i][1]);
+        }
+    }
+
+    void start(bool raw_mode) {
+        fanOutThread = thread([this, raw_mode] {
+            result = fanOut(raw_mode, source, { &sinks[0], &sinks[1] });
+        });
+    }
+
+    void join() {
+        fanOutThread.join();
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(FanOutSuite_RawMode, FanOutFixture<RawForwardDriver>)
+
+BOOST_AUTO_TEST_CASE(it_sends_the_source_data_to_all_sinks)
+{
+    start(true);
+
+    uint8_t buffer[10] = { 1, 2, 3, 4, 5, 6 };
+    ::write(sourceSockets[0], buffer, 10);
+    for (int i = 0; i < 2; ++i) {
+        uint8_t received[10];
+        BOOST_REQUIRE_EQUAL(10, readAll(sinkSockets[i][1], received, 10));
+        BOOST_REQUIRE_EQUAL(6, received[5]);
+    }
+
+    close(sourceSockets[0]);
+    join();
+    BOOST_REQUIRE(!result[0].closed);
+    BOOST_REQUIRE_EQUAL(0, result[0].dropped_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(it_sends_the_sink_data_to_the_source)
+{
+    start(true);
+
+    uint8_t buffer[4] = { 1, 2, 3, 4 };
+    ::write(sinkSockets[0][1], buffer, 2);
+    BOOST_REQUIRE_EQUAL(2, readAll(sourceSockets[0], buffer, 2));
+    ::write(sinkSockets[1][1], buffer + 2, 2);
+    BOOST_REQUIRE_EQUAL(2, readAll(sourceSockets[0], buffer, 2));
+    BOOST_REQUIRE_EQUAL(3, buffer[0]);
+}
+
+BOOST_AUTO_TEST_CASE(it_drops_the_data_of_a_sink_that_does_not_keep_up)
+{
+    // sinks[0] can hold all the data regardless of the reader's
+    // scheduling, while sinks[1] is never read
+    vector<uint8_t> data(2 * 1024 * 1024, 1);
+    sinks[0].setWriteQueueSize(data.size());
+    start(true);
+
+    int received = 0;
+    thread reader([this, &received, &data] {
+        vector<uint8_t> buffer(65536);
+        while (received < static_cast<int>(data.size())) {
+            int c = readAll(sinkSockets[0][1], buffer.data(), buffer.size());
+            if (c == 0) {
+                break;
+            }
+            received += c;
+        }
+    });
+    BOOST_REQUIRE_EQUAL(data.size(), ::write(sourceSockets[0], data.data(), data.size()));
+    reader.join();
+
+    close(sourceSockets[0]);
+    join();
+    BOOST_REQUIRE_EQUAL(data.size(), received);
+    BOOST_REQUIRE_EQUAL(0, result[0].dropped_bytes);
+    BOOST_REQUIRE(result[1].dropped_bytes > 0);
+}
+
+BOOST_AUTO_TEST_CASE(it_removes_the_sinks_that_close)
+{
+    signal(SIGPIPE, SIG_IGN);
+    start(true);
+
+    close(sinkSockets[1][1]);
+    uint8_t buffer[10] = { 1, 2, 3, 4, 5, 6 };
+    for (int i = 0; i < 3; ++i) {
+        ::write(sourceSockets[0], buffer, 10);
+        BOOST_REQUIRE_EQUAL(10, readAll(sinkSockets[0][1], buffer, 10));
+    }
+
+    close(sourceSockets[0]);
+    join();
+    BOOST_REQUIRE(!result[0].closed);
+    BOOST_REQUIRE(result[1].closed);
+    sinkSockets[1][1] = -1;
+}
+
+BOOST_AUTO_TEST_CASE(it_returns_when_all_the_sinks_are_closed)
+{
+    start(true);
+
+    close(sinkSockets[0][1]);
+    close(sinkSockets[1][1]);
+    join();
+    BOOST_REQUIRE(result[0].closed);
+    BOOST_REQUIRE(result[1].closed);
+    sinkSockets[0][1] = sinkSockets[1][1] = -1;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(FanOutSuite_PacketMode, FanOutFixture<PacketForwardDriver>)
+
+BOOST_AUTO_TEST_CASE(it_sends_whole_packets_to_all_sinks)
+{
+    start(false);
+
+    uint8_t buffer[10] = { 1, 2, 3, 0, 4 };
+    ::write(sourceSockets[0], buffer, 5);
+    for (int i = 0; i < 2; ++i) {
+        uint8_t received[10];
+        BOOST_REQUIRE_EQUAL(4, readAll(sinkSockets[i][1], received, 10, 100));
+        BOOST_REQUIRE_EQUAL(3, received[2]);
+    }
+
+    close(sourceSockets[0]);
+    join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
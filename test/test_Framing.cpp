@@ -0,0 +1,131 @@
+#include <boost/test/unit_test.hpp>
+
+#include <iodrivers_base/Framing.hpp>
+#include <iodrivers_base/TestStream.hpp>
+
+using namespace std;
+using namespace iodrivers_base;
+
+BOOST_AUTO_TEST_SUITE(FramingSuite)
+
+BOOST_AUTO_TEST_CASE(it_extracts_little_endian_length_prefixed_packets)
+{
+    LengthPrefixedFraming framing(2, false, 100);
+    uint8_t buffer[] = { 3, 0, 1, 2, 3, 4 };
+    BOOST_REQUIRE_EQUAL(0, framing.extractPacket(buffer, 1));
+    BOOST_REQUIRE_EQUAL(0, framing.extractPacket(buffer, 4));
+    BOOST_REQUIRE_EQUAL(5, framing.extractPacket(buffer, 6));
+}
+
+BOOST_AUTO_TEST_CASE(it_extracts_big_endian_length_prefixed_packets)
+{
+    LengthPrefixedFraming framing(4, true, 100);
+    uint8_t buffer[] = { 0, 0, 0, 1, 42 };
+    BOOST_REQUIRE_EQUAL(5, framing.extractPacket(buffer, 5));
+}
+
+BOOST_AUTO_TEST_CASE(it_skips_a_byte_if_the_length_is_above_the_max_packet_size)
+{
+    LengthPrefixedFraming framing(1, false, 10);
+    uint8_t buffer[] = { 10, 0 };
+    BOOST_REQUIRE_EQUAL(-1, framing.extractPacket(buffer, 2));
+}
+
+BOOST_AUTO_TEST_CASE(it_extracts_delimited_packets)
+{
+    DelimiterFraming framing('\n', 100);
+    uint8_t buffer[] = { 'a', 'b', '\n', 'c' };
+    BOOST_REQUIRE_EQUAL(0, framing.extractPacket(buffer, 2));
+    BOOST_REQUIRE_EQUAL(3, framing.extractPacket(buffer, 4));
+}
+
+BOOST_AUTO_TEST_CASE(it_discards_data_without_delimiter_once_the_max_packet_size_is_reached)
+{
+    DelimiterFraming framing('\n', 4);
+    uint8_t buffer[] = { 'a', 'b', 'c', 'd', '\n' };
+    BOOST_REQUIRE_EQUAL(-4, framing.extractPacket(buffer, 4));
+    BOOST_REQUIRE_EQUAL(-5, framing.extractPacket(buffer, 5));
+}
+
+BOOST_AUTO_TEST_CASE(it_extracts_slip_frames)
+{
+    SLIPFraming framing(100);
+    uint8_t buffer[] = { 0xC0, 1, 0xDB, 0xDC, 2, 0xC0 };
+    BOOST_REQUIRE_EQUAL(-1, framing.extractPacket(buffer, 6));
+    BOOST_REQUIRE_EQUAL(0, framing.extractPacket(buffer + 1, 4));
+    BOOST_REQUIRE_EQUAL(5, framing.extractPacket(buffer + 1, 5));
+}
+
+BOOST_AUTO_TEST_CASE(it_extracts_cobs_frames)
+{
+    COBSFraming framing(100);
+    // Encoding of { 0x11, 0x00, 0x22 }
+    uint8_t buffer[] = { 0, 2, 0x11, 2, 0x22, 0 };
+    BOOST_REQUIRE_EQUAL(-1, framing.extractPacket(buffer, 6));
+    BOOST_REQUIRE_EQUAL(0, framing.extractPacket(buffer + 1, 4));
+    BOOST_REQUIRE_EQUAL(5, framing.extractPacket(buffer + 1, 5));
+}
+
+BOOST_AUTO_TEST_CASE(it_skips_invalid_cobs_frames)
+{
+    COBSFraming framing(100);
+    uint8_t buffer[] = { 3, 0x11, 0 };
+    BOOST_REQUIRE_EQUAL(-3, framing.extractPacket(buffer, 3));
+}
+
+BOOST_AUTO_TEST_CASE(it_creates_the_framings_from_their_description)
+{
+    BOOST_REQUIRE(!Framing::fromString("raw", 100));
+    BOOST_REQUIRE(dynamic_cast<SLIPFraming*>(Framing::fromString("slip", 100).get()));
+    BOOST_REQUIRE(dynamic_cast<COBSFraming*>(Framing::fromString("cobs", 100).get()));
+    BOOST_REQUIRE(dynamic_cast<LengthPrefixedFraming*>(
+        Framing::fromString("length:2:be", 100).get()));
+
+    auto delimiter = Framing::fromString("delimiter:0x0a", 100);
+    uint8_t buffer[] = { 'a', '\n' };
+    BOOST_REQUIRE_EQUAL(2, delimiter->extractPacket(buffer, 2));
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_on_invalid_descriptions)
+{
+    BOOST_REQUIRE_THROW(Framing::fromString("unknown", 100), std::invalid_argument);
+    BOOST_REQUIRE_THROW(Framing::fromString("length:3", 100), std::invalid_argument);
+    BOOST_REQUIRE_THROW(Framing::fromString("length:2:xx", 100), std::invalid_argument);
+    BOOST_REQUIRE_THROW(Framing::fromString("delimiter:256", 100), std::invalid_argument);
+    BOOST_REQUIRE_THROW(Framing::fromString("delimiter:a", 100), std::invalid_argument);
+    BOOST_REQUIRE_THROW(Framing::fromString("slip:1", 100), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_if_the_plugin_cannot_be_loaded)
+{
+    BOOST_REQUIRE_THROW(Framing::fromString("plugin:/does/not/exist.so", 100),
+                        std::runtime_error);
+    BOOST_REQUIRE_THROW(
+        Framing::fromString("plugin:libc.so.6:does_not_exist", 100),
+        std::runtime_error
+    );
+}
+
+BOOST_AUTO_TEST_CASE(it_reads_packets_with_the_driver_framing)
+{
+    FramingDriver driver(100, Framing::fromString("delimiter:0", 100));
+    driver.openURI("test://");
+    uint8_t data[] = { 1, 2, 0, 3, 0 };
+    static_cast<TestStream*>(driver.getMainStream())->pushDataToDriver(
+        vector<uint8_t>(data, data + 5));
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(3, driver.readPacket(buffer, 100));
+    BOOST_REQUIRE_EQUAL(2, driver.readPacket(buffer, 100));
+    BOOST_REQUIRE_EQUAL(3, buffer[0]);
+}
+
+BOOST_AUTO_TEST_CASE(it_does_not_extract_packets_without_framing)
+{
+    FramingDriver driver(100);
+    BOOST_REQUIRE(!driver.getFraming());
+    uint8_t data[] = { 1, 2, 0 };
+    BOOST_REQUIRE_EQUAL(0, driver.extractPacket(data, 3));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,166 @@
+#include <boost/test/unit_test.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/DriverReactor.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+#include <iodrivers_base/IOUringStream.hpp>
+
+#include "DriverTest.hpp"
+
+using namespace std;
+using namespace iodrivers_base;
+
+struct IOUringFixture : TestPipe {
+    DriverTest driver;
+};
+
+static boost::test_tools::assertion_result ioUringSupported(boost::unit_test::test_unit_id)
+{
+    boost::test_tools::assertion_result result(IOUringStream::isSupported());
+    result.message() << "io_uring is not supported on this system";
+    return result;
+}
+
+BOOST_FIXTURE_TEST_SUITE(IOUringStreamSuite, IOUringFixture)
+
+BOOST_AUTO_TEST_CASE(it_reads_packets_through_the_driver,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    driver.setMainStream(new IOUringStream(rx, true));
+    uint8_t data[] = { 0, 'a', 'b', 0, 0, 'c', 'd', 0 };
+    write(data, 8);
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, driver.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL('a', buffer[1]);
+    BOOST_REQUIRE_EQUAL(4, driver.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL('c', buffer[1]);
+}
+
+BOOST_AUTO_TEST_CASE(it_times_out_if_no_data_is_available,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    driver.setMainStream(new IOUringStream(rx, true));
+    uint8_t buffer[100];
+    BOOST_REQUIRE_THROW(
+        driver.readPacket(buffer, 100, base::Time::fromMilliseconds(10)),
+        TimeoutError
+    );
+}
+
+BOOST_AUTO_TEST_CASE(it_reports_eof,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    IOUringStream* stream = new IOUringStream(rx, true);
+    driver.setMainStream(stream);
+    uint8_t data[] = { 0, 'a', 'b', 0 };
+    write(data, 4);
+    close(tx);
+    tx = -1;
+
+    BOOST_REQUIRE(stream->waitRead(base::Time::fromMilliseconds(100)));
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, stream->read(buffer, 100));
+    BOOST_REQUIRE(stream->waitRead(base::Time::fromMilliseconds(100)));
+    BOOST_REQUIRE_EQUAL(0, stream->read(buffer, 100));
+    BOOST_REQUIRE(stream->eof());
+}
+
+BOOST_AUTO_TEST_CASE(it_writes_packets_through_the_driver,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    driver.setMainStream(new IOUringStream(tx, true));
+    tx = -1;
+    uint8_t data[] = { 0, 'a', 'b', 0 };
+    for (int i = 0; i < 10; ++i)
+        driver.writePacket(data, 4);
+
+    // Writes are asynchronous, wait for the last one to be processed
+    uint8_t buffer[40];
+    size_t received = 0;
+    while (received < 40) {
+        ssize_t ret = ::read(rx, buffer + received, 40 - received);
+        BOOST_REQUIRE(ret > 0);
+        received += ret;
+    }
+    for (int i = 0; i < 10; ++i)
+        BOOST_REQUIRE_EQUAL('a', buffer[i * 4 + 1]);
+    close(rx);
+}
+
+BOOST_AUTO_TEST_CASE(it_restores_the_file_descriptor_flags_on_destruction,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    fcntl(rx, F_SETFL, fcntl(rx, F_GETFL) | O_NONBLOCK);
+    delete new IOUringStream(rx, false);
+    BOOST_REQUIRE(fcntl(rx, F_GETFL) & O_NONBLOCK);
+    close(rx);
+}
+
+BOOST_AUTO_TEST_CASE(it_signals_readable_data_on_its_file_descriptor,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    IOUringStream* stream = new IOUringStream(rx, true);
+    driver.setMainStream(stream);
+    BOOST_REQUIRE(driver.getFileDescriptor() != rx);
+
+    pollfd fd = { driver.getFileDescriptor(), POLLIN, 0 };
+    BOOST_REQUIRE_EQUAL(0, ::poll(&fd, 1, 10));
+    uint8_t data[] = { 0, 'a', 'b', 0 };
+    write(data, 4);
+    BOOST_REQUIRE_EQUAL(1, ::poll(&fd, 1, 100));
+
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, stream->read(buffer, 100));
+    BOOST_REQUIRE_EQUAL(0, ::poll(&fd, 1, 10));
+}
+
+BOOST_AUTO_TEST_CASE(it_dispatches_packets_through_a_reactor,
+                     *boost::unit_test::precondition(ioUringSupported))
+{
+    driver.setMainStream(new IOUringStream(rx, true));
+    vector<string> received;
+    DriverReactor reactor;
+    reactor.add(driver, [&received](PacketView const& packet) {
+        received.push_back(string(
+            reinterpret_cast<char const*>(packet.data), packet.size
+        ));
+    });
+
+    write("\x00" "ab\x00" "\x00" "cd\x00", 8);
+    base::Time deadline = base::Time::now() + base::Time::fromSeconds(1);
+    while (received.size() < 2 && base::Time::now() < deadline)
+        reactor.poll(base::Time::fromMilliseconds(100));
+
+    BOOST_REQUIRE_EQUAL(2, received.size());
+    BOOST_REQUIRE_EQUAL(string("\x00" "ab\x00", 4), received[0]);
+    BOOST_REQUIRE_EQUAL(string("\x00" "cd\x00", 4), received[1]);
+}
+
+BOOST_AUTO_TEST_CASE(it_uses_io_uring_when_given_the_io_uring_option)
+{
+    driver.openURI("fd://" + to_string(rx) + "?io_uring=1");
+    if (IOUringStream::isSupported())
+        BOOST_REQUIRE(dynamic_cast<IOUringStream*>(driver.getMainStream()));
+    else
+        BOOST_REQUIRE(dynamic_cast<FDStream*>(driver.getMainStream()));
+    BOOST_REQUIRE_EQUAL(rx, driver.getDeviceFileDescriptor());
+
+    uint8_t data[] = { 0, 'a', 'b', 0 };
+    write(data, 4);
+    uint8_t buffer[100];
+    BOOST_REQUIRE_EQUAL(4, driver.readPacket(buffer, 100, base::Time::fromMilliseconds(100)));
+}
+
+BOOST_AUTO_TEST_CASE(it_rejects_the_io_uring_option_on_streams_that_do_not_support_it)
+{
+    close(rx);
+    BOOST_REQUIRE_THROW(driver.openURI("test://?io_uring=1"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
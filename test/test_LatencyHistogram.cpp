@@ -0,0 +1,77 @@
+#include <boost/test/unit_test.hpp>
+
+#include <iodrivers_base/LatencyHistogram.hpp>
+
+using namespace iodrivers_base;
+
+BOOST_AUTO_TEST_SUITE(LatencyHistogramSuite)
+
+BOOST_AUTO_TEST_CASE(it_stores_small_values_in_their_own_bucket)
+{
+    for (uint64_t i = 0; i < LatencyHistogram::SUB_BUCKETS; ++i) {
+        BOOST_REQUIRE_EQUAL(i, LatencyHistogram::getBucketIndex(i));
+        BOOST_REQUIRE_EQUAL(i, LatencyHistogram::getBucketLowerBound(i));
+        BOOST_REQUIRE_EQUAL(i, LatencyHistogram::getBucketUpperBound(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(its_buckets_cover_all_values_without_overlap)
+{
+    for (size_t i = 0; i < LatencyHistogram::BUCKET_COUNT - 1; ++i) {
+        uint64_t lower = LatencyHistogram::getBucketLowerBound(i);
+        uint64_t upper = LatencyHistogram::getBucketUpperBound(i);
+        BOOST_REQUIRE_EQUAL(i, LatencyHistogram::getBucketIndex(lower));
+        BOOST_REQUIRE_EQUAL(i, LatencyHistogram::getBucketIndex(upper));
+        BOOST_REQUIRE_EQUAL(upper + 1, LatencyHistogram::getBucketLowerBound(i + 1));
+        // The bucket width is at most 1/16th of its values
+        BOOST_REQUIRE((upper - lower) * LatencyHistogram::SUB_BUCKETS <= lower);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(it_stores_very_large_values_in_the_last_bucket)
+{
+    BOOST_REQUIRE_EQUAL(LatencyHistogram::BUCKET_COUNT - 1,
+                        LatencyHistogram::getBucketIndex(UINT64_MAX));
+}
+
+BOOST_AUTO_TEST_CASE(it_returns_an_empty_snapshot_if_nothing_was_recorded)
+{
+    LatencyHistogram histogram;
+    LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+    BOOST_REQUIRE_EQUAL(0, snapshot.count);
+    BOOST_REQUIRE_EQUAL(0, snapshot.min_ns);
+    BOOST_REQUIRE_EQUAL(0, snapshot.getMean());
+    BOOST_REQUIRE_EQUAL(0, snapshot.getPercentile(99));
+}
+
+BOOST_AUTO_TEST_CASE(it_computes_statistics_on_the_recorded_values)
+{
+    LatencyHistogram histogram;
+    for (uint64_t i = 1; i <= 100; ++i)
+        histogram.record(i * 1000);
+
+    LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+    BOOST_REQUIRE_EQUAL(100, snapshot.count);
+    BOOST_REQUIRE_EQUAL(1000, snapshot.min_ns);
+    BOOST_REQUIRE_EQUAL(100000, snapshot.max_ns);
+    BOOST_REQUIRE_EQUAL(50500, snapshot.getMean());
+
+    uint64_t median = snapshot.getPercentile(50);
+    BOOST_REQUIRE(median >= 50000 && median < 50000 * 17 / 16);
+    BOOST_REQUIRE_EQUAL(100000, snapshot.getPercentile(100));
+}
+
+BOOST_AUTO_TEST_CASE(it_is_emptied_by_reset)
+{
+    LatencyHistogram histogram;
+    histogram.record(10);
+    histogram.reset();
+    histogram.record(20);
+
+    LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+    BOOST_REQUIRE_EQUAL(1, snapshot.count);
+    BOOST_REQUIRE_EQUAL(20, snapshot.min_ns);
+    BOOST_REQUIRE_EQUAL(20, snapshot.max_ns);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,53 @@
+#include <boost/test/unit_test.hpp>
+
+#include <iodrivers_base/URI.hpp>
+#include <iodrivers_base/SocketConfiguration.hpp>
+
+using namespace std;
+using namespace iodrivers_base;
+
+BOOST_AUTO_TEST_SUITE(SocketConfiguration_fromURI)
+
+BOOST_AUTO_TEST_CASE(it_leaves_all_options_unset_by_default) {
+    URI uri("", "", 0, { });
+    auto conf = SocketConfiguration::fromURI(uri);
+    BOOST_TEST(conf.empty());
+    BOOST_TEST(conf.nodelay == -1);
+    BOOST_TEST(conf.receive_buffer_size == -1);
+}
+
+BOOST_AUTO_TEST_CASE(it_sets_the_options_from_the_uri) {
+    URI uri("", "", 0, { { "nodelay", "0" }, { "quickack", "1" },
+                         { "rcvbuf", "65536" }, { "sndbuf", "32768" },
+                         { "busy_poll", "50" }, { "priority", "6" } });
+    auto conf = SocketConfiguration::fromURI(uri);
+    BOOST_TEST(!conf.empty());
+    BOOST_TEST(conf.nodelay == 0);
+    BOOST_TEST(conf.quickack == 1);
+    BOOST_TEST(conf.receive_buffer_size == 65536);
+    BOOST_TEST(conf.send_buffer_size == 32768);
+    BOOST_TEST(conf.busy_poll == 50);
+    BOOST_TEST(conf.priority == 6);
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_if_a_flag_is_not_0_or_1) {
+    URI uri("", "", 0, { { "nodelay", "2" } });
+    BOOST_REQUIRE_THROW(SocketConfiguration::fromURI(uri), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_if_a_buffer_size_is_zero) {
+    URI uri("", "", 0, { { "rcvbuf", "0" } });
+    BOOST_REQUIRE_THROW(SocketConfiguration::fromURI(uri), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_if_a_value_is_not_a_number) {
+    URI uri("", "", 0, { { "sndbuf", "64k" } });
+    BOOST_REQUIRE_THROW(SocketConfiguration::fromURI(uri), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_throws_if_a_value_is_negative) {
+    URI uri("", "", 0, { { "priority", "-1" } });
+    BOOST_REQUIRE_THROW(SocketConfiguration::fromURI(uri), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()